@@ -0,0 +1,174 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "base.h"
+
+u64 get_page_size(void) {
+#if defined(__APPLE__) || defined(__linux__)
+    return (u64)getpagesize();
+#endif
+}
+
+void* reserve_memory(u64 size) {
+#if defined(__APPLE__) || defined(__linux__)
+    // Reserve address space only; pages become usable once they are committed
+    void* result = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return result == MAP_FAILED ? NULL : result;
+#endif
+}
+
+void* commit_memory(void* addr, u64 size) {
+#if defined(__APPLE__) || defined(__linux__)
+    // Physical pages are still only backed on first touch, but the range has to be made
+    // accessible before anything can be written to it
+    if (mprotect(addr, size, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+    return addr;
+#endif
+}
+
+bool decommit_memory(void* addr, u64 size) {
+#if defined(__APPLE__)
+    // On MacOS, use madvise to indicate that the memory is no longer needed
+    if (madvise(addr, size, MADV_FREE) != 0) {
+        return false;
+    }
+#elif defined(__linux__)
+    // On Linux, use MADV_DONTNEED instead of MADV_FREE
+    if (madvise(addr, size, MADV_DONTNEED) != 0) {
+        return false;
+    }
+#endif
+    return mprotect(addr, size, PROT_NONE) == 0;
+}
+
+bool release_memory(void* addr, u64 size) {
+#if defined(__APPLE__) || defined(__linux__)
+    return munmap(addr, size) == 0;
+#endif
+}
+
+// Commits happen in chunks of this size so that small pushes don't each cost an mprotect call
+#define ARENA_COMMIT_SIZE KB(64)
+// Committed memory kept around by `arena_clear` so the next directory can reuse it for free
+#define ARENA_RETAIN_SIZE MB(4)
+
+/// @brief A file mapping whose lifetime is tied to the arena's contents
+typedef struct ArenaMapping {
+    struct ArenaMapping* next;
+    void* addr;
+    u64 size;
+} ArenaMapping;
+
+typedef struct {
+    void* base;
+    u64 reserved;
+    u64 committed;
+    u64 used;
+    u64 peak; // high-water mark of `used`
+    ArenaMapping* mappings; // unmapped by `arena_clear` and `arena_release`
+} Arena;
+
+Arena arena_create(u64 reserve_size) {
+    const u64 page_size = get_page_size();
+    reserve_size = ALIGN_UP_POW2(reserve_size, page_size);
+
+    void* base = reserve_memory(reserve_size);
+    if (base == NULL) {
+        LOG_ERROR(
+            "Failed to reserve %llu bytes of address space\n", (unsigned long long)reserve_size);
+        exit(1);
+    }
+
+    // clang-format off
+    return (Arena){
+        .base = base,
+        .reserved = reserve_size,
+        .committed = 0,
+        .used = 0,
+        .peak = 0,
+        .mappings = NULL
+    };
+    // clang-format on
+}
+
+void* arena_push(Arena* arena, u64 size, u64 alignment) {
+    assert((alignment & (alignment - 1)) == 0); // alignment must be power of 2
+
+    const u64 aligned_used = ALIGN_UP_POW2(arena->used, alignment);
+    const u64 newUsed = aligned_used + size;
+
+    if (newUsed > arena->reserved) {
+        LOG_ERROR(
+            "Arena out of memory: requested %llu bytes, but only %llu bytes "
+            "reserved\n",
+            (unsigned long long)newUsed,
+            (unsigned long long)arena->reserved);
+        exit(1);
+    }
+
+    if (newUsed > arena->committed) {
+        // `arena->reserved` is aligned to the page size, and so is `ARENA_COMMIT_SIZE`, so
+        // clamping to the reservation keeps `new_commit` page aligned.
+        u64 new_commit = ALIGN_UP_POW2(newUsed, ARENA_COMMIT_SIZE);
+        if (new_commit > arena->reserved) {
+            new_commit = arena->reserved;
+        }
+        char* start = (char*)arena->base + arena->committed;
+        u64 commit_size = new_commit - arena->committed;
+        if (commit_memory(start, commit_size) == NULL) {
+            LOG_ERROR("Failed to commit %llu bytes\n", (unsigned long long)commit_size);
+            exit(1);
+        }
+        arena->committed = new_commit;
+    }
+
+    void* result = (char*)arena->base + aligned_used;
+    arena->used = newUsed;
+    if (newUsed > arena->peak) {
+        arena->peak = newUsed;
+    }
+    return result;
+}
+
+/// @brief Unmap `addr` the next time the arena is cleared or released
+void arena_track_mapping(Arena* arena, void* addr, u64 size) {
+    ArenaMapping* mapping = arena_push(arena, sizeof(ArenaMapping), ALIGNMENT);
+    *mapping = (ArenaMapping){.next = arena->mappings, .addr = addr, .size = size};
+    arena->mappings = mapping;
+}
+
+void arena_unmap_all(Arena* arena) {
+    for (ArenaMapping* m = arena->mappings; m; m = m->next) {
+        munmap(m->addr, m->size);
+    }
+    arena->mappings = NULL;
+}
+
+void arena_clear(Arena* arena) {
+    arena_unmap_all(arena);
+    arena->used = 0;
+
+    // Hand back whatever a large directory made us commit, but keep enough around that
+    // a run of small directories doesn't keep faulting pages back in
+    if (arena->committed > ARENA_RETAIN_SIZE) {
+        char* start = (char*)arena->base + ARENA_RETAIN_SIZE;
+        if (decommit_memory(start, arena->committed - ARENA_RETAIN_SIZE)) {
+            arena->committed = ARENA_RETAIN_SIZE;
+        }
+    }
+}
+
+bool arena_release(Arena* arena) {
+    arena_unmap_all(arena);
+    const bool result = release_memory(arena->base, arena->reserved);
+    *arena = (Arena){0};
+    return result;
+}
+
+#endif // ARENA_H
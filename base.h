@@ -0,0 +1,42 @@
+#ifndef BASE_H
+#define BASE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// clang-format off
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t  u8;
+typedef int64_t  i64;
+typedef int32_t  i32;
+typedef int16_t  i16;
+typedef int8_t   i8;
+// clang-format on
+
+#define LOG_ERROR(...) fprintf(stderr, "[ERROR] " __VA_ARGS__)
+#define LOG_WARN(...) fprintf(stderr, "[WARN] " __VA_ARGS__)
+#define LOG_INFO(...) fprintf(stderr, "[INFO] " __VA_ARGS__)
+
+#define ALIGNMENT 16
+#define ALIGN_UP_POW2(n, pow2) (((u64)(n) + ((u64)(pow2) - 1)) & (~((u64)(pow2) - 1)))
+
+#define KB(n) ((u64)(n) << 10)
+#define MB(n) ((u64)(n) << 20)
+#define GB(n) ((u64)(n) << 30)
+
+// Output and source paths, kept apart from the libc's or the kernel's PATH_MAX so every module
+// agrees on one size whatever the include order
+#define MKSITE_PATH_MAX 1024
+
+/// @brief Non-owning view of a string, usually pointing into a page's source
+typedef struct {
+    const char* data;
+    u32 len;
+} Str;
+
+#define STR_LIT(lit) ((Str){(lit), sizeof(lit) - 1})
+
+#endif // BASE_H
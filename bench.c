@@ -0,0 +1,559 @@
+// Benchmark harness: generates a synthetic corpus and times each phase of a build separately,
+// then the renderer's byte loops on their own in nanoseconds per byte.
+//
+// The generator is built as a unity build on top of main.c, so it measures exactly the code
+// the real binary runs.
+
+#define MKSITE_NO_MAIN
+#include "main.c"
+
+typedef struct {
+    u32 posts;
+    u32 post_size;          // average bytes of body text per post
+    double heading_density; // chance that a block is a heading rather than a paragraph
+    double inline_density;  // chance that a word is wrapped in an inline format marker
+    u32 runs;
+    u64 seed;
+    const char* dir;
+    const char* save_path;
+    const char* baseline_path;
+    double threshold; // allowed slowdown against the baseline, in percent
+} BenchConfig;
+
+typedef enum {
+    PHASE_IMPORT,
+    PHASE_RENDER,
+    PHASE_INDEX,
+    PHASE_WRITE,
+    PHASE_COUNT
+} Phase;
+
+const char* PHASE_NAMES[PHASE_COUNT] = {"import", "render", "index", "write"};
+
+// The hand-written loops every page goes through, timed one at a time over the whole corpus
+typedef enum {
+    KERNEL_SLUGIFY,      // titles
+    KERNEL_FRONT_MATTER, // everything up to the closing ---
+    KERNEL_FORMAT_TYPE,  // every byte of the content
+    KERNEL_INLINE,       // every line of the content
+    KERNEL_PARSE,        // the content's block structure, headings included
+    KERNEL_COUNT
+} Kernel;
+
+const char* KERNEL_NAMES[KERNEL_COUNT] = {
+    "slugify", "front_matter", "format_type", "inline", "parse"};
+
+// Each kernel sample goes over at least this much input, so the ones with little to do (titles,
+// front matter) still take long enough to time
+#define KERNEL_MIN_BYTES MB(4)
+
+typedef struct {
+    double samples[PHASE_COUNT][256]; // milliseconds
+    u64 bytes[PHASE_COUNT];           // bytes processed by one run of each phase
+    double kernel_samples[KERNEL_COUNT][256]; // nanoseconds per byte
+    u64 kernel_bytes[KERNEL_COUNT];           // bytes in one pass of each kernel
+} BenchResults;
+
+static u64 rng_state;
+
+u64 rng_next() {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+double rng_unit() {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+const char* WORDS[] = {
+    "the",    "quick",  "brown",     "fox",     "jumps",   "over",    "lazy",     "dog",
+    "arena",  "buffer", "pointer",   "page",    "render",  "static",  "site",     "memory",
+    "thread", "cache",  "allocator", "syscall", "compile", "kernel",  "latency",  "vector",
+    "string", "format", "snprintf",  "journal", "boba",    "writing", "generator", "index",
+};
+#define WORD_COUNT (sizeof(WORDS) / sizeof(WORDS[0]))
+
+void gen_words(Buf* out, u32 count, double inline_density) {
+    static const char* MARKERS[] = {"**", "__", "==", "`"};
+    for (u32 i = 0; i < count; ++i) {
+        if (i > 0) {
+            buf_char(out, ' ');
+        }
+        const char* word = WORDS[rng_next() % WORD_COUNT];
+        if (rng_unit() < inline_density) {
+            const char* marker = MARKERS[rng_next() % 4];
+            buf_str(out, marker);
+            buf_str(out, word);
+            buf_str(out, marker);
+        } else {
+            buf_str(out, word);
+        }
+    }
+}
+
+/// @brief Write `cfg->posts` synthetic posts to `posts_dir`, returns the total source bytes
+u64 gen_corpus(const BenchConfig* cfg, Arena* arena, const char* posts_dir) {
+    u64 total = 0;
+    for (u32 i = 0; i < cfg->posts; ++i) {
+        Buf out = buf_create(arena, cfg->post_size * 2 + 256);
+
+        char header[256];
+        int len = snprintf(
+            header,
+            sizeof(header),
+            "title: Synthetic post %u\ndate: %04u-%02u-%02u\n---\n\n",
+            i,
+            2000 + (u32)(rng_next() % 27),
+            1 + (u32)(rng_next() % 12),
+            1 + (u32)(rng_next() % 28));
+        buf_write(&out, header, len);
+
+        // Sizes vary between half and one and a half times the average
+        const u64 target = out.len + cfg->post_size / 2 + rng_next() % (cfg->post_size + 1);
+        while (out.len < target) {
+            if (rng_unit() < cfg->heading_density) {
+                buf_str(&out, "## ");
+                gen_words(&out, 2 + (u32)(rng_next() % 5), cfg->inline_density);
+                buf_lit(&out, "\n\n");
+            } else {
+                const u32 lines = 1 + (u32)(rng_next() % 4);
+                for (u32 l = 0; l < lines; ++l) {
+                    gen_words(&out, 6 + (u32)(rng_next() % 12), cfg->inline_density);
+                    buf_char(&out, '\n');
+                }
+                buf_char(&out, '\n');
+            }
+        }
+
+        char path[MKSITE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/post-%06u.txt", posts_dir, i);
+        if (!buf_write_file(&out, path)) {
+            LOG_ERROR("Failed to write %s\n", path);
+            exit(1);
+        }
+        total += out.len;
+        arena_clear(arena);
+    }
+    return total;
+}
+
+double now_ms() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+void bench_run(const char* posts_dir, const char* out_dir, BenchResults* results, u32 run) {
+    Arena arena = arena_create(GB(64));
+    Arena page_arena = arena_create(GB(4));
+    double t0 = now_ms();
+
+    Page* pages = NULL;
+    u32 page_count = 0;
+    import_pages(posts_dir, &arena, &page_arena, &pages, &page_count, NULL, NULL);
+    double t1 = now_ms();
+
+    Buf* rendered = arena_push(&arena, sizeof(Buf) * page_count, ALIGNMENT);
+    u64 rendered_bytes = 0;
+    for (u32 i = 0; i < page_count; ++i) {
+        rendered[i] = buf_create(&arena, KB(16));
+        build_page(&rendered[i], &pages[i], NULL);
+        rendered_bytes += rendered[i].len;
+    }
+    double t2 = now_ms();
+
+    sort_pages(pages, page_count, SORT_NEWEST, &arena);
+    Buf index = buf_create(&arena, KB(64));
+    render_index(&index, pages, page_count);
+    double t3 = now_ms();
+
+    for (u32 i = 0; i < page_count; ++i) {
+        char path[MKSITE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s.html", out_dir, pages[i].slug.data);
+        buf_write_file(&rendered[i], path);
+    }
+    char index_path[MKSITE_PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s/index.html", out_dir);
+    buf_write_file(&index, index_path);
+    double t4 = now_ms();
+
+    u64 source_bytes = 0;
+    for (u32 i = 0; i < page_count; ++i) {
+        source_bytes += pages[i].source_size;
+    }
+
+    results->samples[PHASE_IMPORT][run] = t1 - t0;
+    results->samples[PHASE_RENDER][run] = t2 - t1;
+    results->samples[PHASE_INDEX][run] = t3 - t2;
+    results->samples[PHASE_WRITE][run] = t4 - t3;
+    results->bytes[PHASE_IMPORT] = source_bytes;
+    results->bytes[PHASE_RENDER] = source_bytes;
+    results->bytes[PHASE_INDEX] = index.len;
+    results->bytes[PHASE_WRITE] = rendered_bytes + index.len;
+
+    arena_release(&arena);
+    arena_release(&page_arena);
+}
+
+// Keeps the compiler from dropping kernels whose results are otherwise unused
+static volatile u64 bench_sink;
+
+/// @brief Run `kernel` once over every page, returns how many bytes it went through
+u64 bench_kernel_pass(Kernel kernel, const Page* pages, u32 count, Arena* arena) {
+    u64 bytes = 0;
+    u64 sink = 0;
+    for (u32 i = 0; i < count; ++i) {
+        const Page* page = &pages[i];
+        const char* content = page->content;
+        const u32 len = (u32)page->content_len;
+        switch (kernel) {
+            case KERNEL_SLUGIFY: {
+                char slug[TITLE_MAX];
+                sink += slugify(page->title.data, page->title.len, slug, sizeof(slug));
+                bytes += page->title.len;
+                break;
+            }
+            case KERNEL_FRONT_MATTER: {
+                const u64 head_len = (u64)(content - page->source);
+                Page parsed = {0};
+                const char* rest = NULL;
+                bool ended = false;
+                parse_front_matter(
+                    arena, page->source_name, page->source, head_len, &parsed, &rest, &ended);
+                sink += parsed.slug.len;
+                bytes += head_len;
+                break;
+            }
+            case KERNEL_FORMAT_TYPE:
+                for (u32 j = 0; j < len; ++j) {
+                    sink += get_format_type(content, j, len);
+                }
+                bytes += len;
+                break;
+            case KERNEL_INLINE: {
+                MdFootnotes footnotes;
+                md_footnotes_init(&footnotes, arena);
+                Buf out = buf_create(arena, len * 2 + KB(1));
+                const char* end = content + len;
+                for (const char* line = content; line < end;) {
+                    const char* eol = memchr(line, '\n', end - line);
+                    const u32 line_len = eol ? (u32)(eol - line) : (u32)(end - line);
+                    md_write_inline(&out, line, line_len, &footnotes, false);
+                    line += eol ? line_len + 1 : line_len;
+                }
+                sink += out.len;
+                bytes += len;
+                break;
+            }
+            case KERNEL_PARSE: {
+                MdFootnotes footnotes;
+                md_footnotes_init(&footnotes, arena);
+                MdParser parser;
+                md_parser_init(&parser, arena, &footnotes, len);
+                md_parse(&parser, content, len);
+                sink += parser.count;
+                bytes += len;
+                break;
+            }
+            case KERNEL_COUNT:
+                break;
+        }
+        arena_clear(arena);
+    }
+    bench_sink += sink;
+    return bytes;
+}
+
+void bench_kernels(const char* posts_dir, u32 runs, BenchResults* results) {
+    Arena arena = arena_create(GB(64));
+    Arena page_arena = arena_create(GB(4));
+    Arena scratch = arena_create(GB(4));
+    Page* pages = NULL;
+    u32 page_count = 0;
+    import_pages(posts_dir, &arena, &page_arena, &pages, &page_count, NULL, NULL);
+
+    for (u32 k = 0; k < KERNEL_COUNT; ++k) {
+        // The first pass warms the caches and sizes the rest
+        const u64 bytes = bench_kernel_pass((Kernel)k, pages, page_count, &scratch);
+        const u64 reps = bytes ? (KERNEL_MIN_BYTES + bytes - 1) / bytes : 1;
+        for (u32 run = 0; run < runs; ++run) {
+            const double t0 = now_ms();
+            for (u64 r = 0; r < reps; ++r) {
+                bench_kernel_pass((Kernel)k, pages, page_count, &scratch);
+            }
+            const double ms = now_ms() - t0;
+            results->kernel_samples[k][run] = bytes ? ms * 1e6 / (double)(bytes * reps) : 0;
+        }
+        results->kernel_bytes[k] = bytes;
+    }
+
+    arena_release(&scratch);
+    arena_release(&arena);
+    arena_release(&page_arena);
+}
+
+int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/// @brief Nearest-rank percentile of sorted `samples`
+double percentile(const double* samples, u32 count, double p) {
+    u32 rank = (u32)(p / 100.0 * count + 0.999999);
+    rank = rank < 1 ? 1 : (rank > count ? count : rank);
+    return samples[rank - 1];
+}
+
+/// @brief Read the p50s of `names` written by --save into `out`, -1 for any that's missing.
+/// Returns false if the file can't be used.
+bool load_baseline(const char* path, const char* const* names, u32 count, double* out) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    for (u32 p = 0; p < count; ++p) {
+        out[p] = -1.0;
+    }
+    char name[32];
+    double value;
+    while (fscanf(f, "%31s %lf", name, &value) == 2) {
+        for (u32 p = 0; p < count; ++p) {
+            if (strcmp(name, names[p]) == 0) {
+                out[p] = value;
+            }
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+/// @brief Print how `p50` compares to `baseline`, returns true if it's a regression
+bool report_delta(double p50, double baseline, double threshold) {
+    if (baseline <= 0) {
+        return false;
+    }
+    const double delta = (p50 - baseline) / baseline * 100.0;
+    printf("  %+6.1f%% vs baseline", delta);
+    if (delta > threshold) {
+        printf(" (REGRESSION)");
+        return true;
+    }
+    return false;
+}
+
+/// @brief Delete a directory holding only files (the corpus and output directories are flat)
+void remove_flat_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            char file[MKSITE_PATH_MAX];
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            unlink(file);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+void usage(const char* argv0) {
+    fprintf(
+        stderr,
+        "Usage: %s [--posts N] [--size BYTES] [--headings P] [--inline P] [--runs N]\n"
+        "          [--seed N] [--dir PATH] [--save FILE] [--baseline FILE] [--threshold PCT]\n",
+        argv0);
+}
+
+int main(int argc, char** argv) {
+    BenchConfig cfg = {
+        .posts = 1000,
+        .post_size = 4096,
+        .heading_density = 0.1,
+        .inline_density = 0.05,
+        .runs = 10,
+        .seed = 1,
+        .threshold = 10.0,
+    };
+
+    for (i32 i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(arg, "--posts") == 0) {
+            cfg.posts = (u32)atoi(value);
+        } else if (strcmp(arg, "--size") == 0) {
+            cfg.post_size = (u32)atoi(value);
+        } else if (strcmp(arg, "--headings") == 0) {
+            cfg.heading_density = atof(value);
+        } else if (strcmp(arg, "--inline") == 0) {
+            cfg.inline_density = atof(value);
+        } else if (strcmp(arg, "--runs") == 0) {
+            cfg.runs = (u32)atoi(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            cfg.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--dir") == 0) {
+            cfg.dir = value;
+        } else if (strcmp(arg, "--save") == 0) {
+            cfg.save_path = value;
+        } else if (strcmp(arg, "--baseline") == 0) {
+            cfg.baseline_path = value;
+        } else if (strcmp(arg, "--threshold") == 0) {
+            cfg.threshold = atof(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+
+    const u32 max_runs = sizeof(((BenchResults*)0)->samples[0]) / sizeof(double);
+    if (cfg.posts == 0 || cfg.runs == 0 || cfg.runs > max_runs) {
+        LOG_ERROR("--posts must be positive and --runs between 1 and %u\n", max_runs);
+        return 1;
+    }
+
+    site_css = styles_css;
+    site_css_len = styles_css_len;
+    opts.jobs = 1;
+    opts.inline_css = true;
+
+    char dir[MKSITE_PATH_MAX];
+    if (cfg.dir) {
+        snprintf(dir, sizeof(dir), "%s", cfg.dir);
+        mkdir(dir, 0755);
+    } else {
+        snprintf(dir, sizeof(dir), "/tmp/mksite-bench-XXXXXX");
+        if (!mkdtemp(dir)) {
+            LOG_ERROR("Failed to create a temporary directory\n");
+            return 1;
+        }
+    }
+
+    char posts_dir[MKSITE_PATH_MAX];
+    char out_dir[MKSITE_PATH_MAX];
+    snprintf(posts_dir, sizeof(posts_dir), "%s/posts", dir);
+    snprintf(out_dir, sizeof(out_dir), "%s/public", dir);
+    mkdir(posts_dir, 0755);
+    mkdir(out_dir, 0755);
+
+    rng_state = cfg.seed ? cfg.seed : 1;
+    Arena gen_arena = arena_create(GB(1));
+    const u64 corpus_bytes = gen_corpus(&cfg, &gen_arena, posts_dir);
+    arena_release(&gen_arena);
+    printf(
+        "corpus: %u posts, %.2f MB in %s (headings %.2f, inline %.2f)\n",
+        cfg.posts,
+        corpus_bytes / 1e6,
+        dir,
+        cfg.heading_density,
+        cfg.inline_density);
+
+    // Importing logs every file, which would dominate the timings
+    FILE* devnull = freopen("/dev/null", "w", stderr);
+    (void)devnull;
+
+    static BenchResults results;
+    for (u32 run = 0; run < cfg.runs; ++run) {
+        bench_run(posts_dir, out_dir, &results, run);
+    }
+    bench_kernels(posts_dir, cfg.runs, &results);
+
+    double baseline[PHASE_COUNT];
+    double kernel_baseline[KERNEL_COUNT];
+    const bool have_baseline = cfg.baseline_path &&
+        load_baseline(cfg.baseline_path, PHASE_NAMES, PHASE_COUNT, baseline) &&
+        load_baseline(cfg.baseline_path, KERNEL_NAMES, KERNEL_COUNT, kernel_baseline);
+    if (cfg.baseline_path && !have_baseline) {
+        printf("warning: could not read baseline %s\n", cfg.baseline_path);
+    }
+
+    FILE* save = cfg.save_path ? fopen(cfg.save_path, "w") : NULL;
+
+    printf(
+        "%-8s %10s %10s %10s %10s %10s %12s\n",
+        "phase",
+        "min ms",
+        "p50 ms",
+        "p90 ms",
+        "p99 ms",
+        "MB/s",
+        "pages/s");
+    bool regressed = false;
+    for (u32 p = 0; p < PHASE_COUNT; ++p) {
+        double* samples = results.samples[p];
+        qsort(samples, cfg.runs, sizeof(double), compare_doubles);
+        const double p50 = percentile(samples, cfg.runs, 50);
+        printf(
+            "%-8s %10.3f %10.3f %10.3f %10.3f %10.1f %12.0f",
+            PHASE_NAMES[p],
+            samples[0],
+            p50,
+            percentile(samples, cfg.runs, 90),
+            percentile(samples, cfg.runs, 99),
+            results.bytes[p] / 1e6 / (p50 / 1000.0),
+            cfg.posts / (p50 / 1000.0));
+
+        if (have_baseline) {
+            regressed |= report_delta(p50, baseline[p], cfg.threshold);
+        }
+        printf("\n");
+
+        if (save) {
+            fprintf(save, "%s %.6f\n", PHASE_NAMES[p], p50);
+        }
+    }
+
+    printf(
+        "\n%-12s %10s %10s %10s %10s %10s\n",
+        "kernel",
+        "MB/pass",
+        "min ns/B",
+        "p50 ns/B",
+        "p90 ns/B",
+        "MB/s");
+    for (u32 k = 0; k < KERNEL_COUNT; ++k) {
+        double* samples = results.kernel_samples[k];
+        qsort(samples, cfg.runs, sizeof(double), compare_doubles);
+        const double p50 = percentile(samples, cfg.runs, 50);
+        printf(
+            "%-12s %10.3f %10.3f %10.3f %10.3f %10.1f",
+            KERNEL_NAMES[k],
+            results.kernel_bytes[k] / 1e6,
+            samples[0],
+            p50,
+            percentile(samples, cfg.runs, 90),
+            p50 > 0 ? 1e3 / p50 : 0);
+        if (have_baseline) {
+            regressed |= report_delta(p50, kernel_baseline[k], cfg.threshold);
+        }
+        printf("\n");
+
+        if (save) {
+            fprintf(save, "%s %.6f\n", KERNEL_NAMES[k], p50);
+        }
+    }
+
+    if (save) {
+        fclose(save);
+        printf("saved p50 timings to %s\n", cfg.save_path);
+    }
+
+    // Corpora in a directory given with --dir are kept for inspection
+    if (!cfg.dir) {
+        remove_flat_dir(posts_dir);
+        remove_flat_dir(out_dir);
+        rmdir(dir);
+    }
+
+    return regressed ? 2 : 0;
+}
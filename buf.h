@@ -0,0 +1,128 @@
+#ifndef BUF_H
+#define BUF_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "arena.h"
+#include "base.h"
+#include "trace.h"
+
+/// @brief Growable output buffer backed by an arena.
+///
+/// While the buffer is the most recent allocation in its arena it grows in place, otherwise it
+/// moves to a fresh allocation. Everything is written out with a single `write()` at the end.
+typedef struct {
+    Arena* arena;
+    char* data;
+    u64 len;
+    u64 cap;
+} Buf;
+
+Buf buf_create(Arena* arena, u64 cap) {
+    return (Buf){.arena = arena, .data = arena_push(arena, cap, 1), .len = 0, .cap = cap};
+}
+
+void buf_reserve(Buf* b, u64 extra) {
+    if (b->len + extra <= b->cap) {
+        return;
+    }
+
+    u64 new_cap = b->cap * 2;
+    if (new_cap < b->len + extra) {
+        new_cap = b->len + extra;
+    }
+
+    Arena* arena = b->arena;
+    if ((char*)arena->base + arena->used == b->data + b->cap) {
+        arena_push(arena, new_cap - b->cap, 1);
+    } else {
+        char* data = arena_push(arena, new_cap, 1);
+        memcpy(data, b->data, b->len);
+        b->data = data;
+    }
+    b->cap = new_cap;
+}
+
+void buf_write(Buf* b, const void* data, u64 len) {
+    buf_reserve(b, len);
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+/// @brief Append a string literal, its length is known at compile time
+#define buf_lit(b, lit) buf_write((b), (lit), sizeof(lit) - 1)
+
+void buf_str(Buf* b, const char* str) {
+    buf_write(b, str, strlen(str));
+}
+
+void buf_char(Buf* b, char c) {
+    buf_reserve(b, 1);
+    b->data[b->len++] = c;
+}
+
+void buf_spaces(Buf* b, u32 count) {
+    buf_reserve(b, count);
+    memset(b->data + b->len, ' ', count);
+    b->len += count;
+}
+
+void buf_u32(Buf* b, u32 value) {
+    char digits[10];
+    u32 n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    buf_reserve(b, n);
+    while (n) {
+        b->data[b->len++] = digits[--n];
+    }
+}
+
+/// @brief Write all of `data` to `fd`, retrying on short writes
+bool write_all(int fd, const void* data, u64 len) {
+    u64 written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, (const char*)data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += (u64)n;
+    }
+    trace_add_written(len);
+    return true;
+}
+
+/// @brief Replace the contents of the file at `path` with `data`
+bool write_file(const char* path, const void* data, u64 len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = write_all(fd, data, len);
+    return close(fd) == 0 && ok;
+}
+
+bool buf_flush(const Buf* b, int fd) {
+    return write_all(fd, b->data, b->len);
+}
+
+/// @brief Write out everything buffered so far and start over, keeping the allocation
+bool buf_drain(Buf* b, int fd) {
+    const bool ok = write_all(fd, b->data, b->len);
+    b->len = 0;
+    return ok;
+}
+
+bool buf_write_file(const Buf* b, const char* path) {
+    return write_file(path, b->data, b->len);
+}
+
+#endif // BUF_H
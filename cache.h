@@ -0,0 +1,317 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+
+#if defined(MKSITE_HAVE_CURL)
+#include <curl/curl.h>
+#endif
+
+// Remote requests in flight at once
+#define CACHE_MAX_TRANSFERS 32
+// Pages looked up in the remote store together while their collection is being imported
+#define CACHE_FETCH_BATCH 64
+
+/// @brief 128-bit name of a cache entry, a hash of everything the entry was rendered from
+typedef struct {
+    u64 hi;
+    u64 lo;
+} CacheKey;
+
+/// @brief Content-addressed store of rendered pages, shared between builds and machines.
+///
+/// An entry is named after its inputs, so it never goes stale and any number of builds can
+/// share it. Entries are files in a local directory, which can be backed by a remote HTTP store
+/// that answers GET and PUT on `<url>/<key>`, like an S3 bucket or any plain WebDAV server.
+/// Remote entries are fetched into the directory in concurrent batches ahead of the renderers,
+/// and the ones rendered here are uploaded in one go at the end of the build.
+typedef struct {
+    char dir[MKSITE_PATH_MAX]; // empty when there's no cache
+    char url[1024]; // remote store without its trailing slash, empty for a local-only cache
+    const char* header; // sent with every remote request, like "Authorization: Bearer ..."
+    pthread_mutex_t lock; // guards `uploads`
+    Arena uploads; // keys stored since the last `cache_upload`
+    u32 upload_count;
+    _Atomic u32 hits;
+    _Atomic u32 misses;
+} RenderCache;
+
+RenderCache render_cache;
+
+static inline bool cache_enabled(const RenderCache* c) {
+    return c->dir[0] != '\0';
+}
+
+bool cache_remote_available() {
+#if defined(MKSITE_HAVE_CURL)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void cache_path(const RenderCache* c, CacheKey key, char path[MKSITE_PATH_MAX]) {
+    snprintf(
+        path,
+        MKSITE_PATH_MAX,
+        "%s/%016llx%016llx",
+        c->dir,
+        (unsigned long long)key.hi,
+        (unsigned long long)key.lo);
+}
+
+/// @brief Use `dir` as the cache, backed by the store at `url` unless that's NULL
+bool cache_open(RenderCache* c, const char* dir, const char* url, const char* header) {
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        LOG_ERROR("Failed to create cache directory: %s\n", dir);
+        return false;
+    }
+    snprintf(c->dir, sizeof(c->dir), "%s", dir);
+    if (url) {
+        snprintf(c->url, sizeof(c->url), "%s", url);
+        u64 len = strlen(c->url);
+        while (len && c->url[len - 1] == '/') {
+            c->url[--len] = '\0';
+        }
+#if defined(MKSITE_HAVE_CURL)
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+#endif
+    }
+    c->header = header;
+    c->uploads = arena_create(GB(1));
+    pthread_mutex_init(&c->lock, NULL);
+    atomic_init(&c->hits, 0);
+    atomic_init(&c->misses, 0);
+    return true;
+}
+
+/// @brief Append the entry for `key` to `out`, returns false if there isn't one
+bool cache_get(RenderCache* c, CacheKey key, Buf* out) {
+    char path[MKSITE_PATH_MAX];
+    cache_path(c, key, path);
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    // A page is never empty, an empty entry can only be a botched upload
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+        return false;
+    }
+
+    const u64 size = (u64)st.st_size;
+    buf_reserve(out, size);
+    u64 got = 0;
+    while (got < size) {
+        const ssize_t n = pread(fd, out->data + out->len + got, size - got, (off_t)got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        got += (u64)n;
+    }
+    close(fd);
+    if (got != size) {
+        atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+        return false;
+    }
+    out->len += size;
+    trace_add_read(size);
+    atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+    return true;
+}
+
+/// @brief Store `data` as the entry for `key`.
+///
+/// Entries are written under a temporary name and renamed into place, so builds sharing the
+/// directory never see half of one. The cache only ever saves work, so failures are ignored.
+void cache_put(RenderCache* c, CacheKey key, const void* data, u64 len) {
+    char tmp[MKSITE_PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s/.put-XXXXXX", c->dir);
+    const int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+    const bool written = write_all(fd, data, len);
+    char path[MKSITE_PATH_MAX];
+    cache_path(c, key, path);
+    if (close(fd) != 0 || !written || chmod(tmp, 0644) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    if (c->url[0]) {
+        pthread_mutex_lock(&c->lock);
+        CacheKey* slot = arena_push(&c->uploads, sizeof(CacheKey), _Alignof(CacheKey));
+        *slot = key;
+        ++c->upload_count;
+        pthread_mutex_unlock(&c->lock);
+    }
+}
+
+#if defined(MKSITE_HAVE_CURL)
+typedef struct {
+    CURL* easy;
+    FILE* file;
+    CacheKey key;
+    char tmp[MKSITE_PATH_MAX]; // where a download goes until it's complete
+} CacheTransfer;
+
+static bool cache_transfer_start(
+    RenderCache* c,
+    CURLM* multi,
+    struct curl_slist* headers,
+    CacheTransfer* t,
+    CacheKey key,
+    bool upload) {
+    char path[MKSITE_PATH_MAX];
+    cache_path(c, key, path);
+    struct stat st;
+    const bool local = stat(path, &st) == 0;
+    // Downloads only fetch what's missing here, uploads only send what's still here
+    if (local != upload) {
+        return false;
+    }
+
+    if (upload) {
+        t->file = fopen(path, "rb");
+    } else {
+        snprintf(t->tmp, sizeof(t->tmp), "%s/.fetch-XXXXXX", c->dir);
+        const int fd = mkstemp(t->tmp);
+        t->file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+        if (fd >= 0 && !t->file) {
+            close(fd);
+            unlink(t->tmp);
+        }
+    }
+    if (!t->file) {
+        t->tmp[0] = '\0';
+        return false;
+    }
+
+    char url[sizeof(c->url) + 40];
+    snprintf(
+        url,
+        sizeof(url),
+        "%s/%016llx%016llx",
+        c->url,
+        (unsigned long long)key.hi,
+        (unsigned long long)key.lo);
+    t->key = key;
+    t->easy = curl_easy_init();
+    curl_easy_setopt(t->easy, CURLOPT_URL, url);
+    curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(t->easy, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(t->easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t);
+    if (upload) {
+        curl_easy_setopt(t->easy, CURLOPT_UPLOAD, 1L);
+        curl_easy_setopt(t->easy, CURLOPT_READDATA, t->file);
+        curl_easy_setopt(t->easy, CURLOPT_INFILESIZE_LARGE, (curl_off_t)st.st_size);
+    } else {
+        curl_easy_setopt(t->easy, CURLOPT_WRITEDATA, t->file);
+    }
+    curl_multi_add_handle(multi, t->easy);
+    return true;
+}
+
+static bool cache_transfer_finish(RenderCache* c, CURLM* multi, CacheTransfer* t, bool ok) {
+    curl_multi_remove_handle(multi, t->easy);
+    curl_easy_cleanup(t->easy);
+    t->easy = NULL;
+    if (t->tmp[0]) {
+        char path[MKSITE_PATH_MAX];
+        cache_path(c, t->key, path);
+        ok = fclose(t->file) == 0 && ok && chmod(t->tmp, 0644) == 0 && rename(t->tmp, path) == 0;
+        if (!ok) {
+            unlink(t->tmp);
+        }
+        t->tmp[0] = '\0';
+    } else {
+        fclose(t->file);
+    }
+    return ok;
+}
+
+/// @brief GET or PUT `keys`, CACHE_MAX_TRANSFERS at a time, returns how many made it
+static u32 cache_transfer(RenderCache* c, const CacheKey* keys, u32 count, bool upload) {
+    CURLM* multi = curl_multi_init();
+    struct curl_slist* headers = c->header ? curl_slist_append(NULL, c->header) : NULL;
+    CacheTransfer transfers[CACHE_MAX_TRANSFERS] = {0};
+    u32 next = 0;
+    u32 active = 0;
+    u32 done = 0;
+    for (;;) {
+        for (u32 i = 0; i < CACHE_MAX_TRANSFERS && next < count; ++i) {
+            while (!transfers[i].easy && next < count) {
+                active += cache_transfer_start(
+                    c, multi, headers, &transfers[i], keys[next++], upload);
+            }
+        }
+        if (active == 0) {
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg* msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CacheTransfer* t = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&t);
+            done += cache_transfer_finish(c, multi, t, msg->data.result == CURLE_OK);
+            --active;
+        }
+        if (running) {
+            curl_multi_poll(multi, NULL, 0, 100, NULL);
+        }
+    }
+    curl_slist_free_all(headers);
+    curl_multi_cleanup(multi);
+    return done;
+}
+#endif
+
+/// @brief Fetch whichever of `keys` aren't in the directory yet from the remote store, all at
+/// once. Returns how many were fetched.
+u32 cache_fetch(RenderCache* c, const CacheKey* keys, u32 count) {
+#if defined(MKSITE_HAVE_CURL)
+    if (c->url[0] && count) {
+        return cache_transfer(c, keys, count, false);
+    }
+#endif
+    (void)c, (void)keys, (void)count;
+    return 0;
+}
+
+/// @brief Send everything stored since the last call to the remote store, returns how many
+/// entries made it
+u32 cache_upload(RenderCache* c) {
+    u32 sent = 0;
+#if defined(MKSITE_HAVE_CURL)
+    if (c->url[0] && c->upload_count) {
+        sent = cache_transfer(c, (const CacheKey*)c->uploads.base, c->upload_count, true);
+    }
+#endif
+    arena_clear(&c->uploads);
+    c->upload_count = 0;
+    return sent;
+}
+
+#endif // CACHE_H
@@ -0,0 +1,136 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "writer.h"
+
+#if defined(MKSITE_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(MKSITE_HAVE_BROTLI)
+#include <brotli/encode.h>
+#endif
+
+/// @brief Gzip `data` into `scratch`, returns NULL on failure
+u8* gzip_compress(Arena* scratch, const void* data, u64 len, u64* out_len) {
+#if defined(MKSITE_HAVE_ZLIB)
+    z_stream zs = {0};
+    // 15 window bits plus 16 selects a gzip header instead of a raw zlib stream
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) !=
+        Z_OK) {
+        return NULL;
+    }
+    const u64 bound = deflateBound(&zs, len);
+    u8* out = arena_push(scratch, bound, 1);
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)len;
+    zs.next_out = out;
+    zs.avail_out = (uInt)bound;
+    const int rc = deflate(&zs, Z_FINISH);
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    return rc == Z_STREAM_END ? out : NULL;
+#else
+    (void)scratch, (void)data, (void)len, (void)out_len;
+    return NULL;
+#endif
+}
+
+/// @brief Brotli-compress `data` into `scratch`, returns NULL on failure
+u8* brotli_compress(Arena* scratch, const void* data, u64 len, u64* out_len) {
+#if defined(MKSITE_HAVE_BROTLI)
+    size_t size = BrotliEncoderMaxCompressedSize(len);
+    u8* out = arena_push(scratch, size, 1);
+    if (!BrotliEncoderCompress(
+            BROTLI_MAX_QUALITY,
+            BROTLI_DEFAULT_WINDOW,
+            BROTLI_MODE_TEXT,
+            len,
+            (const u8*)data,
+            &size,
+            out)) {
+        return NULL;
+    }
+    *out_len = size;
+    return out;
+#else
+    (void)scratch, (void)data, (void)len, (void)out_len;
+    return NULL;
+#endif
+}
+
+bool compression_available() {
+#if defined(MKSITE_HAVE_ZLIB) || defined(MKSITE_HAVE_BROTLI)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// @brief Write `path.gz` and `path.br` next to `path` for servers with gzip/brotli_static.
+///
+/// With a `writer` the compressed copies are queued on it, otherwise they're written right away
+/// and `scratch` holds them.
+bool write_compressed_sidecars(
+    Arena* scratch,
+    Writer* writer,
+    const char* path,
+    const void* data,
+    u64 len) {
+    if (writer) {
+        scratch = &writer->arena;
+    }
+    char sidecar[MKSITE_PATH_MAX + 3]; // room for ".gz" or ".br"
+    const u64 path_len = strlen(path);
+    if (path_len + 4 > sizeof(sidecar)) {
+        return false;
+    }
+    memcpy(sidecar, path, path_len);
+
+    bool ok = true;
+#if defined(MKSITE_HAVE_ZLIB)
+    u64 gz_len = 0;
+    u8* gz = gzip_compress(scratch, data, len, &gz_len);
+    memcpy(sidecar + path_len, ".gz", 4);
+    ok = gz && (writer ? writer_queue(writer, sidecar, gz, gz_len)
+                       : write_file(sidecar, gz, gz_len)) && ok;
+#endif
+#if defined(MKSITE_HAVE_BROTLI)
+    u64 br_len = 0;
+    u8* br = brotli_compress(scratch, data, len, &br_len);
+    memcpy(sidecar + path_len, ".br", 4);
+    ok = br && (writer ? writer_queue(writer, sidecar, br, br_len)
+                       : write_file(sidecar, br, br_len)) && ok;
+#endif
+    return ok;
+}
+
+/// @brief Check that every sidecar this build can write for `path` exists
+bool compressed_sidecars_exist(const char* path) {
+    char sidecar[MKSITE_PATH_MAX + 3];
+    bool exist = true;
+#if defined(MKSITE_HAVE_ZLIB)
+    snprintf(sidecar, sizeof(sidecar), "%s.gz", path);
+    exist = exist && access(sidecar, F_OK) == 0;
+#endif
+#if defined(MKSITE_HAVE_BROTLI)
+    snprintf(sidecar, sizeof(sidecar), "%s.br", path);
+    exist = exist && access(sidecar, F_OK) == 0;
+#endif
+    return exist;
+}
+
+/// @brief Delete the sidecars of `path`, so a server with gzip/brotli_static doesn't keep
+/// sending an older version of it
+void remove_compressed_sidecars(const char* path) {
+    char sidecar[MKSITE_PATH_MAX + 3];
+    snprintf(sidecar, sizeof(sidecar), "%s.gz", path);
+    unlink(sidecar);
+    snprintf(sidecar, sizeof(sidecar), "%s.br", path);
+    unlink(sidecar);
+}
+
+#endif // COMPRESS_H
@@ -0,0 +1,113 @@
+// Fuzz target over the renderer's hand-written byte loops: slugs, front matter, inline formats,
+// headings and whole pages.
+//
+// With clang and -DMKSITE_FUZZ=ON this links against libFuzzer, `mksite-fuzz CORPUS_DIR
+// content/posts` grows a corpus from the real pages. Other compilers get a small driver instead
+// that runs each file named on the command line once, so inputs found elsewhere can be replayed
+// under the sanitizers. Like bench.c it's a unity build on top of main.c.
+
+#define MKSITE_NO_MAIN
+#include "main.c"
+
+// Inputs past this only make each run slower, every loop under test is per line or per page
+#define FUZZ_MAX_INPUT MB(1)
+
+static Arena fuzz_arena;
+
+// Keeps the compiler from dropping calls whose results are otherwise unused
+static volatile u32 fuzz_sink;
+
+/// @brief Check that slugify stays within `output_size` and writes a terminated slug
+static void fuzz_slugify(const char* text, u32 len, u32 output_size) {
+    char slug[TITLE_MAX + 1];
+    slug[output_size] = 0x7f;
+    const u32 slug_len = slugify(text, len, slug, output_size);
+    assert(slug_len < output_size && slug[slug_len] == '\0' && slug[output_size] == 0x7f);
+    assert(slug_len == 0 || (slug[0] != '-' && slug[slug_len - 1] != '-'));
+    fuzz_sink += slug_len;
+}
+
+int LLVMFuzzerTestOneInput(const u8* data, size_t size);
+
+int LLVMFuzzerTestOneInput(const u8* data, size_t size) {
+    if (size > FUZZ_MAX_INPUT) {
+        return 0;
+    }
+    if (!fuzz_arena.base) {
+        fuzz_arena = arena_create(GB(4));
+        site_css = styles_css;
+        site_css_len = styles_css_len;
+        opts.inline_css = true;
+    }
+    const char* text = (const char*)data;
+    const u32 len = (u32)size;
+
+    for (u32 output_size = 1; output_size <= 3; ++output_size) {
+        fuzz_slugify(text, len, output_size);
+    }
+    fuzz_slugify(text, len, TITLE_MAX);
+
+    for (u32 i = 0; i < len; ++i) {
+        fuzz_sink += get_format_type(text, i, len);
+    }
+
+    // Each line as inline Markdown, both on its own and as a link label
+    MdFootnotes footnotes;
+    md_footnotes_init(&footnotes, &fuzz_arena);
+    Buf out = buf_create(&fuzz_arena, KB(4));
+    const char* end = text + len;
+    for (const char* line = text; line < end;) {
+        const char* eol = memchr(line, '\n', end - line);
+        const u32 line_len = eol ? (u32)(eol - line) : (u32)(end - line);
+        md_write_inline(&out, line, line_len, &footnotes, false);
+        md_write_inline(&out, line, line_len, &footnotes, true);
+        line += eol ? line_len + 1 : line_len;
+    }
+
+    // Then the whole input as a page source, front matter first, as `import_page` reads it
+    Page page = {.source_name = "fuzz.txt", .source = text, .source_size = size};
+    const char* content = NULL;
+    bool ended = false;
+    if (parse_front_matter(&fuzz_arena, "fuzz.txt", text, size, &page, &content, &ended)) {
+        assert(content >= text && content <= end);
+        if (!page.slug.data) {
+            page.slug = STR_LIT("");
+        }
+        page.date_full = page.date_abbr = STR_LIT("");
+        page.content = content;
+        page.content_len = size - (u64)(content - text);
+        out.len = 0;
+        build_page(&out, &page, NULL);
+        fuzz_sink += (u32)out.len;
+    }
+
+    arena_clear(&fuzz_arena);
+    return 0;
+}
+
+#if !defined(MKSITE_LIBFUZZER)
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE...\n", argv[0]);
+        return 1;
+    }
+    Arena arena = arena_create(GB(1));
+    for (i32 i = 1; i < argc; ++i) {
+        u64 len = 0;
+        i64 mtime_ns = 0;
+        const char* data = read_file(&arena, argv[i], &len, &mtime_ns);
+        if (!data) {
+            LOG_ERROR("Failed to read %s\n", argv[i]);
+            return 1;
+        }
+        // An exact-size copy, so the sanitizers catch reads past the end of the input
+        u8* input = malloc(len ? len : 1);
+        memcpy(input, data, len);
+        LLVMFuzzerTestOneInput(input, len);
+        free(input);
+        arena_clear(&arena);
+    }
+    printf("Ran %d inputs\n", argc - 1);
+    return 0;
+}
+#endif
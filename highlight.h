@@ -0,0 +1,492 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "html.h"
+
+/// @brief Build-time syntax highlighting for fenced code blocks.
+///
+/// One small lexer covers every language: a byte class table finds identifiers and numbers,
+/// and each language only describes its comments, strings and words. Tokens become
+/// `<span class="hl-…">`, styled in styles.css, so pages need no highlighter script.
+/// Highlighted snippets are cached for the life of the process, so a snippet shared by many
+/// posts, or rebuilt over and over in --watch mode, is only lexed once.
+typedef enum {
+    HL_NONE,
+    HL_KEYWORD,
+    HL_TYPE,
+    HL_STRING,
+    HL_NUMBER,
+    HL_COMMENT,
+    HL_PREPROC,
+} HighlightClass;
+
+static const Str HL_SPANS[] = {
+    [HL_KEYWORD] = STR_LIT("<span class=\"hl-k\">"),
+    [HL_TYPE] = STR_LIT("<span class=\"hl-t\">"),
+    [HL_STRING] = STR_LIT("<span class=\"hl-s\">"),
+    [HL_NUMBER] = STR_LIT("<span class=\"hl-n\">"),
+    [HL_COMMENT] = STR_LIT("<span class=\"hl-c\">"),
+    [HL_PREPROC] = STR_LIT("<span class=\"hl-p\">"),
+};
+
+typedef struct {
+    const char* names; // info strings that pick this language, space separated
+    const char* keywords; // space separated
+    const char* types;
+    const char* line_comment; // NULL without one
+    const char* block_open; // NULL without block comments
+    const char* block_close;
+    const char* quotes; // bytes that open a string
+    bool triple_quotes; // """ and ''' strings, which span lines
+    bool preprocessor; // a line starting with # is a directive
+} HighlightLang;
+
+#define C_KEYWORDS                                                                             \
+    "auto break case const continue default do else enum extern for goto if inline register " \
+    "restrict return sizeof static struct switch typedef union volatile while _Alignas "      \
+    "_Alignof _Atomic _Bool _Generic _Noreturn _Static_assert _Thread_local NULL true false"
+#define C_TYPES                                                                                \
+    "char double float int long short signed unsigned void bool size_t ssize_t ptrdiff_t "    \
+    "intptr_t uintptr_t int8_t int16_t int32_t int64_t uint8_t uint16_t uint32_t uint64_t "    \
+    "FILE u8 u16 u32 u64 i8 i16 i32 i64"
+
+// clang-format off
+static const HighlightLang HIGHLIGHT_LANGS[] = {
+    {
+        .names = "c h",
+        .keywords = C_KEYWORDS,
+        .types = C_TYPES,
+        .line_comment = "//", .block_open = "/*", .block_close = "*/",
+        .quotes = "\"'",
+        .preprocessor = true,
+    },
+    {
+        .names = "cpp c++ cc cxx hpp hh",
+        .keywords = C_KEYWORDS " alignas alignof and asm catch class co_await co_return "
+            "co_yield concept consteval constexpr constinit const_cast decltype delete "
+            "dynamic_cast explicit export final friend mutable namespace new noexcept not "
+            "nullptr operator or override private protected public reinterpret_cast requires "
+            "static_assert static_cast template this thread_local throw try typeid typename "
+            "using virtual",
+        .types = C_TYPES " wchar_t char8_t char16_t char32_t std string string_view vector",
+        .line_comment = "//", .block_open = "/*", .block_close = "*/",
+        .quotes = "\"'",
+        .preprocessor = true,
+    },
+    {
+        .names = "python py",
+        .keywords = "and as assert async await break case class continue def del elif else "
+            "except finally for from global if import in is lambda match nonlocal not or pass "
+            "raise return try while with yield None True False",
+        .types = "bool bytes dict float int list object self set str tuple type",
+        .line_comment = "#",
+        .quotes = "\"'",
+        .triple_quotes = true,
+    },
+    {
+        .names = "javascript js mjs typescript ts",
+        .keywords = "async await break case catch class const continue debugger default delete "
+            "do else export extends false finally for function if import in instanceof let new "
+            "null of return super switch this throw true try typeof undefined var void while "
+            "with yield",
+        .types = "Array Boolean Date Error JSON Map Math Number Object Promise RegExp Set "
+            "String Symbol console",
+        .line_comment = "//", .block_open = "/*", .block_close = "*/",
+        .quotes = "\"'`",
+    },
+    {
+        .names = "rust rs",
+        .keywords = "as async await break const continue crate dyn else enum extern false fn "
+            "for if impl in let loop match mod move mut pub ref return self Self static struct "
+            "super trait true type unsafe use where while",
+        .types = "bool char f32 f64 i8 i16 i32 i64 i128 isize u8 u16 u32 u64 u128 usize str "
+            "Box Option Result String Vec",
+        .line_comment = "//", .block_open = "/*", .block_close = "*/",
+        .quotes = "\"",
+    },
+    {
+        .names = "sh bash shell zsh",
+        .keywords = "case do done elif else esac export fi for function if in local readonly "
+            "return select then until while",
+        .types = "cd echo exit printf read set shift source test unset",
+        .line_comment = "#",
+        .quotes = "\"'",
+    },
+};
+// clang-format on
+
+#define HIGHLIGHT_LANG_COUNT (sizeof(HIGHLIGHT_LANGS) / sizeof(HIGHLIGHT_LANGS[0]))
+
+enum {
+    HL_IDENT = 1, // can be part of an identifier
+    HL_IDENT_START = 2,
+    HL_DIGIT = 4,
+};
+
+// clang-format off
+static const u8 HL_CHARS[256] = {
+    ['0' ... '9'] = HL_IDENT | HL_DIGIT,
+    ['a' ... 'z'] = HL_IDENT | HL_IDENT_START,
+    ['A' ... 'Z'] = HL_IDENT | HL_IDENT_START,
+    ['_'] = HL_IDENT | HL_IDENT_START,
+};
+// clang-format on
+
+// Per-language word tables, at most half full
+#define HIGHLIGHT_WORD_SLOTS 512
+
+typedef struct {
+    const char* word; // points into the language's word list
+    u8 len;
+    u8 cls;
+} HighlightWord;
+
+static HighlightWord highlight_words[HIGHLIGHT_LANG_COUNT][HIGHLIGHT_WORD_SLOTS];
+static pthread_once_t highlight_words_once = PTHREAD_ONCE_INIT;
+
+static u32 highlight_hash(const char* text, u64 len) {
+    u32 hash = 2166136261u;
+    for (u64 i = 0; i < len; ++i) {
+        hash = (hash ^ (u8)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void highlight_add_words(HighlightWord* table, const char* list, u8 cls) {
+    for (const char* p = list; *p;) {
+        const char* end = strchr(p, ' ');
+        end = end ? end : p + strlen(p);
+        u32 slot = highlight_hash(p, end - p) & (HIGHLIGHT_WORD_SLOTS - 1);
+        while (table[slot].word) {
+            slot = (slot + 1) & (HIGHLIGHT_WORD_SLOTS - 1);
+        }
+        table[slot] = (HighlightWord){.word = p, .len = (u8)(end - p), .cls = cls};
+        p = *end ? end + 1 : end;
+    }
+}
+
+static void highlight_build_words(void) {
+    for (u32 i = 0; i < HIGHLIGHT_LANG_COUNT; ++i) {
+        highlight_add_words(highlight_words[i], HIGHLIGHT_LANGS[i].keywords, HL_KEYWORD);
+        highlight_add_words(highlight_words[i], HIGHLIGHT_LANGS[i].types, HL_TYPE);
+    }
+}
+
+static u8 highlight_word_class(const HighlightWord* table, const char* word, u64 len) {
+    u32 slot = highlight_hash(word, len) & (HIGHLIGHT_WORD_SLOTS - 1);
+    for (; table[slot].word; slot = (slot + 1) & (HIGHLIGHT_WORD_SLOTS - 1)) {
+        if (table[slot].len == len && memcmp(table[slot].word, word, len) == 0) {
+            return table[slot].cls;
+        }
+    }
+    return HL_NONE;
+}
+
+/// @brief The language a fenced block's info string asks for, NULL if there's no lexer for it
+const HighlightLang* highlight_language(const char* info, u32 len) {
+    if (!len) {
+        return NULL;
+    }
+    for (u32 i = 0; i < HIGHLIGHT_LANG_COUNT; ++i) {
+        for (const char* p = HIGHLIGHT_LANGS[i].names; *p;) {
+            const char* end = strchr(p, ' ');
+            end = end ? end : p + strlen(p);
+            if ((u64)(end - p) == len && memcmp(p, info, len) == 0) {
+                return &HIGHLIGHT_LANGS[i];
+            }
+            p = *end ? end + 1 : end;
+        }
+    }
+    return NULL;
+}
+
+static bool highlight_starts(const char* p, const char* end, const char* token) {
+    const u64 len = token ? strlen(token) : 0;
+    return len && (u64)(end - p) >= len && memcmp(p, token, len) == 0;
+}
+
+/// @brief A token left open at the end of a line, so blocks can be highlighted a line at a time
+typedef struct {
+    u8 open; // class of the token carrying on into the next line, HL_NONE if there isn't one
+    char quote; // of an open string
+    bool triple; // the open string is a """ or ''' one
+} HighlightState;
+
+/// @brief End of the open token in `state` within the line [p, end), clearing `state` if the
+/// token ends there.
+///
+/// Block comments, triple-quoted strings and template literals carry on past the end of their
+/// line, and so do other strings and preprocessor directives when the line ends in a backslash.
+static const char* highlight_token_end(
+    const HighlightLang* lang,
+    HighlightState* state,
+    const char* p,
+    const char* end) {
+    if (state->open == HL_COMMENT) {
+        const u64 close = strlen(lang->block_close);
+        while ((p = memchr(p, lang->block_close[0], end - p)) &&
+               !highlight_starts(p, end, lang->block_close)) {
+            ++p;
+        }
+        if (!p) {
+            return end;
+        }
+        state->open = HL_NONE;
+        return p + close;
+    }
+
+    if (state->open == HL_PREPROC) {
+        while (p < end) {
+            if (*p == '\\' && p + 1 == end) {
+                return end;
+            }
+            p += *p == '\\' ? 2 : 1;
+        }
+        state->open = HL_NONE;
+        return end;
+    }
+
+    const char quote = state->quote;
+    if (state->triple) {
+        for (const char* q = p; q + 2 < end; ++q) {
+            if (*q == '\\') {
+                ++q;
+            } else if (q[0] == quote && q[1] == quote && q[2] == quote) {
+                state->open = HL_NONE;
+                return q + 3;
+            }
+        }
+        return end;
+    }
+    for (const char* q = p; q < end; ++q) {
+        if (*q == '\\') {
+            if (q + 1 == end) {
+                return end; // the backslash escapes the newline
+            }
+            ++q;
+        } else if (*q == quote) {
+            state->open = HL_NONE;
+            return q + 1;
+        }
+    }
+    // Only template literals span lines, an unterminated string ends with its line
+    if (quote != '`') {
+        state->open = HL_NONE;
+    }
+    return end;
+}
+
+/// @brief Write one line of code, without its newline, as highlighted and escaped HTML.
+///
+/// A token still open at the end of the line leaves its span open too, the newline and the
+/// next lines go inside it until it ends, or `highlight_finish` closes it.
+void highlight_line(
+    Buf* out,
+    const HighlightLang* lang,
+    HighlightState* state,
+    const char* text,
+    u64 len) {
+    const char* p = text;
+    const char* end = text + len;
+    if (state->open) {
+        p = highlight_token_end(lang, state, p, end);
+        html_escape(out, text, p - text);
+        if (state->open) {
+            return;
+        }
+        buf_lit(out, "</span>");
+    }
+
+    pthread_once(&highlight_words_once, highlight_build_words);
+    const HighlightWord* words = highlight_words[lang - HIGHLIGHT_LANGS];
+    const char* plain = p; // start of the text waiting to be written without a span
+    bool line_start = p == text;
+    while (p < end) {
+        const char c = *p;
+        const char* token = p;
+        u8 cls = HL_NONE;
+        if (c == ' ' || c == '\t') {
+            ++p;
+            continue;
+        } else if (lang->preprocessor && line_start && c == '#') {
+            // Directives run to the end of the line, or further after a trailing backslash
+            *state = (HighlightState){.open = HL_PREPROC};
+            p = highlight_token_end(lang, state, p, end);
+            cls = HL_PREPROC;
+        } else if (highlight_starts(p, end, lang->line_comment)) {
+            p = end;
+            cls = HL_COMMENT;
+        } else if (highlight_starts(p, end, lang->block_open)) {
+            *state = (HighlightState){.open = HL_COMMENT};
+            p = highlight_token_end(lang, state, p + strlen(lang->block_open), end);
+            cls = HL_COMMENT;
+        } else if (strchr(lang->quotes, c) && c) {
+            const bool triple = lang->triple_quotes && end - p >= 3 && p[1] == c && p[2] == c;
+            *state = (HighlightState){.open = HL_STRING, .quote = c, .triple = triple};
+            p = highlight_token_end(lang, state, p + (triple ? 3 : 1), end);
+            cls = HL_STRING;
+        } else if (HL_CHARS[(u8)c] & HL_DIGIT) {
+            // Close enough for every literal: 0x1F, 1.5e3, 10'000, 42ull
+            while (p < end && ((HL_CHARS[(u8)*p] & HL_IDENT) || *p == '.' || *p == '\'')) {
+                ++p;
+            }
+            cls = HL_NUMBER;
+        } else if (HL_CHARS[(u8)c] & HL_IDENT_START) {
+            while (p < end && (HL_CHARS[(u8)*p] & HL_IDENT)) {
+                ++p;
+            }
+            cls = highlight_word_class(words, token, p - token);
+        } else {
+            ++p;
+        }
+        line_start = false;
+
+        if (cls != HL_NONE) {
+            html_escape(out, plain, token - plain);
+            buf_write(out, HL_SPANS[cls].data, HL_SPANS[cls].len);
+            html_escape(out, token, p - token);
+            if (!state->open) {
+                buf_lit(out, "</span>");
+            }
+            plain = p;
+        }
+    }
+    html_escape(out, plain, p - plain);
+}
+
+/// @brief Close the span of a token the code ended in the middle of
+void highlight_finish(Buf* out, HighlightState* state) {
+    if (state->open) {
+        buf_lit(out, "</span>");
+        state->open = HL_NONE;
+    }
+}
+
+/// @brief Write `text` as highlighted, escaped HTML
+void highlight_code(Buf* out, const HighlightLang* lang, const char* text, u64 len) {
+    HighlightState state = {0};
+    const char* end = text + len;
+    for (const char* line = text; line < end;) {
+        const char* eol = memchr(line, '\n', end - line);
+        const u64 line_len = eol ? (u64)(eol - line) : (u64)(end - line);
+        highlight_line(out, lang, &state, line, line_len);
+        if (eol) {
+            buf_char(out, '\n');
+        }
+        line += eol ? line_len + 1 : line_len;
+    }
+    highlight_finish(out, &state);
+}
+
+// Snippets kept by the cache, it stops taking new ones once it's three quarters full
+#define HIGHLIGHT_CACHE_SLOTS 65536
+// Longest snippet worth caching. Longer blocks are highlighted a line at a time as they're
+// rendered, so a huge one never has to be held whole.
+#define HIGHLIGHT_SNIPPET_MAX KB(64)
+// The cache stops taking new snippets once their source and HTML add up to this much
+#define HIGHLIGHT_CACHE_BYTES MB(64)
+
+typedef struct {
+    _Atomic u64 key; // hash of the language and the code, 0 while the slot is free
+    const char* source; // to tell snippets with the same hash apart
+    u64 source_len;
+    const char* html;
+    u64 html_len;
+} HighlightSlot;
+
+/// @brief Highlighted snippets by hash. Lookups are lock-free, insertions take `mutex`.
+typedef struct {
+    pthread_mutex_t mutex;
+    Arena arena; // the cached sources and HTML
+    u32 count;
+    _Atomic u64 hits;
+    _Atomic u64 misses;
+    HighlightSlot slots[HIGHLIGHT_CACHE_SLOTS];
+} HighlightCache;
+
+static HighlightCache highlight_cache;
+static pthread_once_t highlight_cache_once = PTHREAD_ONCE_INIT;
+
+static void highlight_cache_init(void) {
+    pthread_mutex_init(&highlight_cache.mutex, NULL);
+    highlight_cache.arena = arena_create(HIGHLIGHT_CACHE_BYTES + MB(1));
+}
+
+static u64 highlight_key(const HighlightLang* lang, const char* text, u64 len) {
+    u64 hash = 0xcbf29ce484222325ull ^ (u64)(lang - HIGHLIGHT_LANGS);
+    for (u64 i = 0; i < len; ++i) {
+        hash = (hash ^ (u8)text[i]) * 0x100000001b3ull;
+    }
+    return hash ? hash : 1;
+}
+
+/// @brief `highlight_code`, reusing the HTML of any identical snippet seen before.
+///
+/// Snippets over HIGHLIGHT_SNIPPET_MAX are just highlighted.
+void highlight_cached(Buf* out, const HighlightLang* lang, const char* text, u64 len) {
+    if (len > HIGHLIGHT_SNIPPET_MAX) {
+        highlight_code(out, lang, text, len);
+        return;
+    }
+    pthread_once(&highlight_cache_once, highlight_cache_init);
+    HighlightCache* cache = &highlight_cache;
+    const u64 key = highlight_key(lang, text, len);
+
+    u32 slot = (u32)key & (HIGHLIGHT_CACHE_SLOTS - 1);
+    for (;; slot = (slot + 1) & (HIGHLIGHT_CACHE_SLOTS - 1)) {
+        const HighlightSlot* s = &cache->slots[slot];
+        const u64 found = atomic_load_explicit(&s->key, memory_order_acquire);
+        if (!found) {
+            break;
+        }
+        if (found == key) {
+            // Each hash gets one slot, a different snippet with the same hash isn't cached
+            if (s->source_len != len || memcmp(s->source, text, len) != 0) {
+                break;
+            }
+            atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+            buf_write(out, s->html, s->html_len);
+            return;
+        }
+    }
+
+    atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+    const u64 start = out->len;
+    highlight_code(out, lang, text, len);
+    const u64 html_len = out->len - start;
+
+    pthread_mutex_lock(&cache->mutex);
+    const bool room = 4 * (cache->count + 1) <= 3 * HIGHLIGHT_CACHE_SLOTS &&
+        cache->arena.used + len + html_len <= HIGHLIGHT_CACHE_BYTES;
+    if (room) {
+        // Another thread may have added the same snippet, or used this slot, in the meantime
+        for (;; slot = (slot + 1) & (HIGHLIGHT_CACHE_SLOTS - 1)) {
+            const u64 found = atomic_load_explicit(&cache->slots[slot].key, memory_order_relaxed);
+            if (!found || found == key) {
+                break;
+            }
+        }
+        HighlightSlot* s = &cache->slots[slot];
+        if (!atomic_load_explicit(&s->key, memory_order_relaxed)) {
+            char* source = arena_push(&cache->arena, len + html_len, 1);
+            memcpy(source, text, len);
+            memcpy(source + len, out->data + start, html_len);
+            s->source = source;
+            s->source_len = len;
+            s->html = source + len;
+            s->html_len = html_len;
+            ++cache->count;
+            // Publishes everything above to lock-free readers
+            atomic_store_explicit(&s->key, key, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+#endif // HIGHLIGHT_H
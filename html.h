@@ -1,56 +1,113 @@
 #ifndef HTML_H
 #define HTML_H
 
-#include <stdio.h>
-#include <stdarg.h>
-
-typedef int32_t i32;
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "scan.h"
 
 typedef struct {
     i32 indent;
-    FILE* f;
+    Buf* out;
 } Html;
 
-Html* html_raw(Html* h, const char* fmt, ...) {
-    fprintf(h->f, "%*s", h->indent, "");
-    va_list args;
-    va_start(args, fmt);
-    vfprintf(h->f, fmt, args);
-    va_end(args);
+/// @brief Write `text` verbatim at the current indentation
+Html* html_raw(Html* h, const char* text) {
+    buf_spaces(h->out, h->indent);
+    buf_str(h->out, text);
     return h;
 }
 
-Html* html_open(Html* h, const char* tag, const char* attrs) {
+static void html_tag(Html* h, const char* prefix, const char* tag, const char* attrs) {
+    buf_spaces(h->out, h->indent);
+    buf_str(h->out, prefix);
+    buf_str(h->out, tag);
     if (attrs) {
-        html_raw(h, "<%s %s>\n", tag, attrs);
-    } else {
-        html_raw(h, "<%s>\n", tag);
+        buf_char(h->out, ' ');
+        buf_str(h->out, attrs);
     }
+}
+
+Html* html_open(Html* h, const char* tag, const char* attrs) {
+    html_tag(h, "<", tag, attrs);
+    buf_lit(h->out, ">\n");
     h->indent += 2;
     return h;
 }
 
 Html* html_close(Html* h, const char* tag) {
     h->indent -= 2;
-    return html_raw(h, "</%s>\n", tag);
+    html_tag(h, "</", tag, NULL);
+    buf_lit(h->out, ">\n");
+    return h;
 }
 
 /// @brief Write a self-closing HTML tag
 Html* html_void(Html* h, const char* tag, const char* attrs) {
-    if (attrs) {
-        return html_raw(h, "<%s %s />\n", tag, attrs);
-    } else {
-        return html_raw(h, "<%s />\n", tag);
-    }
+    html_tag(h, "<", tag, attrs);
+    buf_lit(h->out, " />\n");
+    return h;
 }
 
 // Inline content (no newline after open, content on same line)
 Html* html_inline(Html* h, const char* tag, const char* attrs, const char* content) {
-    if (attrs) {
-        return html_raw(h, "<%s %s>%s</%s>\n", tag, attrs, content, tag);
-    } else {
-        return html_raw(h, "<%s>%s</%s>\n", tag, content, tag);
+    html_tag(h, "<", tag, attrs);
+    buf_char(h->out, '>');
+    buf_str(h->out, content);
+    buf_lit(h->out, "</");
+    buf_str(h->out, tag);
+    buf_lit(h->out, ">\n");
+    return h;
+}
+
+// Entities for the bytes `scan_html_special` stops at, indexed by the byte
+static const Str HTML_ENTITIES[256] = {
+    ['&'] = STR_LIT("&amp;"),
+    ['<'] = STR_LIT("&lt;"),
+    ['>'] = STR_LIT("&gt;"),
+    ['"'] = STR_LIT("&quot;"),
+};
+
+/// @brief Append `text` with &, <, > and " escaped, the runs between them are copied in bulk
+void html_escape(Buf* out, const char* text, u64 len) {
+    const char* p = text;
+    const char* end = text + len;
+    for (;;) {
+        const char* special = scan_html_special(p, end);
+        buf_write(out, p, special - p);
+        if (special == end) {
+            return;
+        }
+        const Str entity = HTML_ENTITIES[(u8)*special];
+        buf_write(out, entity.data, entity.len);
+        p = special + 1;
+    }
+}
+
+/// @brief `text` escaped for HTML, in `arena` if anything needed escaping and as-is otherwise
+Str html_escape_str(Arena* arena, Str text) {
+    const char* special = scan_html_special(text.data, text.data + text.len);
+    if (special == text.data + text.len) {
+        return text;
+    }
+    Buf out = buf_create(arena, (u64)text.len + 32);
+    html_escape(&out, text.data, text.len);
+    return (Str){out.data, (u32)out.len};
+}
+
+/// @brief Escape the NUL-terminated `text` into `dst`, truncating between entities if needed
+void html_escape_cstr(char* dst, u64 size, const char* text) {
+    u64 len = 0;
+    for (; *text; ++text) {
+        const Str entity = HTML_ENTITIES[(u8)*text];
+        const u64 n = entity.len ? entity.len : 1;
+        if (len + n + 1 > size) {
+            break;
+        }
+        memcpy(dst + len, entity.len ? entity.data : text, n);
+        len += n;
     }
+    dst[len] = '\0';
 }
 
 #endif // HTML_H
@@ -1,6 +1,11 @@
 #include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,145 +13,316 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 #include <time.h>
 #include <unistd.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "cache.h"
+#include "compress.h"
+#include "html.h"
+#include "md.h"
+#include "queue.h"
+#include "scan.h"
+#include "search.h"
+#include "template.h"
+#include "trace.h"
+#include "writer.h"
 #include "styles.h"
+#include "templates.h"
 
-// clang-format off
-typedef uint64_t u64;
-typedef uint32_t u32;
-typedef uint16_t u16;
-typedef uint8_t  u8;
-typedef int64_t  i64;
-typedef int32_t  i32;
-typedef int16_t  i16;
-typedef int8_t   i8;
-// clang-format on
+/// @brief A fixed set of threads that run batches of indexed tasks with work stealing.
+///
+/// Each worker starts a batch owning a contiguous slice of the task indices and pops from the
+/// front of it. Once its own slice runs dry it steals the upper half of another worker's slice,
+/// so a few expensive tasks clumped together don't leave the other workers idle. The thread
+/// calling `pool_run` takes part as worker 0.
+typedef struct Worker Worker;
+typedef void (*TaskFn)(void* ctx, u32 index, Worker* worker);
 
-#define LOG_ERROR(...) fprintf(stderr, "[ERROR] " __VA_ARGS__)
-#define LOG_WARN(...) fprintf(stderr, "[WARN] " __VA_ARGS__)
-#define LOG_INFO(...) fprintf(stderr, "[INFO] " __VA_ARGS__)
+typedef struct {
+    // [lo, hi) packed as `lo | (u64)hi << 32`, so a steal is a single CAS
+    _Alignas(64) _Atomic u64 range;
+} WorkRange;
+
+typedef struct Pool Pool;
+
+struct Worker {
+    u32 id;
+    Arena scratch; // cleared after every task
+    Writer writer; // outputs queued by this worker, flushed before `pool_run` returns
+    Pool* pool;
+    pthread_t thread;
+};
 
-#define ALIGNMENT 16
-#define ALIGN_UP_POW2(n, pow2) (((u64)(n) + ((u64)(pow2) - 1)) & (~((u64)(pow2) - 1)))
+struct Pool {
+    u32 worker_count;
+    Worker* workers;
+    WorkRange* ranges;
 
-#define KB(n) ((u64)(n) << 10)
-#define MB(n) ((u64)(n) << 20)
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    u64 generation;
+    u32 running;
+    bool shutdown;
 
-u64 get_page_size(void) {
-#if defined(__APPLE__) || defined(__linux__)
-    return (u64)getpagesize();
-#endif
-}
+    TaskFn fn;
+    void* ctx;
+};
 
-void* reserve_memory(u64 size) {
-#if defined(__APPLE__) || defined(__linux__)
-    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-#endif
+static inline u64 work_range_pack(u32 lo, u32 hi) {
+    return (u64)lo | ((u64)hi << 32);
 }
 
-void* commit_memory(void* addr, u64 size) {
-#if defined(__APPLE__) || defined(__linux__)
-    // On MacOS and Linux, memory is committed on access, so just return the address
-    return addr;
-#endif
+bool work_range_pop(WorkRange* r, u32* index) {
+    u64 cur = atomic_load(&r->range);
+    for (;;) {
+        const u32 lo = (u32)cur;
+        const u32 hi = (u32)(cur >> 32);
+        if (lo >= hi) {
+            return false;
+        }
+        if (atomic_compare_exchange_weak(&r->range, &cur, work_range_pack(lo + 1, hi))) {
+            *index = lo;
+            return true;
+        }
+    }
 }
 
-bool decommit_memory(void* addr, u64 size) {
-#if defined(__APPLE__)
-    // On MacOS, use madvise to indicate that the memory is no longer needed
-    return madvise(addr, size, MADV_FREE) == 0;
-#elif defined(__linux__)
-    // On Linux, use MADV_DONTNEED instead of MADV_FREE
-    return madvise(addr, size, MADV_DONTNEED) == 0;
-#endif
+/// @brief Move the upper half of some other worker's range into `self`, claiming one index
+bool work_range_steal(Pool* pool, u32 self, u32* index) {
+    for (u32 n = 1; n < pool->worker_count; ++n) {
+        WorkRange* victim = &pool->ranges[(self + n) % pool->worker_count];
+        u64 cur = atomic_load(&victim->range);
+        for (;;) {
+            const u32 lo = (u32)cur;
+            const u32 hi = (u32)(cur >> 32);
+            if (lo >= hi) {
+                break;
+            }
+            const u32 mid = hi - (hi - lo + 1) / 2;
+            if (atomic_compare_exchange_weak(&victim->range, &cur, work_range_pack(lo, mid))) {
+                atomic_store(&pool->ranges[self].range, work_range_pack(mid + 1, hi));
+                *index = mid;
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
-bool release_memory(void* addr, u64 size) {
-#if defined(__APPLE__) || defined(__linux__)
-    return munmap(addr, size) == 0;
-#endif
+void pool_work(Worker* worker) {
+    Pool* pool = worker->pool;
+    u32 index;
+    while (work_range_pop(&pool->ranges[worker->id], &index) ||
+           work_range_steal(pool, worker->id, &index)) {
+        pool->fn(pool->ctx, index, worker);
+        arena_clear(&worker->scratch);
+        writer_flush_if_full(&worker->writer);
+    }
+    writer_flush(&worker->writer);
 }
 
-typedef struct {
-    void* base;
-    u64 reserved;
-    u64 committed;
-    u64 used;
-} Arena;
-
-Arena arena_create(u64 reserve_size) {
-    const u64 page_size = get_page_size();
-    reserve_size = ALIGN_UP_POW2(reserve_size, page_size);
-
-    void* base = reserve_memory(reserve_size);
-    if (base == NULL) {
-        exit(1);
-    }
-
-    // clang-format off
-    return (Arena){
-        .base = base,
-        .reserved = reserve_size,
-        .committed = 0,
-        .used = 0
-    };
-    // clang-format on
-}
+void* pool_thread_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Pool* pool = worker->pool;
+    trace_tid = worker->id;
+    u64 seen_generation = 0;
 
-void* arena_push(Arena* arena, u64 size, u64 alignment) {
-    assert((alignment & (alignment - 1)) == 0); // alignment must be power of 2
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->shutdown && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
 
-    const u64 aligned_used = ALIGN_UP_POW2(arena->used, alignment);
-    const u64 newUsed = aligned_used + size;
+        pool_work(worker);
 
-    if (newUsed > arena->reserved) {
-        LOG_ERROR(
-            "Arena out of memory: requested %llu bytes, but only %llu bytes "
-            "reserved\n",
-            newUsed,
-            arena->reserved);
-        exit(1);
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->mutex);
     }
+}
 
-    if (newUsed > arena->committed) {
-        const u64 page_size = get_page_size();
-        // No need to clamp `new_commit` here because `newUsed <= arena->reserved`,
-        // and `arena->reserved` is is already aligned to page size. Therefore,
-        // `new_commit` will also be <= `arena->reserved`.
-        const u64 new_commit = ALIGN_UP_POW2(newUsed, page_size);
-        char* start = (char*)arena->base + arena->committed;
-        u64 commit_size = new_commit - arena->committed;
-        if (commit_memory(start, commit_size) == NULL) {
+void pool_create(Pool* pool, Arena* arena, u32 worker_count) {
+    assert(worker_count > 0);
+    *pool = (Pool){.worker_count = worker_count};
+    pool->workers = arena_push(arena, sizeof(Worker) * worker_count, ALIGNMENT);
+    pool->ranges = arena_push(arena, sizeof(WorkRange) * worker_count, _Alignof(WorkRange));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (u32 i = 0; i < worker_count; ++i) {
+        Worker* worker = &pool->workers[i];
+        *worker = (Worker){.id = i, .scratch = arena_create(GB(4)), .pool = pool};
+        writer_init(&worker->writer);
+        atomic_init(&pool->ranges[i].range, 0);
+        // Worker 0 is whichever thread calls `pool_run`
+        if (i > 0 && pthread_create(&worker->thread, NULL, pool_thread_main, worker) != 0) {
+            LOG_ERROR("Failed to start worker thread %u\n", i);
             exit(1);
         }
-        arena->committed = new_commit;
     }
+}
+
+void pool_destroy(Pool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        if (i > 0) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+        arena_release(&pool->workers[i].scratch);
+        writer_release(&pool->workers[i].writer);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+}
+
+/// @brief Run `fn(ctx, i, worker)` for every `i` in [0, count) and wait for all of them
+void pool_run(Pool* pool, u32 count, TaskFn fn, void* ctx) {
+    if (count == 0) {
+        return;
+    }
+
+    const u32 n = pool->worker_count;
+    for (u32 i = 0; i < n; ++i) {
+        const u32 lo = (u32)((u64)count * i / n);
+        const u32 hi = (u32)((u64)count * (i + 1) / n);
+        atomic_store(&pool->ranges[i].range, work_range_pack(lo, hi));
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->running = n - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool_work(&pool->workers[0]);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/// @brief Number of outputs the workers failed to write since the last call
+u32 pool_take_write_failures(Pool* pool) {
+    u32 failures = 0;
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        failures += writer_take_failures(&pool->workers[i].writer);
+    }
+    return failures;
+}
 
-    void* result = (char*)arena->base + aligned_used;
-    arena->used = newUsed;
-    return result;
+static inline u64 rotl64(u64 x, u32 r) {
+    return (x << r) | (x >> (64 - r));
 }
 
-void arena_clear(Arena* arena) {
-    arena->used = 0;
+/// @brief Fast non-cryptographic 64-bit hash, consumes 8 bytes per step
+u64 hash_bytes(const void* data, u64 len, u64 seed) {
+    const u8* p = (const u8*)data;
+    u64 h = seed ^ (len * 0x9e3779b97f4a7c15ull);
+
+    while (len >= 8) {
+        u64 w;
+        memcpy(&w, p, 8);
+        w *= 0xbf58476d1ce4e5b9ull;
+        w ^= w >> 31;
+        h = rotl64((h ^ w) * 0x94d049bb133111ebull, 27);
+        p += 8;
+        len -= 8;
+    }
+
+    u64 w = 0;
+    memcpy(&w, p, len);
+    h ^= w * 0xbf58476d1ce4e5b9ull;
+
+    // Final avalanche (splitmix64)
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
 }
 
-bool arena_release(Arena* arena) {
-    const bool result = release_memory(arena->base, arena->reserved);
-    *arena = (Arena){0};
-    return result;
+i64 stat_mtime_ns(const struct stat* st) {
+#if defined(__APPLE__)
+    return (i64)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (i64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
 }
 
-#define PATH_MAX 1024
 #define TITLE_MAX 256
-#define DATE_MAX 64
+// Sources over --stream-above are read and rendered through a window of this size
+#define STREAM_WINDOW KB(256)
+#define STREAM_ABOVE_DEFAULT MB(64)
 #define PUBLIC_DIR "./public"
 #define CONTENT_DIR "./content"
 #define ASSET_DIR "./assets"
 
 #define SITE_URL "journal.willcodeforboba.dev"
 
+// Bump whenever the generated HTML changes in a way RENDERER_HASH doesn't see, so incremental
+// builds re-render everything
+#define TEMPLATE_VERSION 4
+#define MANIFEST_PATH PUBLIC_DIR "/.manifest"
+#define ASSET_MANIFEST_PATH PUBLIC_DIR "/assets.json"
+#define SEARCH_PATH PUBLIC_DIR "/search.bin"
+#define SITEMAP_PATH PUBLIC_DIR "/sitemap.xml"
+#define FEED_SIZE_DEFAULT 20
+#define CONFIG_PATH "./mksite.conf"
+
+typedef struct {
+    bool force; // ignore the manifest and rebuild every output
+    u32 jobs;   // worker threads used for rendering
+    bool mmap;  // map sources instead of copying them into the arena
+    bool inline_css; // embed styles.css in every page instead of linking one shared file
+    bool precompress; // write .gz/.br sidecars next to every output
+    bool watch; // stay resident and rebuild whatever changes on disk
+    const char* trace_path; // where to write the --trace output, NULL when not tracing
+    u32 per_page; // posts per index page, 0 puts every post on index.html
+    bool archives; // also write per-year and per-month archive pages
+    u64 stream_above; // sources bigger than this are streamed instead of loaded whole
+    bool fingerprint; // put a content hash in every asset's name so it can be cached forever
+    u32 feed_size; // newest pages in each index's feed.xml
+    const char* cache_dir; // render cache, NULL when pages are always rendered
+    const char* cache_url; // remote store behind `cache_dir`, NULL for a local-only cache
+} Options;
+
+Options opts;
+
+// Root-relative URL of the fingerprinted stylesheet, empty when styles are inlined
+char stylesheet_href[64];
+// Root-relative URL of assets/favicon.svg, fingerprinted with --fingerprint
+char favicon_href[MKSITE_PATH_MAX] = "/favicon.svg";
+
+// The styles in use: the copy of styles.css embedded at compile time, or a fresh read of the
+// file once --watch sees it change
+const u8* site_css;
+u64 site_css_len;
+
 // clang-format off
 const char* MONTHS_FULL[] = {
     "January",
@@ -179,51 +355,198 @@ const char* MONTHS_ABBR[] = {
 };
 // clang-format on
 
-bool format_date(const char* iso_date, const char* dict[], char out[32]) {
-    i32 year, month, day;
-    if (sscanf(iso_date, "%d-%d-%d", &year, &month, &day) != 3) {
-        return false;
+/// @brief Pack a date as YYYYMMDD so that dates compare as plain integers
+#define DATE_PACK(year, month, day) ((u32)(year) * 10000 + (u32)(month) * 100 + (u32)(day))
+#define DATE_YEAR(date) ((date) / 10000)
+#define DATE_MONTH(date) ((date) / 100 % 100)
+#define DATE_DAY(date) ((date) % 100)
+
+static const char* parse_date_field(const char* p, const char* end, u32 max_digits, u32* out) {
+    u32 value = 0;
+    u32 digits = 0;
+    while (p < end && digits < max_digits && *p >= '0' && *p <= '9') {
+        value = value * 10 + (u32)(*p++ - '0');
+        ++digits;
     }
-    assert(month >= 1 && month <= 12);
-    snprintf(out, 32, "%s %2d, %04d", dict[month - 1], day, year);
-    return true;
+    *out = value;
+    return digits ? p : NULL;
+}
+
+/// @brief Number of days in `month` (1-12) of `year`, Gregorian leap years included
+static u32 days_in_month(u32 year, u32 month) {
+    static const u8 days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return days[month - 1] + (month == 2 && leap);
 }
 
-bool format_date_full(const char* iso_date, char out[32]) {
-    return format_date(iso_date, MONTHS_FULL, out);
+/// @brief Parse [str, end) as a `YYYY-MM-DD` date into a packed date.
+///
+/// Single-digit months and days are accepted, and so is trailing whitespace (a CR, say).
+/// Anything else after the day, or a day the month doesn't have, is an error rather than a
+/// date that ends up in feed.xml and sitemap.xml.
+bool parse_date(const char* str, const char* end, u32* date) {
+    u32 year, month, day;
+    const char* p = parse_date_field(str, end, 4, &year);
+    if (!p || p == end || *p++ != '-' || !(p = parse_date_field(p, end, 2, &month)) ||
+        p == end || *p++ != '-' || !(p = parse_date_field(p, end, 2, &day))) {
+        return false;
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        ++p;
+    }
+    if (p != end || month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)) {
+        return false;
+    }
+    *date = DATE_PACK(year, month, day);
+    return true;
 }
 
-bool format_date_abbr(const char* iso_date, char out[32]) {
-    return format_date(iso_date, MONTHS_ABBR, out);
+/// @brief Write `date` as "<month> DD, YYYY" into `out`, returns the length.
+///
+/// Same output as printf's "%s %2d, %04d", with the day padded by a space.
+u32 format_date(u32 date, const char* dict[], char out[32]) {
+    const char* month = dict[DATE_MONTH(date) - 1];
+    const u32 month_len = (u32)strlen(month);
+    const u32 day = DATE_DAY(date);
+    const u32 year = DATE_YEAR(date);
+
+    char* p = out;
+    memcpy(p, month, month_len);
+    p += month_len;
+    *p++ = ' ';
+    *p++ = day >= 10 ? (char)('0' + day / 10) : ' ';
+    *p++ = (char)('0' + day % 10);
+    *p++ = ',';
+    *p++ = ' ';
+    *p++ = (char)('0' + year / 1000);
+    *p++ = (char)('0' + year / 100 % 10);
+    *p++ = (char)('0' + year / 10 % 10);
+    *p++ = (char)('0' + year % 10);
+    *p = '\0';
+    return (u32)(p - out);
 }
 
 typedef struct {
-    char title[TITLE_MAX];
-    char slug[TITLE_MAX];
-    char date[DATE_MAX];
-    const char* content;
+    Str title; // points into `source`
+    Str title_html; // `title` escaped once for the page and the index, often `title` itself
+    Str slug; // interned in the collection arena and NUL-terminated, so it can go into paths
+    u32 date; // packed YYYYMMDD, 0 when the page has none
+    Str date_full; // "January  5, 2024", formatted at import and empty without a date
+    Str date_abbr; // "Jan  5, 2024"
+    const char* source_name; // file name within its collection directory
+    const char* source; // whole file, including the front matter. NULL when streamed.
+    const char* content; // NULL when streamed
+    u64 content_len;
+    const char* stream_path; // set for sources too big to load, see `build_page_streamed`
+    u64 content_offset; // where the content starts in a streamed source
+    u64 source_size;
+    i64 source_mtime; // nanoseconds
+    const SearchTerm* search_terms; // kept across --watch rebuilds, NULL until first indexed
+    u32 search_term_count;
 } Page;
 
-int compare_pages_desc(const void* a, const void* b) {
-    const Page* page_a = (const Page*)a;
-    const Page* page_b = (const Page*)b;
-    return strcmp(page_b->date, page_a->date);
+typedef enum {
+    SORT_NEWEST,
+    SORT_OLDEST,
+    SORT_TITLE,
+} SortOrder;
+
+static int page_title_compare(const void* a, const void* b) {
+    const Page* pa = *(const Page* const*)a;
+    const Page* pb = *(const Page* const*)b;
+    const u32 len = pa->title.len < pb->title.len ? pa->title.len : pb->title.len;
+    const int c = memcmp(pa->title.data, pb->title.data, len);
+    if (c != 0 || pa->title.len != pb->title.len) {
+        return c != 0 ? c : (pa->title.len < pb->title.len ? -1 : 1);
+    }
+    return pa < pb ? -1 : pa > pb; // the array order breaks ties, which keeps it stable
+}
+
+/// @brief Fill `sorted` with the indices of `pages` in `order`, keeping the directory order for
+/// pages that compare equal.
+///
+/// Dates are sorted as packed (date, index) keys, which keeps the comparisons on a small dense
+/// array.
+void order_pages(
+    const Page* pages,
+    u32 page_count,
+    SortOrder order,
+    u32* sorted,
+    Arena* scratch) {
+    if (order == SORT_TITLE) {
+        const Page** by_title = arena_push(scratch, sizeof(Page*) * page_count, ALIGNMENT);
+        for (u32 i = 0; i < page_count; ++i) {
+            by_title[i] = &pages[i];
+        }
+        qsort(by_title, page_count, sizeof(Page*), page_title_compare);
+        for (u32 i = 0; i < page_count; ++i) {
+            sorted[i] = (u32)(by_title[i] - pages);
+        }
+        return;
+    }
+
+    u64* keys = arena_push(scratch, sizeof(u64) * page_count, ALIGNMENT);
+    for (u32 i = 0; i < page_count; ++i) {
+        const u32 date = order == SORT_NEWEST ? UINT32_MAX - pages[i].date : pages[i].date;
+        keys[i] = (u64)date << 32 | i;
+    }
+
+    // LSD radix sort, one byte at a time. Keys are unique so the result is fully determined.
+    u64* tmp = arena_push(scratch, sizeof(u64) * page_count, ALIGNMENT);
+    for (u32 shift = 0; shift < 64; shift += 8) {
+        u32 counts[256] = {0};
+        for (u32 i = 0; i < page_count; ++i) {
+            ++counts[(keys[i] >> shift) & 0xff];
+        }
+        // Skip bytes that are the same in every key, like the high bytes of small indices
+        if (page_count && counts[(keys[0] >> shift) & 0xff] == page_count) {
+            continue;
+        }
+        u32 offset = 0;
+        for (u32 b = 0; b < 256; ++b) {
+            const u32 count = counts[b];
+            counts[b] = offset;
+            offset += count;
+        }
+        for (u32 i = 0; i < page_count; ++i) {
+            tmp[counts[(keys[i] >> shift) & 0xff]++] = keys[i];
+        }
+        u64* swap = keys;
+        keys = tmp;
+        tmp = swap;
+    }
+
+    for (u32 i = 0; i < page_count; ++i) {
+        sorted[i] = (u32)keys[i];
+    }
+}
+
+/// @brief Sort pages as `order_pages` does, moving each of them once
+void sort_pages(Page* pages, u32 page_count, SortOrder order, Arena* scratch) {
+    u32* indices = arena_push(scratch, sizeof(u32) * page_count, ALIGNMENT);
+    order_pages(pages, page_count, order, indices, scratch);
+    Page* sorted = arena_push(scratch, sizeof(Page) * page_count, ALIGNMENT);
+    for (u32 i = 0; i < page_count; ++i) {
+        sorted[i] = pages[indices[i]];
+    }
+    memcpy(pages, sorted, sizeof(Page) * page_count);
 }
 
-#define PRINT(...) fprintf(fout, __VA_ARGS__)
+#define PRINT(lit) buf_lit(out, lit)
 
-char* trim_leading_spaces(char* str) {
-    while (*str == ' ') {
+const char* trim_leading_spaces(const char* str, const char* end) {
+    while (str < end && *str == ' ') {
         str++;
     }
     return str;
 }
 
-void slugify(const char* input, char* output, u32 output_size) {
+/// @brief Write the slug for `input` into `output`, returns its length
+u32 slugify(const char* input, u32 input_len, char* output, u32 output_size) {
     u32 j = 0;
     bool prev_was_dash = true; // Start true to skip leading dashes
 
-    for (u32 i = 0; input[i] && j < output_size - 1; ++i) {
+    for (u32 i = 0; i < input_len && j < output_size - 1; ++i) {
         char c = input[i];
 
         if (isalnum(c)) {
@@ -241,495 +564,3468 @@ void slugify(const char* input, char* output, u32 output_size) {
     }
 
     output[j] = '\0';
+    return j;
 }
 
-char* read_file(Arena* arena, const char* path, u64* file_len) {
+/// @brief Read the file at `path`, or only its first `head_len` bytes if it's over `max_len`.
+///
+/// The result is NUL-terminated, `read_len` says how much of the `file_len` bytes it holds.
+char* read_file_head(
+    Arena* arena,
+    const char* path,
+    u64 max_len,
+    u64 head_len,
+    u64* file_len,
+    u64* read_len,
+    i64* mtime_ns) {
     FILE* f = fopen(path, "rb");
     if (!f) {
         return NULL;
     }
-    fseek(f, 0, SEEK_END);
-    *file_len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    char* content = arena_push(arena, *file_len + 1, ALIGNMENT);
-    fread(content, 1, *file_len, f);
-    content[*file_len] = '\0'; // null-terminate
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    *file_len = (u64)st.st_size;
+    *mtime_ns = stat_mtime_ns(&st);
+
+    const u64 len = *file_len > max_len ? head_len : *file_len;
+    char* content = arena_push(arena, len + 1, ALIGNMENT);
+    *read_len = fread(content, 1, len, f);
+    content[*read_len] = '\0'; // null-terminate
+    trace_add_read(*read_len);
     fclose(f);
     return content;
 }
 
-u32 import_pages(const char* dir_path, Arena* arena, Page** out_pages) {
-    DIR* dir = opendir(dir_path);
-    if (!dir) {
-        LOG_ERROR("Failed to open directory: %s\n", dir_path);
-        return 0;
-    }
+char* read_file(Arena* arena, const char* path, u64* file_len, i64* mtime_ns) {
+    u64 read_len = 0;
+    return read_file_head(arena, path, UINT64_MAX, 0, file_len, &read_len, mtime_ns);
+}
 
-    // First pass: count pages
-    u32 page_count = 0;
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL) {
-        const char* name = entry->d_name;
-        const u32 len = strlen(name);
-        if (len > 4 && strcmp(name + len - 4, ".txt") == 0) {
-            ++page_count;
-        }
+/// @brief Map the file at `path` read-only. The mapping lives until `arena` is cleared.
+///
+/// Unlike `read_file`, the result is not NUL-terminated.
+const char* map_file(Arena* arena, const char* path, u64* file_len, i64* mtime_ns) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
     }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    *file_len = (u64)st.st_size;
+    *mtime_ns = stat_mtime_ns(&st);
 
-    LOG_INFO("Scanned %s: found %u pages\n", dir_path, page_count);
-
-    // Allocate array of pages
-    *out_pages = (Page*)arena_push(arena, sizeof(Page) * page_count, ALIGNMENT);
-
-    // Second pass: populate pages
-    rewinddir(dir);
-    u32 idx = 0;
-    while ((entry = readdir(dir)) != NULL) {
-        const char* name = entry->d_name;
-        const u32 len = strlen(name);
-        if (len > 4 && strcmp(name + len - 4, ".txt") == 0) {
-            LOG_INFO("Importing page: %s\n", name);
+    if (*file_len == 0) {
+        close(fd);
+        return "";
+    }
 
-            Page* page = &(*out_pages)[idx++];
+    void* data = mmap(NULL, *file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, *file_len, MADV_SEQUENTIAL);
+    trace_add_read(*file_len);
+    arena_track_mapping(arena, data, *file_len);
+    return data;
+}
 
-            char full_path[PATH_MAX];
-            snprintf(full_path, PATH_MAX, "%s/%s", dir_path, name);
+/// @brief Parse the front matter at the start of `data` into `page`.
+///
+/// `content` is left past the closing `---`, and `ended` says whether there was one. Returns false
+/// if a field is invalid, naming `path` in the error.
+bool parse_front_matter(
+    Arena* arena,
+    const char* path,
+    const char* data,
+    u64 len,
+    Page* page,
+    const char** content,
+    bool* ended) {
+    // Mapped sources aren't NUL-terminated, so every comparison is bounded by the line
+    const char* start = data;
+    const char* end = start + len;
+    *ended = false;
+    while (start < end) {
+        const char* line = memchr(start, '\n', end - start);
+        u64 line_len = line ? (line - start) : (end - start);
+        const char* line_end = start + line_len;
+
+        // End of metadata
+        if (line_len == 3 && memcmp(start, "---", 3) == 0) {
+            start = line ? line + 1 : end;
+            *ended = true;
+            break;
+        }
 
-            u64 file_len = 0;
-            const char* data = read_file(arena, full_path, &file_len);
-            if (!data) {
-                LOG_ERROR("Failed to read %s\n", full_path);
-                closedir(dir);
-                return 0;
+        if (line_len >= 6 && memcmp(start, "title:", 6) == 0) {
+            const char* value = trim_leading_spaces(start + 6, line_end);
+            u64 title_len = line_end - value;
+            if (title_len > TITLE_MAX - 1) {
+                title_len = TITLE_MAX - 1;
             }
+            page->title = (Str){value, (u32)title_len};
+            page->title_html = html_escape_str(arena, page->title);
+
+            char slug[TITLE_MAX];
+            const u32 slug_len = slugify(value, (u32)title_len, slug, sizeof(slug));
+            char* interned = arena_push(arena, slug_len + 1, 1);
+            memcpy(interned, slug, slug_len + 1);
+            page->slug = (Str){interned, slug_len};
+        } else if (line_len >= 5 && memcmp(start, "date:", 5) == 0) {
+            const char* value = trim_leading_spaces(start + 5, line_end);
+            if (value < line_end && !parse_date(value, line_end, &page->date)) {
+                LOG_ERROR(
+                    "Invalid date in %s: %.*s (expected YYYY-MM-DD)\n",
+                    path,
+                    (int)(line_end - value),
+                    value);
+                return false;
+            }
+        }
+        start = line ? line + 1 : end;
+    }
+    *content = start;
+    return true;
+}
 
-            char* start = (char*)data;
-            char* end = start + file_len;
-            while (start < end) {
-                char* line = memchr(start, '\n', end - start);
-                u64 line_len = line ? (line - start) : (end - start);
+/// @brief Read `dir_path/name` and parse its front matter into `page`
+bool import_page(Arena* arena, const char* dir_path, const char* name, Page* page) {
+    *page = (Page){0};
+
+    char full_path[MKSITE_PATH_MAX];
+    snprintf(full_path, MKSITE_PATH_MAX, "%s/%s", dir_path, name);
+
+    // Sources over the --stream-above limit only have their front matter loaded here, the
+    // content is streamed through a fixed window when the page is rendered
+    u64 file_len = 0;
+    u64 head_len = 0;
+    i64 mtime_ns = 0;
+    const char* data = NULL;
+    if (opts.mmap) {
+        data = map_file(arena, full_path, &file_len, &mtime_ns);
+        head_len = file_len > opts.stream_above && file_len > STREAM_WINDOW ? STREAM_WINDOW
+                                                                            : file_len;
+    } else {
+        data = read_file_head(
+            arena, full_path, opts.stream_above, STREAM_WINDOW, &file_len, &head_len, &mtime_ns);
+    }
+    if (!data) {
+        LOG_ERROR("Failed to read %s\n", full_path);
+        return false;
+    }
+    const bool streamed = head_len < file_len;
 
-                // End of metadata
-                if (line_len == 3 && strncmp(start, "---", 3) == 0) {
-                    start = line ? line + 1 : end;
-                    break;
-                }
+    const u64 name_len = strlen(name);
+    char* source_name = arena_push(arena, name_len + 1, 1);
+    memcpy(source_name, name, name_len + 1);
 
-                if (strncmp(start, "title:", 6) == 0) {
-                    char* value = trim_leading_spaces(start + 6);
-                    snprintf(
-                        page->title,
-                        sizeof(page->title),
-                        "%.*s",
-                        (int)(line_len - (value - start)),
-                        value);
-                    slugify(page->title, page->slug, sizeof(page->slug));
-                } else if (strncmp(start, "date:", 5) == 0) {
-                    char* value = trim_leading_spaces(start + 5);
-                    snprintf(
-                        page->date,
-                        sizeof(page->date),
-                        "%.*s",
-                        (int)(line_len - (value - start)),
-                        value);
-                }
-                start = line ? line + 1 : end;
-            }
+    page->source_name = source_name;
+    page->source = data;
+    page->source_size = file_len;
+    page->source_mtime = mtime_ns;
 
-            page->content = start;
-        }
+    const char* start = NULL;
+    bool front_matter_ended = false;
+    if (!parse_front_matter(arena, full_path, data, head_len, page, &start, &front_matter_ended)) {
+        return false;
     }
 
-    return page_count;
-}
+    if (!page->slug.data) {
+        page->slug = STR_LIT("");
+    }
 
-typedef enum {
-    FORMAT_NONE,
-    FORMAT_BOLD,
-    FORMAT_ITALIC,
-    FORMAT_HIGHLIGHT,
-    FORMAT_INLINE_CODE,
-    FORMAT_TYPE_COUNT
-} FormatType;
-
-FormatType get_format_type(const char* text, u32 pos, u32 len) {
-    if (pos + 1 < len && text[pos] == '*' && text[pos + 1] == '*') {
-        return FORMAT_BOLD;
-    } else if (pos + 1 < len && text[pos] == '_' && text[pos + 1] == '_') {
-        return FORMAT_ITALIC;
-    } else if (pos + 1 < len && text[pos] == '=' && text[pos + 1] == '=') {
-        return FORMAT_HIGHLIGHT;
-    } else if (text[pos] == '`' && pos + 1 < len && text[pos + 1] != '`') {
-        return FORMAT_INLINE_CODE;
-    }
-    return FORMAT_NONE;
-}
-
-void write_formatted_line(FILE* fout, const char* text, u32 len) {
-    bool in_bold = false;
-    bool in_italic = false;
-    bool in_highlight = false;
-
-    for (u32 i = 0; i < len; ++i) {
-        FormatType fmt_type = get_format_type(text, i, len);
-        switch (fmt_type) {
-            case FORMAT_BOLD:
-                if (in_bold) {
-                    fprintf(fout, "</strong>");
-                    in_bold = false;
-                } else {
-                    fprintf(fout, "<strong>");
-                    in_bold = true;
-                }
-                ++i; // skip next '*'
-                continue;
-            case FORMAT_ITALIC:
-                if (in_italic) {
-                    fprintf(fout, "</em>");
-                    in_italic = false;
-                } else {
-                    fprintf(fout, "<em>");
-                    in_italic = true;
-                }
-                i += 1; // skip next '_'
-                continue;
-            case FORMAT_HIGHLIGHT:
-                if (in_highlight) {
-                    fprintf(fout, "</mark>");
-                    in_highlight = false;
-                } else {
-                    fprintf(fout, "<mark>");
-                    in_highlight = true;
-                }
-                i += 1; // skip next '='
-                continue;
-            case FORMAT_INLINE_CODE: {
-                u32 j = i + 1;
-                while (j < len && text[j] != '`') {
-                    ++j;
-                }
-                if (j < len) {
-                    // Found closing backtick
-                    u32 code_len = j - (i + 1);
-                    fprintf(fout, "<code>%.*s</code>", code_len, text + i + 1);
-                    i = j; // Move past closing backtick
-                } else {
-                    // No closing backtick found, treat as normal text
-                    fputc(text[i], fout);
-                }
-                continue;
-            }
-            case FORMAT_NONE:
-            default:
-                fputc(text[i], fout);
-                break;
+    if (streamed) {
+        if (!front_matter_ended) {
+            LOG_ERROR(
+                "Front matter of %s doesn't end within the first %u KB\n",
+                full_path,
+                (u32)(STREAM_WINDOW / 1024));
+            return false;
         }
+        const u64 path_len = strlen(full_path);
+        char* stream_path = arena_push(arena, path_len + 1, 1);
+        memcpy(stream_path, full_path, path_len + 1);
+        page->stream_path = stream_path;
+        page->source = NULL;
+        page->content_offset = (u64)(start - data);
+        LOG_INFO("Streaming %s (%.1f MB)\n", full_path, file_len / (1024.0 * 1024.0));
     }
 
-    if (in_bold) {
-        fprintf(fout, "</strong>");
+    // Both forms are needed on every build, the page itself and the index
+    page->date_full = page->date_abbr = STR_LIT("");
+    if (page->date) {
+        char formatted[32];
+        u32 len = format_date(page->date, MONTHS_FULL, formatted);
+        char* full = arena_push(arena, len, 1);
+        memcpy(full, formatted, len);
+        page->date_full = (Str){full, len};
+
+        len = format_date(page->date, MONTHS_ABBR, formatted);
+        char* abbr = arena_push(arena, len, 1);
+        memcpy(abbr, formatted, len);
+        page->date_abbr = (Str){abbr, len};
     }
-    if (in_italic) {
-        fprintf(fout, "</em>");
+    page->content = streamed ? NULL : start;
+    page->content_len = file_len - (u64)(start - data);
+    return true;
+}
+
+bool is_page_source(const char* name) {
+    const u32 len = strlen(name);
+    return len > 4 && strcmp(name + len - 4, ".txt") == 0;
+}
+
+// Called once a page is fully imported, while the rest of the directory still is
+typedef void (*PageImportedFn)(void* ctx, u32 index);
+
+/// @brief Import every page source in `dir_path` in a single pass over the directory.
+///
+/// Sources go into `arena` while the page array grows in place in `page_arena`, which must hold
+/// nothing else. Both stay put as they grow, so `imported` (if not NULL) can hand pages to other
+/// threads straight away. An empty directory is fine, returns false if anything can't be read.
+bool import_pages(
+    const char* dir_path,
+    Arena* arena,
+    Arena* page_arena,
+    Page** out_pages,
+    u32* out_count,
+    PageImportedFn imported,
+    void* ctx) {
+    DIR* dir = opendir(dir_path);
+    if (!dir) {
+        LOG_ERROR("Failed to open directory: %s\n", dir_path);
+        return false;
     }
-    if (in_highlight) {
-        fprintf(fout, "</mark>");
+
+    *out_pages = (Page*)((char*)page_arena->base + page_arena->used);
+    u32 page_count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Filesystems that fill in d_type let us skip directories without looking at the name
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        const char* name = entry->d_name;
+        if (!is_page_source(name)) {
+            continue;
+        }
+
+        Page* page = arena_push(page_arena, sizeof(Page), _Alignof(Page));
+        assert(page == &(*out_pages)[page_count]);
+        LOG_INFO("Importing page: %s\n", name);
+        if (!import_page(arena, dir_path, name, page)) {
+            closedir(dir);
+            *out_count = page_count;
+            return false;
+        }
+        if (imported) {
+            imported(ctx, page_count);
+        }
+        ++page_count;
     }
+
+    closedir(dir);
+    LOG_INFO("Scanned %s: found %u pages\n", dir_path, page_count);
+    *out_count = page_count;
+    return true;
 }
 
-void html_write_head(FILE* fout, const char* title) {
-    PRINT("<!DOCTYPE html>\n");
-    PRINT("<html lang=\"en\">\n");
-    PRINT("<head>\n");
-    PRINT("  <meta charset=\"utf-8\">\n");
-    PRINT("  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\n");
-    PRINT("  <link rel=\"icon\" type=\"image/svg+xml\" href=\"/favicon.svg\" />\n");
-    PRINT("  <title>%s</title>\n", title);
-    PRINT("  <style>\n%.*s\n</style>\n", styles_css_len, styles_css);
-    PRINT("</head>\n");
+/// @brief Fill in the holes of the shared <head>, see templates/head.html
+void template_head_holes(Str* holes, Str title) {
+    holes[TEMPLATE_HOLE_TITLE] = title;
+    if (opts.inline_css) {
+        holes[TEMPLATE_HOLE_INLINE_STYLES] = (Str){(const char*)site_css, (u32)site_css_len};
+    } else {
+        holes[TEMPLATE_HOLE_STYLESHEET] = (Str){stylesheet_href, (u32)strlen(stylesheet_href)};
+    }
+    holes[TEMPLATE_HOLE_FAVICON] = (Str){favicon_href, (u32)strlen(favicon_href)};
 }
 
-void html_write_header(FILE* fout) {
+void html_write_header(Buf* out) {
     PRINT("<header>\n");
     PRINT("  <nav>\n");
-    PRINT("    <a href=\"/\">%s</a>\n", SITE_URL);
+    PRINT("    <a href=\"/\">" SITE_URL "</a>\n");
     PRINT("  </nav>\n");
     PRINT("</header>\n");
 }
 
+/// @brief Renders templates/page.html around a page's content
 typedef struct {
-    u32 text_offset;
-    u8 level;
-} HeadingInfo;
-
-HeadingInfo get_heading_info(const char* line, u32 len) {
-    HeadingInfo info = {0, 0};
-    u32 i = 0;
+    Buf* out;
+    MdFootnotes footnotes;
+    MdRenderer md;
+    Str holes[TEMPLATE_HOLE_COUNT];
+    u32 template_part; // where templates/page.html carries on, after the content or the nav
+} PageRenderer;
+
+/// @brief The pages a page links to, its neighbours in the index. NULL at either end.
+typedef struct {
+    const Page* prev;
+    const Page* next;
+} PageNav;
+
+void page_holes(Str holes[TEMPLATE_HOLE_COUNT], const Page* page) {
+    memset(holes, 0, sizeof(Str) * TEMPLATE_HOLE_COUNT);
+    template_head_holes(holes, page->title_html);
+    holes[TEMPLATE_HOLE_DATE] = page->date_full;
+    holes[TEMPLATE_HOLE_CONTENT] = TEMPLATE_DEFER;
+    holes[TEMPLATE_HOLE_NAV] = TEMPLATE_DEFER;
+}
 
-    while (i < len && line[i] == '#') {
-        ++info.level;
-        ++i;
-    }
+/// @brief Write templates/page.html up to the page content
+void build_page_head(PageRenderer* r, Buf* out, const Page* page, Arena* scratch) {
+    r->out = out;
+    md_renderer_init(&r->md, out, &r->footnotes, scratch);
+    page_holes(r->holes, page);
+    r->template_part = template_render(out, &TEMPLATE_PAGE, 0, r->holes);
+}
 
-    if (i < len && line[i] == ' ') i++;
+/// @brief Finish the content and write templates/page.html up to the navigation
+void build_page_tail(PageRenderer* r) {
+    md_render_finish(&r->md);
+    r->template_part = template_render(r->out, &TEMPLATE_PAGE, r->template_part, r->holes);
+}
 
-    if (info.level > 0 && info.level <= 6) {
-        info.text_offset = i;
-    } else {
-        info.level = 0;
+/// @brief Write the links to a page's neighbours and the rest of templates/page.html.
+///
+/// `template_part` is where `build_page_tail` left off, so the navigation can be added long
+/// after the rest of the page was rendered, once the index order is known.
+void build_page_nav(Buf* out, const Page* page, const PageNav* nav, u32 template_part) {
+    Str holes[TEMPLATE_HOLE_COUNT];
+    char prev[MKSITE_PATH_MAX];
+    char next[MKSITE_PATH_MAX];
+    if (nav && (nav->prev || nav->next)) {
+        memset(holes, 0, sizeof(holes));
+        if (nav->prev) {
+            const int len = snprintf(prev, sizeof(prev), "%s.html", nav->prev->slug.data);
+            holes[TEMPLATE_HOLE_PREV] = (Str){prev, (u32)len};
+            holes[TEMPLATE_HOLE_PREV_TITLE] = nav->prev->title_html;
+        }
+        if (nav->next) {
+            const int len = snprintf(next, sizeof(next), "%s.html", nav->next->slug.data);
+            holes[TEMPLATE_HOLE_NEXT] = (Str){next, (u32)len};
+            holes[TEMPLATE_HOLE_NEXT_TITLE] = nav->next->title_html;
+        }
+        template_render(out, &TEMPLATE_NAV, 0, holes);
     }
-
-    return info;
+    page_holes(holes, page);
+    template_render(out, &TEMPLATE_PAGE, template_part, holes);
 }
 
-void build_page(FILE* fout, const Page* page) {
-    char formatted_date[32];
-    if (page->date[0] && !format_date_full(page->date, formatted_date)) {
-        LOG_WARN("Invalid date format in page %s: %s\n", page->slug, page->date);
-        formatted_date[0] = '\0';
+/// @brief Hash of what a page shows of its neighbours, 0 when it links to none
+u64 page_nav_hash(const PageNav* nav) {
+    if (!nav->prev && !nav->next) {
+        return 0;
     }
-
-    // Output HTML
-    // clang-format off
-    html_write_head(fout, page->title);
-    fprintf(fout, "<body>\n");
-    // html_write_header(fout);
-    fprintf(fout, "  <article>\n");
-    fprintf(fout, "    <h1>%s</h1>\n", page->title);
-    fprintf(fout, "    <div class=\"post-meta\">\n");
-    if (page->date[0]) {
-        fprintf(fout, "    <time style=\"color: #4b5563;\">%s</time>\n", formatted_date);
+    u64 hash = 1;
+    const Page* links[2] = {nav->prev, nav->next};
+    for (u32 i = 0; i < 2; ++i) {
+        const Page* page = links[i];
+        if (!page) {
+            hash = hash_bytes(&i, sizeof(i), hash);
+            continue;
+        }
+        // Slugs are NUL-terminated, so the terminator keeps one link from running into the next
+        hash = hash_bytes(page->slug.data, page->slug.len + 1, hash);
+        hash = hash_bytes(&page->title_html.len, sizeof(page->title_html.len), hash);
+        hash = hash_bytes(page->title_html.data, page->title_html.len, hash);
     }
-    fprintf(fout, "    </div>\n");
-    fprintf(fout, "    <div class=\"content\">\n");
-    // clang-format on
-
-    bool in_paragraph = false;
+    return hash ? hash : 1;
+}
 
-    char* cursor = (char*)page->content;
+/// @brief Write `page` up to its navigation, parsing it on `arena`, which also holds the
+/// renderer's scratch. Returns the part of templates/page.html to carry on from with
+/// `build_page_nav`.
+u32 build_page_body(Buf* out, const Page* page, Arena* arena) {
+    // The whole page is parsed before anything is written, so footnotes resolve either way
+    PageRenderer r;
+    md_footnotes_init(&r.footnotes, arena);
+    MdParser parser;
+    md_parser_init(&parser, arena, &r.footnotes, page->content_len);
+    md_parse(&parser, page->content, page->content_len);
+
+    build_page_head(&r, out, page, arena);
+    md_render(&r.md, parser.nodes, parser.count);
+    build_page_tail(&r);
+    return r.template_part;
+}
 
-    while (*cursor) {
-        // Find end of line
-        char* eol = strchr(cursor, '\n');
-        u32 len = eol ? (u32)(eol - cursor) : strlen(cursor);
+/// @brief Render `page` linking to `nav`, which can be NULL for a page outside any index
+void build_page(Buf* out, const Page* page, const PageNav* nav) {
+    const u32 template_part = build_page_body(out, page, out->arena);
+    build_page_nav(out, page, nav, template_part);
+}
 
-        if (len == 0) {
-            if (in_paragraph) {
-                fprintf(fout, "</p>\n");
-                in_paragraph = false;
+/// @brief Parse a streamed source through `window`, rendering each window's worth of nodes
+/// with `r` before the window moves on. Without `r` the nodes are dropped, that pass only
+/// gathers the footnotes, or with `terms` the page's search terms. Output is drained to `fd`
+/// whenever it passes STREAM_WINDOW.
+static bool stream_page_content(
+    const Page* page,
+    int in,
+    char* window,
+    MdParser* parser,
+    PageRenderer* r,
+    SearchTerms* terms,
+    int fd) {
+    u64 offset = page->content_offset;
+    u64 kept = 0; // start of a line carried over from the previous window
+    for (;;) {
+        const ssize_t n = pread(in, window + kept, STREAM_WINDOW - kept, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-        } else {
-            if (!in_paragraph) {
-                HeadingInfo h_info = get_heading_info(cursor, len);
-                if (h_info.level > 0) {
-                    cursor += h_info.text_offset;
-                    fprintf(fout, "<h%u>", h_info.level);
-                    write_formatted_line(fout, cursor, len - h_info.text_offset);
-                    fprintf(fout, "</h%u>\n", h_info.level);
-                    cursor += eol ? len - h_info.text_offset + 1 : len - h_info.text_offset;
-                    continue;
-                } else {
-                    fprintf(fout, "    <p>");
-                    in_paragraph = true;
-                }
-            } else {
-                fprintf(fout, " ");
+            return false;
+        }
+        offset += (u64)n;
+        trace_add_read((u64)n);
+        const bool eof = n == 0;
+
+        const char* cursor = window;
+        const char* end = window + kept + n;
+        while (cursor < end) {
+            const char* eol = memchr(cursor, '\n', end - cursor);
+            if (!eol && !eof && cursor != window) {
+                break; // finish this line once the rest of it has been read
             }
-            write_formatted_line(fout, cursor, len);
+            const u32 len = eol ? (u32)(eol - cursor) : (u32)(end - cursor);
+            md_parse_line(parser, cursor, len);
+            cursor += eol ? len + 1 : len;
+        }
+        if (eof) {
+            md_finish(parser);
         }
 
-        cursor += eol ? len + 1 : len; // skip past newline if present
+        // The nodes point into the window, so they're done with before it moves
+        if (terms) {
+            search_add_nodes(terms, parser->nodes, parser->count);
+        }
+        if (r) {
+            md_render(&r->md, parser->nodes, parser->count);
+            if (r->out->len >= STREAM_WINDOW && !buf_drain(r->out, fd)) {
+                return false;
+            }
+        }
+        parser->count = 0;
+        if (eof) {
+            return true;
+        }
+        kept = (u64)(end - cursor);
+        memmove(window, cursor, kept);
     }
+}
 
-    if (in_paragraph) {
-        fprintf(fout, "</p>\n");
+/// @brief Render `page` from its source file straight to `out_path`, for sources too big to load.
+///
+/// Input is read through a window of STREAM_WINDOW bytes and output is flushed whenever it
+/// passes that size, so memory use doesn't depend on the size of the source, only on its
+/// footnotes. Footnotes can be referenced before they're defined, so a first pass over the
+/// file gathers them. Lines longer than the window are rendered in window-sized pieces.
+bool build_page_streamed(
+    const Page* page,
+    const PageNav* nav,
+    const char* out_path,
+    Arena* scratch) {
+    int in = open(page->stream_path, O_RDONLY);
+    if (in < 0) {
+        LOG_ERROR("Failed to open %s\n", page->stream_path);
+        return false;
     }
-    fprintf(fout, "    </div>\n");
-    fprintf(fout, "  </article>\n");
-    fprintf(fout, "</body>\n");
-    fprintf(fout, "</html>\n");
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        close(in);
+        return false;
+    }
+
+    char* window = arena_push(scratch, STREAM_WINDOW, 1);
+    PageRenderer r;
+    md_footnotes_init(&r.footnotes, scratch);
+    MdParser parser;
+    md_parser_init(&parser, scratch, &r.footnotes, STREAM_WINDOW);
+    bool ok = stream_page_content(page, in, window, &parser, NULL, NULL, fd);
+
+    Buf out = buf_create(scratch, 2 * STREAM_WINDOW);
+    build_page_head(&r, &out, page, scratch);
+    md_parser_init(&parser, scratch, &r.footnotes, STREAM_WINDOW);
+    ok = ok && stream_page_content(page, in, window, &parser, &r, NULL, fd);
+    build_page_tail(&r);
+    build_page_nav(&out, page, nav, r.template_part);
+    ok = ok && buf_drain(&out, fd);
+    close(in);
+    return close(fd) == 0 && ok;
 }
 
-bool build_pages(const char* dst_path, Page* pages, u32 page_count) {
-    for (u32 i = 0; i < page_count; ++i) {
-        Page* page = &pages[i];
+/// @brief Add the search terms of a source too big to load, reading it the same way
+bool search_page_streamed(const Page* page, SearchTerms* terms, Arena* scratch) {
+    int in = open(page->stream_path, O_RDONLY);
+    if (in < 0) {
+        LOG_ERROR("Failed to open %s\n", page->stream_path);
+        return false;
+    }
+    char* window = arena_push(scratch, STREAM_WINDOW, 1);
+    MdFootnotes footnotes;
+    md_footnotes_init(&footnotes, scratch);
+    MdParser parser;
+    md_parser_init(&parser, scratch, &footnotes, STREAM_WINDOW);
+    const bool ok = stream_page_content(page, in, window, &parser, NULL, terms, -1);
+    close(in);
+    return ok;
+}
 
-        char out_path[PATH_MAX];
-        int len = snprintf(out_path, sizeof(out_path), "%s/%s.html", dst_path, page->slug);
-        assert(len > 0 && len < (int)sizeof(out_path));
+// Settings an asset's copy depends on, in `ManifestEntry::flags`
+#define ASSET_PRECOMPRESSED 1u
+#define ASSET_FINGERPRINTED 2u
 
-        FILE* fout = fopen(out_path, "w");
-        if (!fout) {
-            LOG_ERROR("Failed to open %s for writing\n", out_path);
-            return false;
-        }
+/// @brief Per-output record of the inputs it was last built from.
+typedef struct {
+    u64 key; // hash of `path`, 0 marks an empty slot
+    const char* path;
+    u64 source_hash;
+    i64 source_mtime;
+    u64 source_size;
+    u64 styles_hash;
+    u32 template_version;
+    u64 output_hash; // of the bytes last written, 0 if unknown
+    u64 deps_hash; // of what the output shows of other pages, 0 if nothing
+    u32 flags; // ASSET_* for assets, which don't depend on the styles, 0 for everything else
+    PageNav nav; // pages the output links to as of `deps_hash`, with just a slug and a title
+    bool seen; // touched by the current build, only these are written back
+} ManifestEntry;
 
-        build_page(fout, page);
+typedef struct {
+    Arena arena;
+    ManifestEntry* slots;
+    u32 capacity; // power of 2
+    u32 count;
+    u64 styles_hash;
+} Manifest;
+
+void manifest_grow(Manifest* m, u32 capacity) {
+    ManifestEntry* old_slots = m->slots;
+    const u32 old_capacity = m->capacity;
+
+    m->slots = arena_push(&m->arena, sizeof(ManifestEntry) * capacity, ALIGNMENT);
+    memset(m->slots, 0, sizeof(ManifestEntry) * capacity);
+    m->capacity = capacity;
+
+    for (u32 i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].key == 0) {
+            continue;
+        }
+        u32 slot = (u32)old_slots[i].key & (capacity - 1);
+        while (m->slots[slot].key != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        m->slots[slot] = old_slots[i];
+    }
+}
 
-        fclose(fout);
+/// @brief Find the entry for `path`, inserting an empty one if it doesn't exist yet
+ManifestEntry* manifest_get(Manifest* m, const char* path) {
+    if ((m->count + 1) * 2 > m->capacity) {
+        manifest_grow(m, m->capacity ? m->capacity * 2 : 256);
     }
 
-    return true;
-}
+    const u64 path_len = strlen(path);
+    u64 key = hash_bytes(path, path_len, 0);
+    key = key ? key : 1;
 
-/// @brief Create the public directory if it doesn't exist
-bool prepare_public_dir() {
-    if (access(PUBLIC_DIR, F_OK) == -1) {
-        if (mkdir(PUBLIC_DIR, 0755) == -1) {
-            fprintf(stderr, "Failed to create %s\n", PUBLIC_DIR);
-            return false;
+    u32 slot = (u32)key & (m->capacity - 1);
+    while (m->slots[slot].key != 0) {
+        ManifestEntry* entry = &m->slots[slot];
+        if (entry->key == key && strcmp(entry->path, path) == 0) {
+            return entry;
         }
+        slot = (slot + 1) & (m->capacity - 1);
     }
-    return true;
-}
 
-bool build_index(Page* pages, u32 page_count) {
-    char index_path[PATH_MAX];
-    snprintf(index_path, PATH_MAX, "%s/index.html", PUBLIC_DIR);
+    char* path_copy = arena_push(&m->arena, path_len + 1, 1);
+    memcpy(path_copy, path, path_len + 1);
 
-    FILE* fout = fopen(index_path, "w");
-    if (!fout) {
-        LOG_ERROR("Failed to open %s for writing\n", index_path);
-        return false;
-    }
+    ManifestEntry* entry = &m->slots[slot];
+    *entry = (ManifestEntry){.key = key, .path = path_copy};
+    ++m->count;
+    return entry;
+}
 
-    // Output HTML header
-    // clang-format off
-    html_write_head(fout, "Blog Index");
-    PRINT("<body>\n");
-    // html_write_header(fout);
-    PRINT("  <h1>Blog Posts</h1>\n");
-    PRINT("  <table class=\"archive\">\n");
-    PRINT("    <thead><tr><th>date</th><th>title</th><th>tags</th></tr></thead>\n");
-    PRINT("      <tbody>\n");
-    for (u32 i = 0; i < page_count; ++i) {
-        const Page* page = &pages[i];
-        char formatted_date[32];
-        if (page->date[0] && !format_date_abbr(page->date, formatted_date)) {
-            LOG_WARN("Invalid date format in page %s: %s\n", page->slug, page->date);
-            formatted_date[0] = '\0';
-        }
-        PRINT("        <tr>\n");
-        PRINT("          <td class=\"date\">%s</td>\n", formatted_date);
-        PRINT("          <td class=\"title\"><a href=\"posts/%s.html\">%s</a></td>\n", page->slug, page->title);
-        PRINT("        </tr>\n");
-    }
-    PRINT("    </tbody>\n");
-    PRINT("  </table>\n");
-    PRINT("</body>\n");
-    PRINT("</html>\n");
-    // clang-format on
-
-    fclose(fout);
-    return true;
+/// @brief Check whether `entry` was built from the current styles and templates (or is new)
+bool manifest_entry_current(const Manifest* m, const ManifestEntry* entry, const char* path) {
+    return !opts.force && entry->template_version == TEMPLATE_VERSION &&
+           entry->styles_hash == m->styles_hash && access(path, F_OK) == 0;
 }
 
-bool install_favicon() {
-    const char* src_favicon_path = ASSET_DIR "/favicon.svg";
-    const char* dst_favicon_path = PUBLIC_DIR "/favicon.svg";
+/// @brief Hash of everything outside a page's own source that every output depends on
+u64 styles_hash() {
+    // Editing templates/ or the renderer, switching between inline and linked styles or turning
+    // on sidecars changes every output just like new styles do
+    const u64 seed =
+        TEMPLATES_HASH ^ RENDERER_HASH ^ (opts.inline_css | (u64)opts.precompress << 1);
+    // and so does a new fingerprinted favicon, it's linked from every page
+    const u64 favicon = hash_bytes(favicon_href, strlen(favicon_href), seed);
+    return hash_bytes(site_css, site_css_len, favicon);
+}
 
-    FILE* src_favicon = fopen(src_favicon_path, "rb");
-    if (!src_favicon) {
-        LOG_ERROR("Failed to open favicon source: %s\n", src_favicon_path);
-        return false;
-    }
+/// @brief A page with nothing but `slug` and `title_html`, all a link to it needs, copied onto
+/// the manifest's arena so it outlives the collection
+const Page* manifest_nav_page(Manifest* m, Str slug, Str title_html) {
+    // Slugs go into paths as C strings, so the copy is NUL-terminated too
+    char* text = arena_push(&m->arena, slug.len + title_html.len + 1, 1);
+    memcpy(text, slug.data, slug.len);
+    text[slug.len] = '\0';
+    memcpy(text + slug.len + 1, title_html.data, title_html.len);
+    Page* page = arena_push(&m->arena, sizeof(Page), _Alignof(Page));
+    *page = (Page){
+        .slug = {text, slug.len},
+        .title_html = {text + slug.len + 1, title_html.len},
+    };
+    return page;
+}
 
-    FILE* dst_favicon = fopen(dst_favicon_path, "wb");
-    if (!dst_favicon) {
-        LOG_ERROR("Failed to open favicon destination: %s\n", dst_favicon_path);
-        fclose(src_favicon);
+/// @brief Read the links after the numbers of a version 5 line: the previous page's slug and
+/// title, then the next page's, each empty when there's no such link
+static bool manifest_load_nav(Manifest* m, ManifestEntry* entry, char* fields) {
+    char* field[12];
+    for (u32 i = 0; i < 12; ++i) {
+        field[i] = fields;
+        fields = fields ? strchr(fields, '\t') : NULL;
+        if (fields) {
+            *fields++ = '\0';
+        }
+    }
+    if (!field[11] || fields) {
         return false;
     }
-
-    char buffer[4096];
-    u64 bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src_favicon)) > 0) {
-        fwrite(buffer, 1, bytes, dst_favicon);
+    const Page** links[2] = {&entry->nav.prev, &entry->nav.next};
+    for (u32 i = 0; i < 2; ++i) {
+        const char* slug = field[8 + 2 * i];
+        const char* title = field[9 + 2 * i];
+        if (*slug) {
+            const Str slug_str = {slug, (u32)strlen(slug)};
+            *links[i] = manifest_nav_page(m, slug_str, (Str){title, (u32)strlen(title)});
+        }
     }
-
-    fclose(src_favicon);
-    fclose(dst_favicon);
     return true;
 }
 
-int main(int argc, char** argv) {
-    struct timespec t_start, t_end;
-    clock_gettime(CLOCK_MONOTONIC, &t_start);
-
-    if (!prepare_public_dir()) {
-        return 1;
+/// @brief Write `text` as one field of a manifest line, with the tabs and newlines it can't
+/// hold turned into spaces
+static void manifest_write_field(FILE* f, Str text) {
+    fputc('\t', f);
+    for (u32 i = 0; i < text.len; ++i) {
+        fputc(text.data[i] == '\t' || text.data[i] == '\n' ? ' ' : text.data[i], f);
     }
+}
 
-    if (!install_favicon()) {
-        return 1;
+void manifest_load(Manifest* m) {
+    m->arena = arena_create(GB(1));
+    m->styles_hash = styles_hash();
+
+    u64 len = 0;
+    i64 mtime = 0;
+    char* data = read_file(&m->arena, MANIFEST_PATH, &len, &mtime);
+    if (!data) {
+        return;
     }
 
-    DIR* dir = opendir(CONTENT_DIR);
+    char* cursor = data;
+    char* end = data + len;
+    u32 line_no = 0;
+    u32 version = 1;
+    while (cursor < end) {
+        char* eol = memchr(cursor, '\n', end - cursor);
+        if (!eol) {
+            break;
+        }
+        *eol = '\0';
+        ++line_no;
+
+        if (line_no == 1) {
+            // Version 1 predates output hashes, version 2 dependency hashes, version 3 flags and
+            // version 4 links, their entries just don't have one
+            if (strcmp(cursor, "mksite-manifest 5") == 0) {
+                version = 5;
+            } else if (strcmp(cursor, "mksite-manifest 4") == 0) {
+                version = 4;
+            } else if (strcmp(cursor, "mksite-manifest 3") == 0) {
+                version = 3;
+            } else if (strcmp(cursor, "mksite-manifest 2") == 0) {
+                version = 2;
+            } else if (strcmp(cursor, "mksite-manifest 1") != 0) {
+                LOG_WARN("Ignoring manifest with unknown version: %s\n", MANIFEST_PATH);
+                return;
+            }
+        } else {
+            char* path = cursor;
+            char* fields = strchr(cursor, '\t');
+            if (!fields) {
+                LOG_WARN("Malformed manifest line %u\n", line_no);
+                break;
+            }
+            *fields++ = '\0';
+
+            unsigned long long source_hash, source_size, styles_hash;
+            unsigned long long output_hash = 0, deps_hash = 0;
+            long long source_mtime;
+            unsigned template_version, flags = 0;
+            if (sscanf(
+                    fields,
+                    "%llx\t%lld\t%llu\t%llx\t%u\t%llx\t%llx\t%x",
+                    &source_hash,
+                    &source_mtime,
+                    &source_size,
+                    &styles_hash,
+                    &template_version,
+                    &output_hash,
+                    &deps_hash,
+                    &flags) != 4 + (int)(version < 4 ? version : 4)) {
+                LOG_WARN("Malformed manifest line %u\n", line_no);
+                break;
+            }
+
+            ManifestEntry* entry = manifest_get(m, path);
+            entry->source_hash = source_hash;
+            entry->source_mtime = source_mtime;
+            entry->source_size = source_size;
+            entry->styles_hash = styles_hash;
+            entry->template_version = template_version;
+            entry->output_hash = output_hash;
+            entry->deps_hash = deps_hash;
+            entry->flags = flags;
+            // Before version 4 assets kept their flags where the styles hash goes
+            if (version < 4 && strncmp(path, ASSET_DIR "/", sizeof(ASSET_DIR)) == 0) {
+                entry->flags = (u32)styles_hash;
+                entry->styles_hash = 0;
+            }
+            if (version >= 5 && !manifest_load_nav(m, entry, fields)) {
+                LOG_WARN("Malformed manifest line %u\n", line_no);
+                break;
+            }
+        }
+        cursor = eol + 1;
+    }
+}
+
+bool manifest_save(const Manifest* m) {
+    const char* tmp_path = MANIFEST_PATH ".tmp";
+    FILE* f = fopen(tmp_path, "w");
+    if (!f) {
+        LOG_ERROR("Failed to open %s for writing\n", tmp_path);
+        return false;
+    }
+
+    fprintf(f, "mksite-manifest 5\n");
+    for (u32 i = 0; i < m->capacity; ++i) {
+        const ManifestEntry* entry = &m->slots[i];
+        if (entry->key == 0 || !entry->seen) {
+            continue;
+        }
+        fprintf(
+            f,
+            "%s\t%llx\t%lld\t%llu\t%llx\t%u\t%llx\t%llx\t%x",
+            entry->path,
+            (unsigned long long)entry->source_hash,
+            (long long)entry->source_mtime,
+            (unsigned long long)entry->source_size,
+            (unsigned long long)entry->styles_hash,
+            entry->template_version,
+            (unsigned long long)entry->output_hash,
+            (unsigned long long)entry->deps_hash,
+            entry->flags);
+        const Page* links[2] = {entry->nav.prev, entry->nav.next};
+        for (u32 i = 0; i < 2; ++i) {
+            manifest_write_field(f, links[i] ? links[i]->slug : STR_LIT(""));
+            manifest_write_field(f, links[i] ? links[i]->title_html : STR_LIT(""));
+        }
+        fputc('\n', f);
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, MANIFEST_PATH) != 0) {
+        LOG_ERROR("Failed to write %s\n", MANIFEST_PATH);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Drop `path` from the manifest, for outputs whose source went away
+void manifest_forget(Manifest* m, const char* path) {
+    manifest_get(m, path)->seen = false;
+}
+
+/// @brief Delete an output file and its compressed sidecars
+void remove_output(const char* path) {
+    unlink(path);
+    remove_compressed_sidecars(path);
+}
+
+/// @brief Hash a file without loading it, returns 0 if it can't be read
+u64 hash_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, (u64)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    madvise(data, (u64)st.st_size, MADV_SEQUENTIAL);
+    const u64 hash = hash_bytes(data, (u64)st.st_size, 0);
+    munmap(data, (u64)st.st_size);
+    return hash;
+}
+
+/// @brief Returns true if `path` has to be rebuilt from `page`, and records the new inputs
+bool manifest_update_page(Manifest* m, const char* path, const Page* page) {
+    ManifestEntry* entry = manifest_get(m, path);
+    const bool current = manifest_entry_current(m, entry, path);
+    entry->seen = true;
+
+    // Same size and mtime as last time: trust the stored hash without reading the bytes
+    if (current && entry->source_size == page->source_size &&
+        entry->source_mtime == page->source_mtime) {
+        return false;
+    }
+
+    const u64 source_hash = page->stream_path ? hash_file(page->stream_path)
+                                              : hash_bytes(page->source, page->source_size, 0);
+    const bool dirty = !current || source_hash != entry->source_hash;
+
+    entry->source_hash = source_hash;
+    entry->source_mtime = page->source_mtime;
+    entry->source_size = page->source_size;
+    entry->styles_hash = m->styles_hash;
+    entry->template_version = TEMPLATE_VERSION;
+    return dirty;
+}
+
+/// @brief Returns true if `path` produced from inputs hashing to `hash` has to be rebuilt
+bool manifest_update_hash(Manifest* m, const char* path, u64 hash) {
+    ManifestEntry* entry = manifest_get(m, path);
+    const bool dirty = !manifest_entry_current(m, entry, path) || entry->source_hash != hash;
+    entry->seen = true;
+    entry->source_hash = hash;
+    entry->source_mtime = 0;
+    entry->source_size = 0;
+    entry->styles_hash = m->styles_hash;
+    entry->template_version = TEMPLATE_VERSION;
+    return dirty;
+}
+
+/// @brief Returns true if the file at `path` already holds `data`, so it needn't be rewritten.
+///
+/// `hash` is the output hash the manifest recorded for `path` and is replaced with that of
+/// `data`. Sidecars are only written with their page, so the hash covers --precompress too.
+bool output_unchanged(const char* path, const void* data, u64 len, u64* hash) {
+    const u64 previous = *hash;
+    *hash = hash_bytes(data, len, opts.precompress);
+    *hash = *hash ? *hash : 1;
+    if (opts.force || previous != *hash) {
+        return false;
+    }
+    struct stat st;
+    return stat(path, &st) == 0 && (u64)st.st_size == len;
+}
+
+/// @brief Write one of the site-wide outputs built on this thread, like search.bin or a feed,
+/// unless the file already holds it. The manifest forgets `path` if the write fails.
+bool write_site_file(Manifest* manifest, const char* path, const Buf* out, Arena* scratch) {
+    ManifestEntry* entry = manifest_get(manifest, path);
+    if (output_unchanged(path, out->data, out->len, &entry->output_hash)) {
+        return true;
+    }
+    if (!buf_write_file(out, path) ||
+        (opts.precompress &&
+         !write_compressed_sidecars(scratch, NULL, path, out->data, out->len))) {
+        LOG_ERROR("Failed to write %s\n", path);
+        manifest_forget(manifest, path);
+        return false;
+    }
+    if (!opts.precompress) {
+        remove_compressed_sidecars(path);
+    }
+    return true;
+}
+
+/// @brief A page that has to be rendered
+typedef struct {
+    u32 page; // index into the page array
+    u64 output_hash; // as in `output_unchanged`, previous on the way in and current on the way out
+    PageNav nav;
+    CacheKey cache_key; // of the page up to its navigation, zero when it isn't cached
+    // Pages in an index are rendered up to their navigation while the rest of the collection is
+    // still being imported, see `finish_collection_pages`
+    const char* held; // the page so far, NULL until rendered
+    u64 held_len;
+    u32 held_part; // where templates/page.html carries on after `held`
+    // or rendered whole right away, linking to last build's neighbours, when it had some
+    bool nav_guessed;
+} PageJob;
+
+typedef struct {
+    const char* dst_path;
+    const Page* pages;
+    PageJob* jobs;
+    Arena* held; // per worker, set while rendering pages up to their navigation or a guess of it
+    _Atomic u32 unchanged;
+    atomic_bool failed;
+} BuildPagesTask;
+
+/// @brief Name of `page` in the render cache: its source and everything else that goes into its
+/// HTML up to the navigation, which is added after the cache
+CacheKey page_cache_key(const Page* page, const Manifest* m) {
+    // The styles hash covers the templates, the styles, the favicon and inlining the styles.
+    // RENDERER_HASH is generated from the renderer's sources, so the key can't outlive the code
+    // that rendered the entry, whether or not anyone remembered to bump TEMPLATE_VERSION.
+    const u64 version = RENDERER_HASH ^ TEMPLATE_VERSION;
+    u64 seed = hash_bytes(SITE_URL, sizeof(SITE_URL) - 1, m->styles_hash ^ version);
+    seed = hash_bytes(stylesheet_href, strlen(stylesheet_href), seed);
+    return (CacheKey){
+        hash_bytes(page->source, page->source_size, seed),
+        hash_bytes(page->source, page->source_size, ~seed),
+    };
+}
+
+PageJob page_job(const Page* pages, u32 index, u64 output_hash, const Manifest* m) {
+    PageJob job = {.page = index, .output_hash = output_hash};
+    // Streamed pages go straight to disk and are too big to be worth keeping twice anyway
+    if (cache_enabled(&render_cache) && !pages[index].stream_path) {
+        job.cache_key = page_cache_key(&pages[index], m);
+    }
+    return job;
+}
+
+/// @brief Decide whether `pages[index]` has to be rendered, filling in `job` if so.
+///
+/// This is the only part of building pages that touches the manifest, so it has to run on one
+/// thread at a time.
+bool plan_page(
+    Manifest* manifest,
+    const char* dst_path,
+    const Page* pages,
+    u32 index,
+    bool linked,
+    PageJob* job) {
+    char out_path[MKSITE_PATH_MAX];
+    const int len =
+        snprintf(out_path, sizeof(out_path), "%s/%s.html", dst_path, pages[index].slug.data);
+    assert(len > 0 && len < (int)sizeof(out_path));
+    (void)len; // only read by the assert, which NDEBUG drops
+
+    bool dirty = manifest_update_page(manifest, out_path, &pages[index]);
+    ManifestEntry* entry = manifest_get(manifest, out_path);
+    // Outside an index pages link to nothing, so one that used to be in an index loses its links
+    if (!linked && entry->deps_hash) {
+        entry->deps_hash = 0;
+        entry->nav = (PageNav){0};
+        dirty = true;
+    }
+    if (!dirty) {
+        return false;
+    }
+    *job = page_job(pages, index, entry->output_hash, manifest);
+    // Neighbours rarely change along with a page, so last build's are a good guess that lets
+    // the page be written before the whole collection is imported
+    if (linked && entry->deps_hash && page_nav_hash(&entry->nav) == entry->deps_hash) {
+        job->nav = entry->nav;
+        job->nav_guessed = true;
+    }
+    return true;
+}
+
+/// @brief The part of templates/page.html right after the navigation
+u32 page_nav_part() {
+    for (u32 i = 0; i < TEMPLATE_PAGE.count; ++i) {
+        const TemplatePart* part = &TEMPLATE_PAGE.parts[i];
+        if (part->kind == TEMPLATE_HOLE && part->hole == TEMPLATE_HOLE_NAV) {
+            return i + 1;
+        }
+    }
+    return TEMPLATE_PAGE.count;
+}
+
+/// @brief `build_page_body` through the render cache, when there is one
+u32 build_page_body_cached(Buf* out, const Page* page, CacheKey key, Arena* scratch) {
+    const bool cached = key.hi || key.lo;
+    if (cached && cache_get(&render_cache, key, out)) {
+        return page_nav_part();
+    }
+    const u32 part = build_page_body(out, page, scratch);
+    if (cached) {
+        cache_put(&render_cache, key, out->data, out->len);
+    }
+    return part;
+}
+
+void build_page_job(BuildPagesTask* task, PageJob* job, Worker* worker) {
+    const Page* page = &task->pages[job->page];
+
+    char out_path[MKSITE_PATH_MAX];
+    snprintf(out_path, sizeof(out_path), "%s/%s.html", task->dst_path, page->slug.data);
+
+    const bool hold = task->held && !job->nav_guessed;
+    if (page->stream_path && hold) {
+        return; // written straight to disk, so it has to wait for its navigation
+    }
+
+    u64 t = trace_begin();
+    if (page->stream_path) {
+        job->output_hash = 0; // never held in memory as a whole, so never hashed
+        if (!build_page_streamed(page, &job->nav, out_path, &worker->scratch)) {
+            LOG_ERROR("Failed to write %s\n", out_path);
+            atomic_store(&task->failed, true);
+        } else {
+            // Sidecars from before the page was big enough to stream would outlive it
+            remove_compressed_sidecars(out_path);
+            if (opts.precompress) {
+                LOG_WARN("Not precompressing streamed page %s\n", out_path);
+            }
+        }
+        trace_end("build_page_streamed", page->slug.data, t);
+        return;
+    }
+
+    // Rendered into the writer's arena so the buffer lives until its batch is written
+    Buf out;
+    if (job->held && !task->held) {
+        out = buf_create(&worker->writer.arena, job->held_len + KB(4));
+        buf_write(&out, job->held, job->held_len);
+    } else {
+        out = buf_create(hold ? &task->held[worker->id] : &worker->writer.arena, KB(64));
+        job->held_part = build_page_body_cached(&out, page, job->cache_key, &worker->scratch);
+        if (hold) {
+            job->held = out.data;
+            job->held_len = out.len;
+            trace_end("build_page", page->slug.data, t);
+            return;
+        }
+    }
+    build_page_nav(&out, page, &job->nav, job->held_part);
+    trace_end(job->held ? "finish_page" : "build_page", page->slug.data, t);
+
+    // Re-rendering often gives the same bytes, leaving them keeps mtimes and rsync quiet
+    if (output_unchanged(out_path, out.data, out.len, &job->output_hash)) {
+        atomic_fetch_add(&task->unchanged, 1);
+        return;
+    }
+
+    t = trace_begin();
+    writer_queue(&worker->writer, out_path, out.data, out.len);
+    trace_end("write", page->slug.data, t);
+
+    // Compressing here, straight from the rendered buffer, keeps it on the same workers.
+    // Without --precompress, sidecars left by a build that had it would be served instead.
+    if (opts.precompress) {
+        t = trace_begin();
+        write_compressed_sidecars(NULL, &worker->writer, out_path, out.data, out.len);
+        trace_end("compress", page->slug.data, t);
+    } else {
+        remove_compressed_sidecars(out_path);
+    }
+}
+
+void build_pages_task(void* ctx, u32 index, Worker* worker) {
+    BuildPagesTask* task = (BuildPagesTask*)ctx;
+    build_page_job(task, &task->jobs[index], worker);
+}
+
+/// @brief Record what the workers rendered in the manifest, returns false if anything failed
+bool finish_pages(BuildPagesTask* task, u32 job_count, Manifest* manifest, Pool* pool) {
+    for (u32 i = 0; i < job_count; ++i) {
+        char out_path[MKSITE_PATH_MAX];
+        const char* slug = task->pages[task->jobs[i].page].slug.data;
+        snprintf(out_path, sizeof(out_path), "%s/%s.html", task->dst_path, slug);
+        manifest_get(manifest, out_path)->output_hash = task->jobs[i].output_hash;
+    }
+    const u32 unchanged = atomic_load(&task->unchanged);
+    if (unchanged) {
+        LOG_INFO("Left %u re-rendered but identical pages in %s\n", unchanged, task->dst_path);
+    }
+    trace_counter("unchanged_outputs", task->dst_path, unchanged);
+
+    // Queued writes fail on whichever worker flushes them, they're only counted there
+    return !atomic_load(&task->failed) && pool_take_write_failures(pool) == 0;
+}
+
+/// @brief Create the public directory if it doesn't exist
+bool prepare_public_dir() {
+    if (access(PUBLIC_DIR, F_OK) == -1) {
+        if (mkdir(PUBLIC_DIR, 0755) == -1) {
+            fprintf(stderr, "Failed to create %s\n", PUBLIC_DIR);
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Where a collection's index goes and what it's called
+typedef struct {
+    char dir[MKSITE_PATH_MAX]; // where index.html goes, PUBLIC_DIR itself for the site's front page
+    char root[64]; // relative path from `dir` back to public/
+    char collection[64]; // the pages' directory under public/
+    // Escaped for HTML, so there's room to spare for entities
+    char heading[128]; // of the first index page
+    char title[128]; // <title> of the first index page
+    char archive_label[128]; // the "Posts" in "Posts from 2024"
+    SortOrder sort;
+} IndexConfig;
+
+/// @brief Index `collection` in `dir` under public/ ("" for the front page), titled `title`
+void index_config_init(
+    IndexConfig* index,
+    const char* collection,
+    const char* dir,
+    const char* title) {
+    *index = (IndexConfig){.sort = SORT_NEWEST};
+    snprintf(index->dir, sizeof(index->dir), "%s%s%s", PUBLIC_DIR, *dir ? "/" : "", dir);
+    for (const char* p = dir; *p; ++p) {
+        if (p == dir || p[-1] == '/') {
+            strncat(index->root, "../", sizeof(index->root) - strlen(index->root) - 1);
+        }
+    }
+    snprintf(index->collection, sizeof(index->collection), "%s", collection);
+    // The front page of the blog has kept its old names
+    // These go into the HTML as they are, mksite.conf titles are escaped here once
+    html_escape_cstr(index->heading, sizeof(index->heading), title ? title : "Blog Posts");
+    html_escape_cstr(index->title, sizeof(index->title), title ? title : "Blog Index");
+    html_escape_cstr(index->archive_label, sizeof(index->archive_label), title ? title : "Posts");
+}
+
+/// @brief Year and month shards only make sense while the index is in date order
+static inline bool index_has_archives(const IndexConfig* index) {
+    return opts.archives && index->sort == SORT_NEWEST;
+}
+
+/// @brief One HTML file of the post index: a page of the paginated index or an archive shard
+typedef struct {
+    const IndexConfig* index;
+    char path[MKSITE_PATH_MAX];
+    char title[192];
+    char root[64]; // relative path back to public/, for links to the posts
+    u32 first; // range of the sorted pages listed on this shard
+    u32 count;
+    u32 page_no; // 1-based position in the paginated index, 0 for archive shards
+    u32 page_total;
+    u32 year; // archive year, 0 for index pages
+    u32 month; // archive month, 0 for index pages and year shards
+} IndexShard;
+
+void render_index_pager(Buf* out, const IndexShard* shard) {
+    char newer[32] = "";
+    char older[32] = "";
+    char page[16];
+    char pages[16];
+    if (shard->page_no == 2) {
+        snprintf(newer, sizeof(newer), "../index.html");
+    } else if (shard->page_no > 2) {
+        snprintf(newer, sizeof(newer), "%u.html", shard->page_no - 1);
+    }
+    if (shard->page_no < shard->page_total) {
+        const char* dir = shard->page_no == 1 ? "page/" : "";
+        snprintf(older, sizeof(older), "%s%u.html", dir, shard->page_no + 1);
+    }
+    snprintf(page, sizeof(page), "%u", shard->page_no);
+    snprintf(pages, sizeof(pages), "%u", shard->page_total);
+
+    Str holes[TEMPLATE_HOLE_COUNT] = {
+        [TEMPLATE_HOLE_NEWER] = {newer, (u32)strlen(newer)},
+        [TEMPLATE_HOLE_OLDER] = {older, (u32)strlen(older)},
+        [TEMPLATE_HOLE_PAGE] = {page, (u32)strlen(page)},
+        [TEMPLATE_HOLE_PAGES] = {pages, (u32)strlen(pages)},
+    };
+    template_render(out, &TEMPLATE_PAGER, 0, holes);
+}
+
+/// @brief Links to the year shards from the front page, or to the month shards from a year
+void render_index_archives(Buf* out, const IndexShard* shard, const Page* pages, u32 page_count) {
+    PRINT("  <nav class=\"archives\">\n");
+    u32 last = 0;
+    for (u32 i = 0; i < page_count; ++i) {
+        const u32 date = pages[i].date;
+        const u32 key = shard->year ? DATE_MONTH(date) : DATE_YEAR(date);
+        if (!date || key == last) {
+            continue;
+        }
+        last = key;
+        PRINT("    <a href=\"");
+        if (shard->year) {
+            buf_u32(out, shard->year);
+            buf_char(out, '/');
+            buf_char(out, '0' + key / 10);
+            buf_char(out, '0' + key % 10);
+            PRINT(".html\">");
+            buf_str(out, MONTHS_FULL[key - 1]);
+        } else {
+            PRINT("archive/");
+            buf_u32(out, key);
+            PRINT(".html\">");
+            buf_u32(out, key);
+        }
+        PRINT("</a>\n");
+    }
+    PRINT("  </nav>\n");
+}
+
+void render_index_shard(Buf* out, const Page* pages, u32 page_count, const IndexShard* shard) {
+    const IndexConfig* index = shard->index;
+    const bool front = shard->page_no <= 1 && shard->year == 0;
+    const Str heading = {shard->title, (u32)strlen(shard->title)};
+
+    Str holes[TEMPLATE_HOLE_COUNT] = {
+        [TEMPLATE_HOLE_HEADING] = heading,
+        [TEMPLATE_HOLE_ROWS] = TEMPLATE_DEFER,
+        [TEMPLATE_HOLE_PAGER] = TEMPLATE_DEFER,
+        [TEMPLATE_HOLE_ARCHIVES] = TEMPLATE_DEFER,
+    };
+    template_head_holes(holes, front ? (Str){index->title, (u32)strlen(index->title)} : heading);
+    u32 part = template_render(out, &TEMPLATE_INDEX, 0, holes);
+
+    Str row[TEMPLATE_HOLE_COUNT] = {
+        [TEMPLATE_HOLE_ROOT] = {shard->root, (u32)strlen(shard->root)},
+        [TEMPLATE_HOLE_COLLECTION] = {index->collection, (u32)strlen(index->collection)},
+    };
+    for (u32 i = shard->first; i < shard->first + shard->count; ++i) {
+        const Page* page = &pages[i];
+        row[TEMPLATE_HOLE_DATE] = page->date_abbr;
+        row[TEMPLATE_HOLE_SLUG] = page->slug;
+        row[TEMPLATE_HOLE_TITLE] = page->title_html;
+        template_render(out, &TEMPLATE_INDEX_ROW, 0, row);
+    }
+    part = template_render(out, &TEMPLATE_INDEX, part, holes);
+
+    if (shard->page_total > 1) {
+        render_index_pager(out, shard);
+    }
+    part = template_render(out, &TEMPLATE_INDEX, part, holes);
+
+    if (index_has_archives(index) && shard->page_no == 1) {
+        render_index_archives(out, shard, pages, page_count);
+    } else if (shard->year && !shard->month) {
+        render_index_archives(out, shard, pages + shard->first, shard->count);
+    }
+    template_render(out, &TEMPLATE_INDEX, part, holes);
+}
+
+/// @brief Render the whole index as a single page
+void render_index(Buf* out, const Page* pages, u32 page_count) {
+    static IndexConfig index;
+    index_config_init(&index, "posts", "", NULL);
+    IndexShard shard = {.index = &index, .count = page_count, .page_no = 1, .page_total = 1};
+    snprintf(shard.title, sizeof(shard.title), "%s", index.heading);
+    render_index_shard(out, pages, page_count, &shard);
+}
+
+/// @brief Hash of everything `shard` shows, so unchanged shards can be skipped
+u64 index_shard_hash(const IndexShard* shard, const Page* pages, u32 page_count) {
+    u64 hash = hash_bytes(shard->title, strlen(shard->title), shard->page_no);
+    hash = hash_bytes(&shard->page_total, sizeof(shard->page_total), hash);
+    // Where the index lives and what it links to come from mksite.conf
+    const IndexConfig* index = shard->index;
+    hash = hash_bytes(index->collection, strlen(index->collection), hash);
+    hash = hash_bytes(index->root, strlen(index->root), hash);
+    hash = hash_bytes(index->title, strlen(index->title), hash);
+    hash = hash_bytes(index->archive_label, strlen(index->archive_label), hash);
+    for (u32 i = shard->first; i < shard->first + shard->count; ++i) {
+        const Page* page = &pages[i];
+        hash = hash_bytes(page->title.data, page->title.len, hash);
+        hash = hash_bytes(&page->date, sizeof(page->date), hash);
+        hash = hash_bytes(page->slug.data, page->slug.len, hash);
+    }
+    // The front page links to every year that has posts
+    if (index_has_archives(shard->index) && shard->page_no == 1) {
+        u32 last = 0;
+        for (u32 i = 0; i < page_count; ++i) {
+            const u32 year = DATE_YEAR(pages[i].date);
+            if (year && year != last) {
+                hash = hash_bytes(&year, sizeof(year), hash);
+                last = year;
+            }
+        }
+    }
+    return hash;
+}
+
+bool ensure_dir(const char* path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        LOG_ERROR("Failed to create directory: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Split the sorted `pages` into index pages and, with --archives, year and month shards
+u32 plan_index_shards(
+    const IndexConfig* index,
+    const Page* pages,
+    u32 page_count,
+    IndexShard* shards) {
+    const u32 per_page = opts.per_page ? opts.per_page : (page_count ? page_count : 1);
+    const u32 page_total = page_count ? (page_count + per_page - 1) / per_page : 1;
+
+    u32 shard_count = 0;
+    for (u32 n = 1; n <= page_total; ++n) {
+        IndexShard* shard = &shards[shard_count++];
+        *shard = (IndexShard){
+            .index = index,
+            .first = (n - 1) * per_page,
+            .page_no = n,
+            .page_total = page_total,
+        };
+        shard->count = n < page_total ? per_page : page_count - shard->first;
+        if (n == 1) {
+            snprintf(shard->path, MKSITE_PATH_MAX, "%s/index.html", index->dir);
+            snprintf(shard->title, sizeof(shard->title), "%s", index->heading);
+            snprintf(shard->root, sizeof(shard->root), "%s", index->root);
+        } else {
+            snprintf(shard->path, MKSITE_PATH_MAX, "%s/page/%u.html", index->dir, n);
+            snprintf(shard->title, sizeof(shard->title), "%s, page %u", index->heading, n);
+            snprintf(shard->root, sizeof(shard->root), "%s../", index->root);
+        }
+    }
+
+    if (!index_has_archives(index)) {
+        return shard_count;
+    }
+
+    // Pages are sorted newest first, so every year and every month is one contiguous run
+    for (u32 i = 0; i < page_count;) {
+        const u32 year = DATE_YEAR(pages[i].date);
+        u32 year_end = i;
+        while (year_end < page_count && DATE_YEAR(pages[year_end].date) == year) {
+            ++year_end;
+        }
+        if (year == 0) {
+            break; // undated pages sort last and have no archive
+        }
+
+        IndexShard* shard = &shards[shard_count++];
+        *shard = (IndexShard){.index = index, .first = i, .count = year_end - i, .year = year};
+        snprintf(shard->path, MKSITE_PATH_MAX, "%s/archive/%u.html", index->dir, year);
+        snprintf(shard->title, sizeof(shard->title), "%s from %u", index->archive_label, year);
+        snprintf(shard->root, sizeof(shard->root), "%s../", index->root);
+
+        for (u32 j = i; j < year_end;) {
+            const u32 month = DATE_MONTH(pages[j].date);
+            u32 month_end = j;
+            while (month_end < year_end && DATE_MONTH(pages[month_end].date) == month) {
+                ++month_end;
+            }
+            shard = &shards[shard_count++];
+            *shard = (IndexShard){
+                .index = index,
+                .first = j,
+                .count = month_end - j,
+                .year = year,
+                .month = month,
+            };
+            snprintf(
+                shard->path, MKSITE_PATH_MAX, "%s/archive/%u/%02u.html", index->dir, year, month);
+            snprintf(
+                shard->title,
+                sizeof(shard->title),
+                "%s from %s %u",
+                index->archive_label,
+                MONTHS_FULL[month - 1],
+                year);
+            snprintf(shard->root, sizeof(shard->root), "%s../../", index->root);
+            j = month_end;
+        }
+        i = year_end;
+    }
+    return shard_count;
+}
+
+typedef struct {
+    const Page* pages;
+    u32 page_count;
+    const IndexShard* shards;
+    const u32* dirty; // indices into `shards`
+    u64* output_hashes; // per dirty shard, like `BuildPagesTask::output_hashes`
+    _Atomic u32 unchanged;
+} BuildIndexTask;
+
+void build_index_task(void* ctx, u32 index, Worker* worker) {
+    BuildIndexTask* task = (BuildIndexTask*)ctx;
+    const IndexShard* shard = &task->shards[task->dirty[index]];
+
+    u64 t = trace_begin();
+    Buf out = buf_create(&worker->writer.arena, KB(64));
+    render_index_shard(&out, task->pages, task->page_count, shard);
+    if (output_unchanged(shard->path, out.data, out.len, &task->output_hashes[index])) {
+        atomic_fetch_add(&task->unchanged, 1);
+        trace_end("index_shard", shard->path + sizeof(PUBLIC_DIR), t);
+        return;
+    }
+    writer_queue(&worker->writer, shard->path, out.data, out.len);
+    if (opts.precompress) {
+        write_compressed_sidecars(NULL, &worker->writer, shard->path, out.data, out.len);
+    } else {
+        remove_compressed_sidecars(shard->path);
+    }
+    trace_end("index_shard", shard->path + sizeof(PUBLIC_DIR), t);
+}
+
+/// @brief Check whether `name` is a number followed by ".html", the name of an archive shard
+static bool is_archive_shard_name(const char* name) {
+    const u64 len = strlen(name);
+    return len > 5 && strspn(name, "0123456789") == len - 5 && strcmp(name + len - 5, ".html") == 0;
+}
+
+/// @brief Delete the shard at `path`, unless it's one of `shards`
+static void prune_archive_shard(
+    const char* path,
+    const IndexShard* shards,
+    u32 shard_count,
+    Manifest* manifest) {
+    for (u32 i = 0; i < shard_count; ++i) {
+        if (shards[i].year && strcmp(shards[i].path, path) == 0) {
+            return;
+        }
+    }
+    remove_output(path);
+    manifest_forget(manifest, path);
+}
+
+/// @brief Whether the directory entry at `path` is a directory, asking the filesystem when the
+/// entry doesn't say
+static bool entry_is_dir(const struct dirent* entry, const char* path) {
+    if (entry->d_type != DT_UNKNOWN) {
+        return entry->d_type == DT_DIR;
+    }
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/// @brief Delete the year and month shards of `index` that aren't in `shards`, left over from
+/// removed pages or from an earlier build with --archives
+static void prune_archive_shards(
+    const IndexConfig* index,
+    const IndexShard* shards,
+    u32 shard_count,
+    Manifest* manifest) {
+    char archive_dir[MKSITE_PATH_MAX];
+    const int dir_len = snprintf(archive_dir, sizeof(archive_dir), "%s/archive", index->dir);
+    DIR* dir = dir_len < (int)sizeof(archive_dir) ? opendir(archive_dir) : NULL;
+    if (!dir) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        char path[MKSITE_PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", archive_dir, name) >= (int)sizeof(path)) {
+            continue; // never one of ours, those all fit
+        }
+        if (!entry_is_dir(entry, path)) {
+            if (is_archive_shard_name(name)) {
+                prune_archive_shard(path, shards, shard_count, manifest);
+            }
+            continue;
+        }
+        if (name[0] == '.' || strspn(name, "0123456789") != strlen(name)) {
+            continue;
+        }
+        DIR* year_dir = opendir(path);
+        if (!year_dir) {
+            continue;
+        }
+        struct dirent* month;
+        while ((month = readdir(year_dir)) != NULL) {
+            char month_path[MKSITE_PATH_MAX];
+            if (is_archive_shard_name(month->d_name) &&
+                snprintf(month_path, sizeof(month_path), "%s/%s", path, month->d_name) <
+                    (int)sizeof(month_path) &&
+                !entry_is_dir(month, month_path)) {
+                prune_archive_shard(month_path, shards, shard_count, manifest);
+            }
+        }
+        closedir(year_dir);
+        rmdir(path); // only goes when nothing else is left in it
+    }
+    closedir(dir);
+    rmdir(archive_dir);
+}
+
+/// @brief Write the index of `pages`, paginated and sharded by year and month when asked to
+bool build_index(
+    const IndexConfig* index,
+    Page* pages,
+    u32 page_count,
+    Manifest* manifest,
+    Pool* pool,
+    Arena* arena) {
+    // At most one shard per index page, plus a year and a month shard per page
+    const u32 max_shards = (page_count ? page_count : 1) + (opts.archives ? 2 * page_count : 0);
+    IndexShard* shards = arena_push(arena, sizeof(IndexShard) * max_shards, ALIGNMENT);
+    const u32 shard_count = plan_index_shards(index, pages, page_count, shards);
+    // Archive shards of years and months without pages are left over, they go before the
+    // directories of the current ones are made so emptied directories can go too
+    prune_archive_shards(index, shards, shard_count, manifest);
+
+    // Output directories and manifest lookups stay on this thread, the workers only render
+    u32* dirty = arena_push(arena, sizeof(u32) * shard_count, ALIGNMENT);
+    u64* output_hashes = arena_push(arena, sizeof(u64) * shard_count, ALIGNMENT);
+    u32 dirty_count = 0;
+    u32 last_year = 0;
+    bool ok = ensure_dir(index->dir);
+    for (u32 i = 0; i < shard_count; ++i) {
+        const IndexShard* shard = &shards[i];
+        char dir[MKSITE_PATH_MAX];
+        if (shard->page_no == 2) {
+            snprintf(dir, sizeof(dir), "%s/page", index->dir);
+            ok = ensure_dir(dir) && ok;
+        } else if (shard->year && shard->year != last_year) {
+            snprintf(dir, sizeof(dir), "%s/archive", index->dir);
+            ok = ensure_dir(dir) && ok;
+            snprintf(dir, sizeof(dir), "%s/archive/%u", index->dir, shard->year);
+            ok = ensure_dir(dir) && ok;
+            last_year = shard->year;
+        }
+        const u64 hash = index_shard_hash(shard, pages, page_count);
+        if (manifest_update_hash(manifest, shard->path, hash)) {
+            output_hashes[dirty_count] = manifest_get(manifest, shard->path)->output_hash;
+            dirty[dirty_count++] = i;
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+
+    // Index pages past the new end are left over from a bigger site
+    const u32 page_total = shards[0].page_total;
+    for (u32 n = page_total + 1;; ++n) {
+        char stale[MKSITE_PATH_MAX];
+        snprintf(stale, sizeof(stale), "%s/page/%u.html", index->dir, n);
+        if (access(stale, F_OK) != 0) {
+            break;
+        }
+        remove_output(stale);
+        manifest_forget(manifest, stale);
+    }
+
+    if (dirty_count == 0) {
+        LOG_INFO("Index is up to date\n");
+        return true;
+    }
+    if (dirty_count < shard_count) {
+        LOG_INFO("Skipped %u unchanged index pages\n", shard_count - dirty_count);
+    }
+
+    BuildIndexTask task = {
+        .pages = pages,
+        .page_count = page_count,
+        .shards = shards,
+        .dirty = dirty,
+        .output_hashes = output_hashes,
+    };
+    atomic_init(&task.unchanged, 0);
+    pool_run(pool, dirty_count, build_index_task, &task);
+
+    for (u32 i = 0; i < dirty_count; ++i) {
+        manifest_get(manifest, shards[dirty[i]].path)->output_hash = output_hashes[i];
+    }
+    const u32 unchanged = atomic_load(&task.unchanged);
+    if (unchanged) {
+        LOG_INFO("Left %u re-rendered but identical index pages\n", unchanged);
+    }
+    trace_counter("unchanged_outputs", "index", unchanged);
+    return pool_take_write_failures(pool) == 0;
+}
+
+/// @brief Delete the content-addressed stylesheets in public/ other than `keep` (a file name, or
+/// NULL when the styles are inlined), and their sidecars
+static void remove_stale_stylesheets(const char* keep) {
+    DIR* dir = opendir(PUBLIC_DIR);
+    if (!dir) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        // Only "styles.<16 hex digits>.css", the names install_stylesheet gives them
+        if (strlen(name) != 27 || memcmp(name, "styles.", 7) != 0 ||
+            strcmp(name + 23, ".css") != 0 || strspn(name + 7, "0123456789abcdef") != 16 ||
+            (keep && strcmp(name, keep) == 0)) {
+            continue;
+        }
+        char path[MKSITE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", PUBLIC_DIR, name);
+        remove_output(path);
+    }
+    closedir(dir);
+}
+
+/// @brief Write styles.css to a content-addressed file that can be cached forever, and delete
+/// the one it replaces
+bool install_stylesheet(Arena* scratch) {
+    if (opts.inline_css) {
+        remove_stale_stylesheets(NULL);
+        return true;
+    }
+
+    const u64 hash = hash_bytes(site_css, site_css_len, 0);
+    snprintf(
+        stylesheet_href,
+        sizeof(stylesheet_href),
+        "/styles.%016llx.css",
+        (unsigned long long)hash);
+
+    char path[MKSITE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", PUBLIC_DIR, stylesheet_href);
+
+    // The name is derived from the contents, so an existing file is already up to date
+    const bool written = access(path, F_OK) != 0;
+    if (written && !write_file(path, site_css, site_css_len)) {
+        LOG_ERROR("Failed to write stylesheet: %s\n", path);
+        return false;
+    }
+    // and so are its sidecars, unless one is missing
+    if (opts.precompress && (written || !compressed_sidecars_exist(path)) &&
+        !write_compressed_sidecars(scratch, NULL, path, site_css, site_css_len)) {
+        LOG_ERROR("Failed to write compressed copies of %s\n", path);
+        return false;
+    }
+    remove_stale_stylesheets(stylesheet_href + 1);
+    return true;
+}
+
+/// @brief A file under assets/, copied to the same place under public/
+typedef struct {
+    const char* rel; // path under assets/, like "fonts/inter.woff2"
+    char* url; // root-relative URL it's served from, with room for a fingerprint
+    char* stale_url; // previous fingerprinted URL to delete once replaced, or NULL
+    u64 size;
+    i64 mtime;
+    u64 hash; // of the contents, only computed with --fingerprint
+} Asset;
+
+typedef struct {
+    Arena arena; // paths and URLs, cleared by every `install_assets`
+    Arena list; // nothing but the asset array, so it can keep growing in place
+    Asset* items;
+    u32 count;
+    Arena dirs; // asset directories as consecutive NUL-terminated paths, for --watch
+    u64 dirs_len;
+} Assets;
+
+Assets assets;
+
+static bool asset_compressible(const char* rel) {
+    static const char* const exts[] = {".svg", ".css", ".js", ".json", ".txt", ".xml", ".html"};
+    const char* dot = strrchr(rel, '.');
+    for (u32 i = 0; dot && i < sizeof(exts) / sizeof(exts[0]); ++i) {
+        if (strcmp(dot, exts[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Write the URL of `rel` to `url`, with `hash` before the extension when fingerprinting
+static void asset_url(char* url, u64 url_size, const char* rel, bool fingerprint, u64 hash) {
+    if (!fingerprint) {
+        snprintf(url, url_size, "/%s", rel);
+        return;
+    }
+    const char* slash = strrchr(rel, '/');
+    const char* dot = strrchr(slash ? slash + 1 : rel, '.');
+    const int stem = dot && dot != (slash ? slash + 1 : rel) ? (int)(dot - rel) : (int)strlen(rel);
+    snprintf(url, url_size, "/%.*s.%016llx%s", stem, rel, (unsigned long long)hash, rel + stem);
+}
+
+/// @brief Returns true if the asset at `src_path` has to be copied, and records its inputs
+bool manifest_update_asset(Manifest* m, const char* src_path, Asset* asset) {
+    ManifestEntry* entry = manifest_get(m, src_path);
+    const u32 flags = (opts.precompress ? ASSET_PRECOMPRESSED : 0) |
+                      (opts.fingerprint ? ASSET_FINGERPRINTED : 0);
+    const bool was_fingerprinted = entry->flags & ASSET_FINGERPRINTED;
+    const u64 url_size = strlen(asset->rel) + 19;
+
+    char* previous = arena_push(&assets.arena, url_size, 1);
+    asset_url(previous, url_size, asset->rel, was_fingerprinted, entry->source_hash);
+    char path[MKSITE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", PUBLIC_DIR, previous);
+
+    const bool current = !opts.force && entry->flags == flags &&
+                         entry->source_size == asset->size && entry->source_mtime == asset->mtime &&
+                         access(path, F_OK) == 0;
+    entry->seen = true;
+    entry->source_size = asset->size;
+    entry->source_mtime = asset->mtime;
+    entry->flags = flags;
+    entry->template_version = TEMPLATE_VERSION;
+    if (current) {
+        asset->url = previous;
+        asset->hash = entry->source_hash;
+        return false;
+    }
+    asset->url = arena_push(&assets.arena, url_size, 1);
+    asset->stale_url = was_fingerprinted ? previous : NULL;
+    return true;
+}
+
+/// @brief Delete every output the build didn't touch, like the pages of deleted or renamed
+/// sources and the copies of deleted assets, before their entries are dropped from the manifest
+/// by not being saved.
+///
+/// Only for full builds, the ones that touch every output that still has a source.
+void remove_unseen_outputs(const Manifest* m) {
+    u32 removed = 0;
+    for (u32 i = 0; i < m->capacity; ++i) {
+        const ManifestEntry* entry = &m->slots[i];
+        if (entry->key == 0 || entry->seen) {
+            continue;
+        }
+        if (strncmp(entry->path, PUBLIC_DIR "/", sizeof(PUBLIC_DIR)) == 0) {
+            remove_output(entry->path);
+            ++removed;
+        } else if (strncmp(entry->path, ASSET_DIR "/", sizeof(ASSET_DIR)) == 0) {
+            // Assets are recorded under their source, their copy is wherever its URL points
+            const char* rel = entry->path + sizeof(ASSET_DIR);
+            char url[MKSITE_PATH_MAX];
+            const bool fingerprinted = entry->flags & ASSET_FINGERPRINTED;
+            asset_url(url, sizeof(url), rel, fingerprinted, entry->source_hash);
+            char path[MKSITE_PATH_MAX];
+            if (snprintf(path, sizeof(path), "%s%s", PUBLIC_DIR, url) < (int)sizeof(path)) {
+                remove_output(path);
+                ++removed;
+            }
+        }
+    }
+    if (removed) {
+        LOG_INFO("Removed %u stale outputs\n", removed);
+    }
+}
+
+/// @brief Add every file under `ASSET_DIR/rel` to `assets`, recursing into subdirectories
+bool scan_assets(const char* rel) {
+    char dir_path[MKSITE_PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s%s%s", ASSET_DIR, *rel ? "/" : "", rel);
+    DIR* dir = opendir(dir_path);
+    if (!dir) {
+        // A site without assets/ is fine, anything else going wrong isn't
+        if (errno == ENOENT && !*rel) {
+            return true;
+        }
+        LOG_ERROR("Failed to open directory: %s\n", dir_path);
+        return false;
+    }
+
+    const u64 dir_len = strlen(dir_path) + 1;
+    memcpy(arena_push(&assets.dirs, dir_len, 1), dir_path, dir_len);
+    assets.dirs_len += dir_len;
+
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char child[MKSITE_PATH_MAX];
+        snprintf(child, sizeof(child), "%s%s%s", rel, *rel ? "/" : "", entry->d_name);
+        char path[MKSITE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", ASSET_DIR, child);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            LOG_ERROR("Failed to stat %s\n", path);
+            ok = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            char out_dir[MKSITE_PATH_MAX];
+            snprintf(out_dir, sizeof(out_dir), "%s/%s", PUBLIC_DIR, child);
+            ok = ensure_dir(out_dir) && scan_assets(child);
+        } else if (S_ISREG(st.st_mode)) {
+            const u64 len = strlen(child) + 1;
+            char* rel_copy = arena_push(&assets.arena, len, 1);
+            memcpy(rel_copy, child, len);
+            Asset* asset = arena_push(&assets.list, sizeof(Asset), _Alignof(Asset));
+            *asset = (Asset){
+                .rel = rel_copy,
+                .size = (u64)st.st_size,
+                .mtime = stat_mtime_ns(&st),
+            };
+            ++assets.count;
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+typedef struct {
+    const u32* dirty; // indices into `assets.items`
+    atomic_bool failed;
+} InstallAssetsTask;
+
+void install_asset_task(void* ctx, u32 index, Worker* worker) {
+    InstallAssetsTask* task = (InstallAssetsTask*)ctx;
+    Asset* asset = &assets.items[task->dirty[index]];
+
+    char src_path[MKSITE_PATH_MAX];
+    snprintf(src_path, sizeof(src_path), "%s/%s", ASSET_DIR, asset->rel);
+    if (opts.fingerprint) {
+        asset->hash = hash_file(src_path);
+    }
+    asset_url(asset->url, strlen(asset->rel) + 19, asset->rel, opts.fingerprint, asset->hash);
+    char dst_path[MKSITE_PATH_MAX];
+    snprintf(dst_path, sizeof(dst_path), "%s%s", PUBLIC_DIR, asset->url);
+
+    u64 t = trace_begin();
+    if (!opts.precompress || !asset_compressible(asset->rel)) {
+        // Images and fonts are compressed already, their bytes never need to leave the kernel
+        if (!copy_file(src_path, dst_path)) {
+            LOG_ERROR("Failed to copy %s to %s\n", src_path, dst_path);
+            atomic_store(&task->failed, true);
+        } else if (asset_compressible(asset->rel)) {
+            remove_compressed_sidecars(dst_path);
+        }
+        trace_end("copy_asset", asset->rel, t);
+        return;
+    }
+
+    u64 len = 0;
+    i64 mtime = 0;
+    const char* data = read_file(&worker->writer.arena, src_path, &len, &mtime);
+    if (!data) {
+        LOG_ERROR("Failed to read %s\n", src_path);
+        atomic_store(&task->failed, true);
+        return;
+    }
+    writer_queue(&worker->writer, dst_path, data, len);
+    write_compressed_sidecars(NULL, &worker->writer, dst_path, data, len);
+    trace_end("compress_asset", asset->rel, t);
+}
+
+static int asset_compare(const void* a, const void* b) {
+    return strcmp(((const Asset*)a)->rel, ((const Asset*)b)->rel);
+}
+
+/// @brief Write public/assets.json, mapping every asset to its fingerprinted URL, unless it
+/// already holds that
+bool write_asset_manifest(Manifest* manifest, Arena* scratch) {
+    Buf out = buf_create(scratch, KB(16));
+    buf_lit(&out, "{");
+    for (u32 i = 0; i < assets.count; ++i) {
+        const Asset* asset = &assets.items[i];
+        buf_str(&out, i ? ",\n  " : "\n  ");
+        for (u32 pass = 0; pass < 2; ++pass) {
+            const char* str = pass ? asset->url : asset->rel;
+            buf_char(&out, '"');
+            for (; *str; ++str) {
+                if (*str == '"' || *str == '\\') {
+                    buf_char(&out, '\\');
+                }
+                buf_char(&out, *str);
+            }
+            buf_str(&out, pass ? "\"" : "\": ");
+        }
+    }
+    buf_lit(&out, "\n}\n");
+    manifest_get(manifest, ASSET_MANIFEST_PATH)->seen = true;
+    return write_site_file(manifest, ASSET_MANIFEST_PATH, &out, scratch);
+}
+
+/// @brief Copy assets/ into public/ on the pool, skipping files that haven't changed.
+///
+/// With --fingerprint every file gets its content hash in the name so it can be cached forever,
+/// and public/assets.json maps the original names to the new ones. `copied` is set to the
+/// number of files written.
+bool install_assets(Manifest* manifest, Pool* pool, Arena* scratch, u32* copied) {
+    arena_clear(&assets.arena);
+    arena_clear(&assets.list);
+    arena_clear(&assets.dirs);
+    assets.items = (Asset*)assets.list.base;
+    assets.count = 0;
+    assets.dirs_len = 0;
+    if (!scan_assets("")) {
+        return false;
+    }
+    // Sorted so assets.json doesn't depend on the order of readdir
+    qsort(assets.items, assets.count, sizeof(Asset), asset_compare);
+
+    u32* dirty = arena_push(scratch, sizeof(u32) * (assets.count + 1), ALIGNMENT);
+    u32 dirty_count = 0;
+    for (u32 i = 0; i < assets.count; ++i) {
+        char src_path[MKSITE_PATH_MAX];
+        snprintf(src_path, sizeof(src_path), "%s/%s", ASSET_DIR, assets.items[i].rel);
+        if (manifest_update_asset(manifest, src_path, &assets.items[i])) {
+            dirty[dirty_count++] = i;
+        }
+    }
+
+    InstallAssetsTask task = {.dirty = dirty};
+    atomic_init(&task.failed, false);
+    pool_run(pool, dirty_count, install_asset_task, &task);
+    bool ok = !atomic_load(&task.failed) && pool_take_write_failures(pool) == 0;
+
+    for (u32 i = 0; i < dirty_count; ++i) {
+        const Asset* asset = &assets.items[dirty[i]];
+        char src_path[MKSITE_PATH_MAX];
+        snprintf(src_path, sizeof(src_path), "%s/%s", ASSET_DIR, asset->rel);
+        manifest_get(manifest, src_path)->source_hash = asset->hash;
+
+        // A fingerprinted copy is never overwritten, the one it replaces has to go
+        if (asset->stale_url && strcmp(asset->stale_url, asset->url) != 0) {
+            char stale[MKSITE_PATH_MAX];
+            snprintf(stale, sizeof(stale), "%s%s", PUBLIC_DIR, asset->stale_url);
+            remove_output(stale);
+        }
+    }
+
+    strcpy(favicon_href, "/favicon.svg");
+    for (u32 i = 0; i < assets.count; ++i) {
+        if (strcmp(assets.items[i].rel, "favicon.svg") == 0) {
+            snprintf(favicon_href, sizeof(favicon_href), "%s", assets.items[i].url);
+        }
+    }
+
+    // Rebuilt every time, an asset that went away changes it as much as a copied one
+    if (opts.fingerprint) {
+        ok = write_asset_manifest(manifest, scratch) && ok;
+    } else {
+        remove_output(ASSET_MANIFEST_PATH);
+    }
+    if (dirty_count) {
+        LOG_INFO("Copied %u of %u assets\n", dirty_count, assets.count);
+    }
+    *copied = dirty_count;
+    return ok;
+}
+
+/// @brief One subdirectory of content/, rendered into the directory of the same name in public/
+typedef struct {
+    char name[MKSITE_PATH_MAX];
+    char src_path[MKSITE_PATH_MAX];
+    char dst_path[MKSITE_PATH_MAX];
+    Arena arena; // source files
+    Arena page_arena; // nothing but the page array, so it can keep growing in place
+    u64 imported_size; // arena usage right after a full import, see `watch_compact`
+    Page* pages;
+    u32 page_count;
+    bool has_index;
+    IndexConfig index;
+    i32 watch_id; // inotify watch descriptor in --watch mode
+} Collection;
+
+/// @brief What mksite.conf says about one collection
+typedef struct {
+    char name[64];
+    bool has_index;
+    char index_dir[MKSITE_PATH_MAX]; // under public/, empty for the front page
+    char title[64]; // empty keeps the blog's names
+    SortOrder sort;
+} CollectionConfig;
+
+typedef struct {
+    // Holds nothing but the collection array so the array can keep growing in place
+    Arena arena;
+    Collection* collections;
+    u32 collection_count;
+    // Same for the collections declared in mksite.conf
+    Arena config_arena;
+    CollectionConfig* configs;
+    u32 config_count;
+    bool configured; // there's a mksite.conf, so collections it doesn't list get no index
+} Site;
+
+static char* config_trim(char* str) {
+    while (*str == ' ' || *str == '\t') {
+        ++str;
+    }
+    char* end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        --end;
+    }
+    *end = '\0';
+    return str;
+}
+
+/// @brief Read the collection settings from `CONFIG_PATH`, if there is one.
+///
+/// The file has one `[name]` section per subdirectory of content/, holding `key = value` lines:
+///
+///     [posts]
+///     index = /        # where index.html goes under public/: /, a directory, or none
+///     title = Posts    # heading of the index, defaults to the blog's own names
+///     sort = newest    # index order: newest, oldest or title
+///
+/// A collection that isn't listed is still built, just without an index.
+bool site_load_config(Site* site, Arena* scratch) {
+    site->config_arena = arena_create(MB(64));
+    site->configs = (CollectionConfig*)site->config_arena.base;
+
+    u64 len = 0;
+    i64 mtime = 0;
+    char* data = read_file(scratch, CONFIG_PATH, &len, &mtime);
+    if (!data) {
+        return access(CONFIG_PATH, F_OK) != 0;
+    }
+    site->configured = true;
+
+    CollectionConfig* config = NULL;
+    u32 line_no = 0;
+    for (char* line = data; line < data + len;) {
+        char* eol = memchr(line, '\n', data + len - line);
+        eol = eol ? eol : data + len;
+        *eol = '\0';
+        ++line_no;
+        char* hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char* text = config_trim(line);
+        line = eol + 1;
+        if (!*text) {
+            continue;
+        }
+
+        const u64 text_len = strlen(text);
+        if (text[0] == '[' && text[text_len - 1] == ']') {
+            text[text_len - 1] = '\0';
+            const u64 align = _Alignof(CollectionConfig);
+            config = arena_push(&site->config_arena, sizeof(CollectionConfig), align);
+            assert(config == &site->configs[site->config_count]);
+            ++site->config_count;
+            *config = (CollectionConfig){.sort = SORT_NEWEST};
+            snprintf(config->name, sizeof(config->name), "%s", config_trim(text + 1));
+            continue;
+        }
+
+        char* eq = strchr(text, '=');
+        if (!config || !eq) {
+            LOG_ERROR("%s:%u: expected [collection] or key = value\n", CONFIG_PATH, line_no);
+            return false;
+        }
+        *eq = '\0';
+        const char* key = config_trim(text);
+        const char* value = config_trim(eq + 1);
+        if (strcmp(key, "index") == 0) {
+            config->has_index = strcmp(value, "none") != 0;
+            while (*value == '/') {
+                ++value;
+            }
+            snprintf(config->index_dir, sizeof(config->index_dir), "%s", value);
+        } else if (strcmp(key, "title") == 0) {
+            snprintf(config->title, sizeof(config->title), "%s", value);
+        } else if (strcmp(key, "sort") == 0) {
+            const char* orders[] = {[SORT_NEWEST] = "newest", "oldest", "title"};
+            u32 order = 0;
+            while (order < 3 && strcmp(value, orders[order]) != 0) {
+                ++order;
+            }
+            if (order == 3) {
+                LOG_ERROR("%s:%u: unknown sort order %s\n", CONFIG_PATH, line_no, value);
+                return false;
+            }
+            config->sort = (SortOrder)order;
+        } else {
+            LOG_ERROR("%s:%u: unknown key %s\n", CONFIG_PATH, line_no, key);
+            return false;
+        }
+    }
+
+    // Two indexes in one place would keep overwriting each other
+    for (u32 i = 0; i < site->config_count; ++i) {
+        for (u32 j = 0; j < i; ++j) {
+            const CollectionConfig* a = &site->configs[i];
+            const CollectionConfig* b = &site->configs[j];
+            if (a->has_index && b->has_index && strcmp(a->index_dir, b->index_dir) == 0) {
+                LOG_ERROR("%s: %s and %s share an index\n", CONFIG_PATH, b->name, a->name);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+Collection* site_add_collection(Site* site, const char* name) {
+    Collection* c = arena_push(&site->arena, sizeof(Collection), ALIGNMENT);
+    if (site->collection_count == 0) {
+        site->collections = c;
+    }
+    assert(c == &site->collections[site->collection_count]);
+    ++site->collection_count;
+
+    *c = (Collection){
+        .arena = arena_create(GB(64)),
+        .page_arena = arena_create(GB(4)),
+        .watch_id = -1,
+    };
+    snprintf(c->name, MKSITE_PATH_MAX, "%s", name);
+    snprintf(c->src_path, MKSITE_PATH_MAX, "%s/%s", CONTENT_DIR, name);
+    snprintf(c->dst_path, MKSITE_PATH_MAX, "%s/%s", PUBLIC_DIR, name);
+
+    // Without a mksite.conf only the `posts` collection gets an index, as the site's front page
+    const CollectionConfig* config = NULL;
+    for (u32 i = 0; i < site->config_count && !config; ++i) {
+        config = strcmp(site->configs[i].name, name) == 0 ? &site->configs[i] : NULL;
+    }
+    if (config) {
+        c->has_index = config->has_index;
+        const char* title = *config->title ? config->title : NULL;
+        index_config_init(&c->index, name, config->index_dir, title);
+        c->index.sort = config->sort;
+    } else {
+        c->has_index = !site->configured && strcmp(name, "posts") == 0;
+        index_config_init(&c->index, name, "", NULL);
+    }
+    return c;
+}
+
+/// @brief Append `date` as YYYY-MM-DD, the date format of both Atom and sitemaps
+void buf_iso_date(Buf* out, u32 date) {
+    char text[16];
+    const int len = snprintf(
+        text, sizeof(text), "%04u-%02u-%02u", DATE_YEAR(date), DATE_MONTH(date), DATE_DAY(date));
+    buf_write(out, text, (u64)len);
+}
+
+/// @brief Append the absolute URL of a page in the collection at `dst_path`
+void buf_page_url(Buf* out, const char* dst_path, const Page* page) {
+    const char* dir = dst_path + sizeof(PUBLIC_DIR) - 1;
+    buf_lit(out, "https://" SITE_URL);
+    html_escape(out, dir, strlen(dir));
+    buf_char(out, '/');
+    buf_write(out, page->slug.data, page->slug.len);
+    buf_lit(out, ".html");
+}
+
+/// @brief Append the absolute URL of the front page of `index`
+void buf_index_url(Buf* out, const IndexConfig* index) {
+    const char* dir = index->dir + sizeof(PUBLIC_DIR) - 1;
+    buf_lit(out, "https://" SITE_URL);
+    html_escape(out, dir, strlen(dir));
+    buf_char(out, '/');
+}
+
+static int feed_page_compare(const void* a, const void* b) {
+    const Page* pa = *(const Page* const*)a;
+    const Page* pb = *(const Page* const*)b;
+    if (pa->date != pb->date) {
+        return pa->date > pb->date ? -1 : 1;
+    }
+    return pa < pb ? -1 : pa > pb;
+}
+
+/// @brief The newest dated pages of `c`, at most `opts.feed_size` of them and newest first
+static u32 feed_pages(const Collection* c, const Page*** pages, Arena* scratch) {
+    const Page** feed = arena_push(scratch, sizeof(Page*) * (c->page_count + 1), ALIGNMENT);
+    u32 count = 0;
+    for (u32 i = 0; i < c->page_count; ++i) {
+        if (c->pages[i].date) {
+            feed[count++] = &c->pages[i];
+        }
+    }
+    // Newest-first indexes already have them in order, with the undated pages at the end
+    if (c->index.sort != SORT_NEWEST) {
+        qsort(feed, count, sizeof(Page*), feed_page_compare);
+    }
+    *pages = feed;
+    return count < opts.feed_size ? count : opts.feed_size;
+}
+
+/// @brief Hash of everything a collection's feed.xml is built from
+static u64 feed_hash(const Collection* c, const Page** pages, u32 count) {
+    // Entries carry rendered content, so a renderer change rebuilds the feed too
+    u64 hash = hash_bytes(c->index.dir, strlen(c->index.dir), TEMPLATE_VERSION ^ RENDERER_HASH);
+    hash = hash_bytes(c->index.heading, strlen(c->index.heading), hash);
+    hash = hash_bytes(c->dst_path, strlen(c->dst_path), hash);
+    for (u32 i = 0; i < count; ++i) {
+        const Page* page = pages[i];
+        hash = hash_bytes(page->slug.data, page->slug.len, hash);
+        hash = hash_bytes(page->title.data, page->title.len, hash);
+        hash = hash_bytes(&page->date, sizeof(page->date), hash);
+        hash = hash_bytes(&page->source_size, sizeof(page->source_size), hash);
+        hash = hash_bytes(&page->source_mtime, sizeof(page->source_mtime), hash);
+    }
+    return hash;
+}
+
+/// @brief Write feed.xml next to the index of `c`: an Atom feed of its newest pages.
+///
+/// The feed is only rebuilt when one of the pages in it, or which pages those are, changed.
+/// Entries carry their rendered content, except for streamed pages, which are too big for a
+/// feed reader and only get a link.
+bool build_feed(Collection* c, Manifest* manifest, Arena* scratch) {
+    const Page** pages;
+    const u32 count = feed_pages(c, &pages, scratch);
+    char path[MKSITE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/feed.xml", c->index.dir);
+    if (!manifest_update_hash(manifest, path, feed_hash(c, pages, count))) {
+        return true;
+    }
+
+    u64 t = trace_begin();
+    Buf feed = buf_create(scratch, KB(64));
+    Buf* out = &feed;
+    PRINT("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+    PRINT("<feed xmlns=\"http://www.w3.org/2005/Atom\">\n");
+    PRINT("  <title>");
+    buf_str(out, c->index.heading);
+    PRINT("</title>\n");
+    PRINT("  <link href=\"");
+    buf_index_url(out, &c->index);
+    PRINT("\"/>\n");
+    PRINT("  <link rel=\"self\" href=\"");
+    buf_index_url(out, &c->index);
+    PRINT("feed.xml\"/>\n");
+    PRINT("  <id>");
+    buf_index_url(out, &c->index);
+    PRINT("</id>\n");
+    PRINT("  <author><name>" SITE_URL "</name></author>\n");
+    if (count) {
+        PRINT("  <updated>");
+        buf_iso_date(out, pages[0]->date);
+        PRINT("T00:00:00Z</updated>\n");
+    }
+
+    // Each entry is rendered on arenas of its own, so the feed grows in place on `scratch` and
+    // the entry's HTML on `html_arena`
+    Arena render_arena = arena_create(GB(16));
+    Arena html_arena = arena_create(GB(16));
+    for (u32 i = 0; i < count; ++i) {
+        const Page* page = pages[i];
+        PRINT("  <entry>\n");
+        PRINT("    <title>");
+        buf_write(out, page->title_html.data, page->title_html.len);
+        PRINT("</title>\n");
+        PRINT("    <link href=\"");
+        buf_page_url(out, c->dst_path, page);
+        PRINT("\"/>\n");
+        PRINT("    <id>");
+        buf_page_url(out, c->dst_path, page);
+        PRINT("</id>\n");
+        PRINT("    <updated>");
+        buf_iso_date(out, page->date);
+        PRINT("T00:00:00Z</updated>\n");
+        if (!page->stream_path) {
+            MdFootnotes footnotes;
+            md_footnotes_init(&footnotes, &render_arena);
+            MdParser parser;
+            md_parser_init(&parser, &render_arena, &footnotes, page->content_len);
+            md_parse(&parser, page->content, page->content_len);
+            Buf html = buf_create(&html_arena, page->content_len + KB(1));
+            MdRenderer md;
+            md_renderer_init(&md, &html, &footnotes, &render_arena);
+            md_render(&md, parser.nodes, parser.count);
+            md_render_finish(&md);
+
+            // Relative links in the content resolve against the page, not the feed
+            PRINT("    <content type=\"html\" xml:base=\"");
+            buf_page_url(out, c->dst_path, page);
+            PRINT("\">");
+            html_escape(out, html.data, html.len);
+            PRINT("</content>\n");
+            arena_clear(&render_arena);
+            arena_clear(&html_arena);
+        }
+        PRINT("  </entry>\n");
+    }
+    arena_release(&html_arena);
+    arena_release(&render_arena);
+    PRINT("</feed>\n");
+
+    const bool ok = write_site_file(manifest, path, out, scratch);
+    trace_end("build_feed", c->name, t);
+    return ok;
+}
+
+bool build_collection_index(Collection* c, Manifest* manifest, Pool* pool, Arena* scratch) {
+    if (!c->has_index) {
+        return true;
+    }
+    u64 t = trace_begin();
+    sort_pages(c->pages, c->page_count, c->index.sort, scratch);
+    trace_end("sort_pages", c->name, t);
+
+    t = trace_begin();
+    const bool ok = build_index(&c->index, c->pages, c->page_count, manifest, pool, scratch);
+    trace_end("build_index", c->name, t);
+    return build_feed(c, manifest, scratch) && ok;
+}
+
+/// @brief Link the pages of an indexed collection to their neighbours and finish building them.
+///
+/// `task` holds the `job_count` pages whose own source changed, already rendered up to their
+/// navigation, or already written with a guess of it when they had neighbours last time.
+/// Every page records what it shows of its neighbours as its `deps_hash`, so the pages whose
+/// links changed are exactly the ones whose hash doesn't match anymore, like the neighbours of
+/// a page that was retitled, added or removed, or a page whose guess was wrong. Those are
+/// rendered whole, and everything else is left alone.
+bool finish_collection_pages(
+    Collection* c,
+    BuildPagesTask* task,
+    u32 job_count,
+    Manifest* manifest,
+    Pool* pool,
+    Arena* scratch) {
+    if (!c->has_index) {
+        return finish_pages(task, job_count, manifest, pool);
+    }
+
+    const u32 cap = c->page_count ? c->page_count : 1;
+    u32* order = arena_push(scratch, sizeof(u32) * cap, ALIGNMENT);
+    order_pages(c->pages, c->page_count, c->index.sort, order, scratch);
+    u32* job_of = arena_push(scratch, sizeof(u32) * cap, ALIGNMENT);
+    memset(job_of, 0xff, sizeof(u32) * cap);
+    for (u32 i = 0; i < job_count; ++i) {
+        job_of[task->jobs[i].page] = i;
+    }
+
+    PageJob* jobs = arena_push(scratch, sizeof(PageJob) * cap, ALIGNMENT);
+    u32 count = 0;
+    u32 relinked = 0;
+    for (u32 k = 0; k < c->page_count; ++k) {
+        const u32 i = order[k];
+        const PageNav nav = {
+            .prev = k > 0 ? &c->pages[order[k - 1]] : NULL,
+            .next = k + 1 < c->page_count ? &c->pages[order[k + 1]] : NULL,
+        };
+        const u64 deps_hash = page_nav_hash(&nav);
+
+        char out_path[MKSITE_PATH_MAX];
+        snprintf(out_path, sizeof(out_path), "%s/%s.html", c->dst_path, c->pages[i].slug.data);
+        ManifestEntry* entry = manifest_get(manifest, out_path);
+        // Kept for the next build's guesses, copied since the pages don't outlive the collection
+        if (page_nav_hash(&entry->nav) != deps_hash) {
+            entry->nav = (PageNav){
+                nav.prev ? manifest_nav_page(manifest, nav.prev->slug, nav.prev->title_html) : NULL,
+                nav.next ? manifest_nav_page(manifest, nav.next->slug, nav.next->title_html) : NULL,
+            };
+        }
+        const PageJob* done = job_of[i] != UINT32_MAX ? &task->jobs[job_of[i]] : NULL;
+        if (done && done->nav_guessed && page_nav_hash(&done->nav) == deps_hash) {
+            entry->output_hash = done->output_hash; // written already, with the right links
+            continue;
+        }
+        if (done) {
+            jobs[count] = *done;
+            jobs[count].nav_guessed = false;
+        } else if (entry->deps_hash != deps_hash) {
+            jobs[count] = page_job(c->pages, i, entry->output_hash, manifest);
+            ++relinked;
+        } else {
+            continue;
+        }
+        jobs[count++].nav = nav;
+        entry->deps_hash = deps_hash;
+    }
+    if (relinked) {
+        LOG_INFO("Relinking %u pages whose neighbours changed in %s\n", relinked, c->dst_path);
+    }
+    if (relinked && render_cache.url[0]) {
+        CacheKey* keys = arena_push(scratch, sizeof(CacheKey) * count, ALIGNMENT);
+        u32 key_count = 0;
+        for (u32 i = 0; i < count; ++i) {
+            keys[key_count] = jobs[i].cache_key;
+            key_count += !jobs[i].held && (keys[key_count].hi || keys[key_count].lo);
+        }
+        cache_fetch(&render_cache, keys, key_count);
+    }
+
+    BuildPagesTask finish = {.dst_path = c->dst_path, .pages = c->pages, .jobs = jobs};
+    atomic_init(&finish.unchanged, atomic_load(&task->unchanged));
+    atomic_init(&finish.failed, atomic_load(&task->failed));
+    pool_run(pool, count, build_pages_task, &finish);
+    return finish_pages(&finish, count, manifest, pool);
+}
+
+/// @brief One arena per worker for `BuildPagesTask::held`
+Arena* held_arenas_create(Pool* pool, Arena* scratch) {
+    Arena* held = arena_push(scratch, sizeof(Arena) * pool->worker_count, ALIGNMENT);
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        held[i] = arena_create(GB(16));
+    }
+    return held;
+}
+
+void held_arenas_release(Arena* held, Pool* pool) {
+    for (u32 i = 0; held && i < pool->worker_count; ++i) {
+        arena_release(&held[i]);
+    }
+}
+
+/// @brief Build whichever of the `count` pages of `c` from `first` on are out of date, and
+/// the neighbours whose navigation changed with them
+bool build_collection_pages(
+    Collection* c,
+    u32 first,
+    u32 count,
+    Manifest* manifest,
+    Pool* pool,
+    Arena* scratch) {
+    // Decide what needs rendering up front, so the workers never touch the manifest
+    PageJob* jobs = arena_push(scratch, sizeof(PageJob) * (count ? count : 1), ALIGNMENT);
+    u32 job_count = 0;
+    for (u32 i = first; i < first + count; ++i) {
+        job_count += plan_page(manifest, c->dst_path, c->pages, i, c->has_index, &jobs[job_count]);
+    }
+    if (job_count < count) {
+        LOG_INFO("Skipped %u unchanged pages in %s\n", count - job_count, c->dst_path);
+    }
+
+    if (render_cache.url[0]) {
+        CacheKey* keys = arena_push(scratch, sizeof(CacheKey) * (job_count + 1), ALIGNMENT);
+        u32 key_count = 0;
+        for (u32 i = 0; i < job_count; ++i) {
+            keys[key_count] = jobs[i].cache_key;
+            key_count += keys[key_count].hi || keys[key_count].lo;
+        }
+        cache_fetch(&render_cache, keys, key_count);
+    }
+
+    BuildPagesTask task = {.dst_path = c->dst_path, .pages = c->pages, .jobs = jobs};
+    task.held = c->has_index ? held_arenas_create(pool, scratch) : NULL;
+    atomic_init(&task.unchanged, 0);
+    atomic_init(&task.failed, false);
+    pool_run(pool, job_count, build_pages_task, &task);
+    const bool ok = finish_collection_pages(c, &task, job_count, manifest, pool, scratch);
+    held_arenas_release(task.held, pool);
+    return ok;
+}
+
+// Pages waiting between import and rendering, bounding how far the imports run ahead
+#define PIPELINE_DEPTH 256
+
+typedef struct SitePipeline SitePipeline;
+
+/// @brief One collection's part of a `SitePipeline`
+typedef struct {
+    SitePipeline* pipeline;
+    u32 id; // index into `pipeline->imports`
+    Collection* c;
+    Arena jobs_arena; // nothing but `render.jobs`, so it grows in place under the renderers
+    u32 job_count;
+    BuildPagesTask render;
+    u32 queued; // jobs pushed onto the queue, the ones after it wait for their cache fetch
+    Worker* importer; // the worker running this import
+    bool import_failed;
+} CollectionImport;
+
+/// @brief Importing collections while other workers render what's already been imported.
+///
+/// The first tasks each import one collection, planning every page against the manifest as
+/// soon as it's read and pushing the ones that need rendering onto `queue`. The remaining
+/// tasks, one per worker, render from the queue until the last import closes it. Renders queue
+/// their output on the worker's `Writer`, so reads, rendering and writes all overlap, and a
+/// small collection is done long before a big one next to it.
+struct SitePipeline {
+    Manifest* manifest;
+    CollectionImport* imports;
+    u32 import_count;
+    Queue queue; // import id << 32 | index into that import's `render.jobs`
+    _Atomic u32 importing; // imports still running, the last one to finish closes `queue`
+    pthread_mutex_t manifest_mutex; // imports run side by side but plan against one manifest
+};
+
+static void pipeline_render(SitePipeline* p, u64 item, Worker* worker) {
+    CollectionImport* import = &p->imports[item >> 32];
+    build_page_job(&import->render, &import->render.jobs[(u32)item], worker);
+    arena_clear(&worker->scratch);
+    writer_flush_if_full(&worker->writer);
+}
+
+/// @brief Hand the planned jobs that haven't been queued yet to the renderers, fetching them
+/// from the remote render cache first if there is one
+static void pipeline_queue_jobs(SitePipeline* p, CollectionImport* import) {
+    const u32 first = import->queued;
+    if (render_cache.url[0] && first < import->job_count) {
+        CacheKey keys[CACHE_FETCH_BATCH];
+        u32 count = 0;
+        for (u32 i = first; i < import->job_count; ++i) {
+            keys[count] = import->render.jobs[i].cache_key;
+            count += keys[count].hi || keys[count].lo;
+        }
+        cache_fetch(&render_cache, keys, count);
+    }
+    for (; import->queued < import->job_count; ++import->queued) {
+        // When the renderers fall behind, the importer lends a hand instead of waiting
+        const u64 item = (u64)import->id << 32 | import->queued;
+        u64 ready;
+        while (!queue_push(&p->queue, item)) {
+            if (queue_pop(&p->queue, &ready)) {
+                pipeline_render(p, ready, import->importer);
+            }
+        }
+    }
+}
+
+void pipeline_page_imported(void* ctx, u32 index) {
+    CollectionImport* import = (CollectionImport*)ctx;
+    SitePipeline* p = import->pipeline;
+    PageJob job;
+    const Collection* c = import->c;
+    pthread_mutex_lock(&p->manifest_mutex);
+    const bool planned = plan_page(p->manifest, c->dst_path, c->pages, index, c->has_index, &job);
+    pthread_mutex_unlock(&p->manifest_mutex);
+    if (!planned) {
+        return;
+    }
+    PageJob* slot = arena_push(&import->jobs_arena, sizeof(PageJob), _Alignof(PageJob));
+    assert(slot == &import->render.jobs[import->job_count]);
+    *slot = job;
+    ++import->job_count;
+    // Remote fetches go out a batch at a time, everything else is rendered right away
+    if (!render_cache.url[0] || import->job_count - import->queued == CACHE_FETCH_BATCH) {
+        pipeline_queue_jobs(p, import);
+    }
+}
+
+void pipeline_task(void* ctx, u32 index, Worker* worker) {
+    SitePipeline* p = (SitePipeline*)ctx;
+    // Imports come first, and every worker runs its tasks in order, so whichever import hasn't
+    // started yet is always next in line for some worker that isn't waiting on the queue
+    if (index < p->import_count) {
+        CollectionImport* import = &p->imports[index];
+        Collection* c = import->c;
+        u64 t = trace_begin();
+        import->importer = worker;
+        import->import_failed = !import_pages(
+            c->src_path,
+            &c->arena,
+            &c->page_arena,
+            &c->pages,
+            &c->page_count,
+            pipeline_page_imported,
+            import);
+        pipeline_queue_jobs(p, import);
+        c->imported_size = c->arena.used;
+        trace_end("import_pages", c->name, t);
+        if (atomic_fetch_sub(&p->importing, 1) == 1) {
+            queue_close(&p->queue);
+        }
+        return;
+    }
+
+    u64 item;
+    while (queue_pop_wait(&p->queue, &item)) {
+        pipeline_render(p, item, worker);
+    }
+}
+
+/// @brief Import the `count` collections starting at `collections` and build whatever the
+/// manifest says is out of date, all at once
+bool build_collections(
+    Collection* collections,
+    u32 count,
+    Manifest* manifest,
+    Pool* pool,
+    Arena* scratch) {
+    u64 t = trace_begin();
+    SitePipeline p = {.manifest = manifest, .import_count = count};
+    p.imports = arena_push(scratch, sizeof(CollectionImport) * count, ALIGNMENT);
+    // Shared by every indexed collection, they're all finished before any of it is released
+    Arena* held = NULL;
+    for (u32 i = 0; i < count && !held; ++i) {
+        held = collections[i].has_index ? held_arenas_create(pool, scratch) : NULL;
+    }
+    queue_init(&p.queue, scratch, PIPELINE_DEPTH);
+    atomic_init(&p.importing, count);
+    for (u32 i = 0; i < count; ++i) {
+        Collection* c = &collections[i];
+        if (!ensure_dir(c->dst_path)) {
+            return false;
+        }
+        arena_clear(&c->page_arena);
+
+        CollectionImport* import = &p.imports[i];
+        *import = (CollectionImport){
+            .pipeline = &p,
+            .id = i,
+            .c = c,
+            .jobs_arena = arena_create(GB(1)),
+            .render = {.dst_path = c->dst_path, .held = c->has_index ? held : NULL},
+        };
+        atomic_init(&import->render.unchanged, 0);
+        atomic_init(&import->render.failed, false);
+        // `c->pages` only gets set by the import, but the page array never moves, so the
+        // renderers can rely on where it starts
+        import->render.pages = (const Page*)c->page_arena.base;
+        import->render.jobs = (PageJob*)import->jobs_arena.base;
+    }
+    pthread_mutex_init(&p.manifest_mutex, NULL);
+    pool_run(pool, count + pool->worker_count, pipeline_task, &p);
+    pthread_mutex_destroy(&p.manifest_mutex);
+    queue_destroy(&p.queue);
+    trace_end("build_pages", NULL, t);
+
+    bool ok = true;
+    for (u32 i = 0; i < count; ++i) {
+        CollectionImport* import = &p.imports[i];
+        Collection* c = import->c;
+        if (import->import_failed) {
+            LOG_ERROR("Failed to import pages from %s\n", c->src_path);
+            ok = false;
+        } else {
+            if (import->job_count < c->page_count) {
+                const u32 skipped = c->page_count - import->job_count;
+                LOG_INFO("Skipped %u unchanged pages in %s\n", skipped, c->dst_path);
+            }
+            if (!finish_collection_pages(
+                    c, &import->render, import->job_count, manifest, pool, scratch)) {
+                LOG_ERROR("Failed to build pages to %s\n", c->dst_path);
+                ok = false;
+            } else {
+                ok = build_collection_index(c, manifest, pool, scratch) && ok;
+            }
+        }
+        arena_release(&import->jobs_arena);
+        trace_counter("arena_peak", c->name, c->arena.peak);
+    }
+    held_arenas_release(held, pool);
+    return ok;
+}
+
+bool build_collection(Collection* c, Manifest* manifest, Pool* pool, Arena* scratch) {
+    return build_collections(c, 1, manifest, pool, scratch);
+}
+
+/// @brief Hash of everything public/search.bin is built from
+u64 search_index_hash(const Site* site) {
+    u64 hash = hash_bytes(SEARCH_MAGIC, 4, SEARCH_VERSION);
+    for (u32 i = 0; i < site->collection_count; ++i) {
+        const Collection* c = &site->collections[i];
+        hash = hash_bytes(c->dst_path, strlen(c->dst_path), hash);
+        for (u32 j = 0; j < c->page_count; ++j) {
+            const Page* page = &c->pages[j];
+            hash = hash_bytes(page->slug.data, page->slug.len, hash);
+            hash = hash_bytes(page->title.data, page->title.len, hash);
+            hash = hash_bytes(&page->source_size, sizeof(page->source_size), hash);
+            hash = hash_bytes(&page->source_mtime, sizeof(page->source_mtime), hash);
+        }
+    }
+    return hash;
+}
+
+/// @brief A page whose search terms haven't been gathered yet
+typedef struct {
+    Collection* c;
+    Page* page;
+    u32 doc; // index into `SearchTask::docs`
+} SearchPending;
+
+typedef struct {
+    const SearchPending* pending;
+    SearchDoc* docs;
+    Arena* arenas; // per worker, holding the terms gathered on it
+    atomic_bool failed;
+} SearchTask;
+
+void search_page_task(void* ctx, u32 index, Worker* worker) {
+    SearchTask* task = (SearchTask*)ctx;
+    const Page* page = task->pending[index].page;
+
+    u64 t = trace_begin();
+    SearchTerms terms;
+    search_terms_init(&terms, &worker->scratch);
+    search_add_text(&terms, page->title.data, page->title.len);
+    if (page->stream_path) {
+        if (!search_page_streamed(page, &terms, &worker->scratch)) {
+            atomic_store(&task->failed, true);
+        }
+    } else {
+        MdFootnotes footnotes;
+        md_footnotes_init(&footnotes, &worker->scratch);
+        MdParser parser;
+        md_parser_init(&parser, &worker->scratch, &footnotes, page->content_len);
+        md_parse(&parser, page->content, page->content_len);
+        search_add_nodes(&terms, parser.nodes, parser.count);
+    }
+
+    // Scratch is cleared after every task, the terms have to outlive the whole batch
+    SearchDoc* doc = &task->docs[task->pending[index].doc];
+    doc->terms = search_terms_copy(terms.items, terms.count, &task->arenas[worker->id]);
+    doc->term_count = terms.count;
+    trace_end("search_page", page->slug.data, t);
+}
+
+/// @brief Write public/search.bin, the full-text index of every page on the site.
+///
+/// Pages are tokenized on the pool, straight from their parsed Markdown, and merged into one
+/// index on this thread. With --watch every page keeps its terms, so a rebuild only tokenizes
+/// the pages that changed.
+bool build_search_index(Site* site, Manifest* manifest, Pool* pool, Arena* scratch) {
+    if (!manifest_update_hash(manifest, SEARCH_PATH, search_index_hash(site))) {
+        LOG_INFO("Search index is up to date\n");
+        return true;
+    }
+
+    u64 t = trace_begin();
+    u32 page_count = 0;
+    for (u32 i = 0; i < site->collection_count; ++i) {
+        page_count += site->collections[i].page_count;
+    }
+    const u32 cap = page_count ? page_count : 1;
+    SearchDoc* docs = arena_push(scratch, sizeof(SearchDoc) * cap, ALIGNMENT);
+    SearchPending* pending = arena_push(scratch, sizeof(SearchPending) * cap, ALIGNMENT);
+    u32 pending_count = 0;
+    u32 doc_count = 0;
+    for (u32 i = 0; i < site->collection_count; ++i) {
+        Collection* c = &site->collections[i];
+        for (u32 j = 0; j < c->page_count; ++j) {
+            Page* page = &c->pages[j];
+            char url[MKSITE_PATH_MAX];
+            const int len = snprintf(
+                url, sizeof(url), "%s/%s.html", c->dst_path + sizeof(PUBLIC_DIR), page->slug.data);
+            char* interned = arena_push(scratch, (u64)len, 1);
+            memcpy(interned, url, (u64)len);
+
+            docs[doc_count] = (SearchDoc){
+                .url = {interned, (u32)len},
+                .title = page->title,
+                .terms = page->search_terms,
+                .term_count = page->search_term_count,
+            };
+            if (!page->search_terms) {
+                pending[pending_count++] = (SearchPending){.c = c, .page = page, .doc = doc_count};
+            }
+            ++doc_count;
+        }
+    }
+
+    SearchTask task = {.pending = pending, .docs = docs};
+    task.arenas = arena_push(scratch, sizeof(Arena) * pool->worker_count, ALIGNMENT);
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        task.arenas[i] = arena_create(GB(16));
+    }
+    atomic_init(&task.failed, false);
+    pool_run(pool, pending_count, search_page_task, &task);
+
+    if (opts.watch) {
+        for (u32 i = 0; i < pending_count; ++i) {
+            SearchDoc* doc = &docs[pending[i].doc];
+            Page* page = pending[i].page;
+            doc->terms = search_terms_copy(doc->terms, doc->term_count, &pending[i].c->arena);
+            page->search_terms = doc->terms;
+            page->search_term_count = doc->term_count;
+        }
+    }
+
+    Buf out = buf_create(scratch, MB(1));
+    const u32 term_count = search_index_write(&out, scratch, docs, doc_count);
+    for (u32 i = 0; i < pool->worker_count; ++i) {
+        arena_release(&task.arenas[i]);
+    }
+
+    if (atomic_load(&task.failed)) {
+        LOG_ERROR("Failed to write %s\n", SEARCH_PATH);
+        manifest_forget(manifest, SEARCH_PATH);
+        return false;
+    }
+    const bool ok = write_site_file(manifest, SEARCH_PATH, &out, scratch);
+    trace_end("search_index", NULL, t);
+    if (!ok) {
+        return false;
+    }
+    LOG_INFO("Indexed %u terms from %u pages for search\n", term_count, doc_count);
+    return true;
+}
+
+/// @brief Hash of everything public/sitemap.xml is built from
+u64 sitemap_hash(const Site* site) {
+    u64 hash = TEMPLATE_VERSION;
+    for (u32 i = 0; i < site->collection_count; ++i) {
+        const Collection* c = &site->collections[i];
+        hash = hash_bytes(&c->has_index, sizeof(c->has_index), hash);
+        hash = hash_bytes(c->index.dir, strlen(c->index.dir), hash);
+        hash = hash_bytes(c->dst_path, strlen(c->dst_path), hash);
+        for (u32 j = 0; j < c->page_count; ++j) {
+            const Page* page = &c->pages[j];
+            hash = hash_bytes(page->slug.data, page->slug.len, hash);
+            hash = hash_bytes(&page->date, sizeof(page->date), hash);
+        }
+    }
+    return hash;
+}
+
+/// @brief Write public/sitemap.xml, listing every index and every page with its date
+bool build_sitemap(Site* site, Manifest* manifest, Arena* scratch) {
+    if (!manifest_update_hash(manifest, SITEMAP_PATH, sitemap_hash(site))) {
+        return true;
+    }
+
+    u64 t = trace_begin();
+    Buf sitemap = buf_create(scratch, MB(1));
+    Buf* out = &sitemap;
+    u32 url_count = 0;
+    PRINT("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+    PRINT("<urlset xmlns=\"http://www.sitemaps.org/schemas/sitemap/0.9\">\n");
+    for (u32 i = 0; i < site->collection_count; ++i) {
+        const Collection* c = &site->collections[i];
+        if (c->has_index) {
+            PRINT("  <url><loc>");
+            buf_index_url(out, &c->index);
+            PRINT("</loc></url>\n");
+            ++url_count;
+        }
+    }
+    for (u32 i = 0; i < site->collection_count; ++i) {
+        const Collection* c = &site->collections[i];
+        for (u32 j = 0; j < c->page_count; ++j) {
+            const Page* page = &c->pages[j];
+            PRINT("  <url><loc>");
+            buf_page_url(out, c->dst_path, page);
+            PRINT("</loc>");
+            if (page->date) {
+                PRINT("<lastmod>");
+                buf_iso_date(out, page->date);
+                PRINT("</lastmod>");
+            }
+            PRINT("</url>\n");
+        }
+        url_count += c->page_count;
+    }
+    PRINT("</urlset>\n");
+
+    const bool ok = write_site_file(manifest, SITEMAP_PATH, out, scratch);
+    trace_end("build_sitemap", NULL, t);
+    if (ok) {
+        LOG_INFO("Listed %u URLs in %s\n", url_count, SITEMAP_PATH);
+    }
+    return ok;
+}
+
+/// @brief Upload what this build added to the render cache and say how well it did
+void report_render_cache() {
+    if (!cache_enabled(&render_cache)) {
+        return;
+    }
+    const u32 hits = atomic_exchange(&render_cache.hits, 0);
+    const u32 misses = atomic_exchange(&render_cache.misses, 0);
+    const u32 stored = render_cache.upload_count;
+    const u32 uploaded = cache_upload(&render_cache);
+    LOG_INFO("Render cache: %u hits, %u misses\n", hits, misses);
+    if (stored) {
+        LOG_INFO("Uploaded %u of %u new cache entries to %s\n", uploaded, stored, render_cache.url);
+    }
+}
+
+bool build_site(Site* site, Manifest* manifest, Pool* pool, Arena* scratch) {
+    DIR* dir = opendir(CONTENT_DIR);
     if (!dir) {
         fprintf(stderr, "Failed to open content directory: %s\n", CONTENT_DIR);
-        return 1;
+        return false;
     }
 
-    Arena arena = arena_create(KB(16));
-
     struct dirent* entry;
     while ((entry = readdir(dir)) != NULL) {
         const char* dname = entry->d_name;
+        if (entry->d_type == DT_DIR && strcmp(dname, ".") != 0 && strcmp(dname, "..") != 0) {
+            site_add_collection(site, dname);
+        }
+    }
+    closedir(dir);
+
+    for (u32 i = 0; i < site->config_count; ++i) {
+        bool found = false;
+        for (u32 j = 0; j < site->collection_count && !found; ++j) {
+            found = strcmp(site->collections[j].name, site->configs[i].name) == 0;
+        }
+        if (!found) {
+            LOG_WARN("%s lists %s, which isn't in %s\n", CONFIG_PATH, site->configs[i].name,
+                     CONTENT_DIR);
+        }
+    }
+
+    bool ok =
+        build_collections(site->collections, site->collection_count, manifest, pool, scratch);
+    arena_clear(scratch);
+    ok = ok && build_search_index(site, manifest, pool, scratch);
+    arena_clear(scratch);
+    ok = ok && build_sitemap(site, manifest, scratch);
+    arena_clear(scratch);
+    report_render_cache();
+
+    // Unless we're watching, the pages aren't needed once the site is built
+    if (!opts.watch) {
+        for (u32 i = 0; i < site->collection_count; ++i) {
+            Collection* c = &site->collections[i];
+            LOG_INFO("Arena high-water mark for %s: %.1f KB\n", c->name, c->arena.peak / 1024.0);
+            arena_release(&c->arena);
+            arena_release(&c->page_arena);
+        }
+    }
+    return ok;
+}
+
+#define STYLES_PATH "./styles.css"
+
+/// @brief Everything --watch keeps resident between rebuilds
+typedef struct {
+    Site* site;
+    Manifest* manifest;
+    Pool* pool;
+    Arena* scratch; // cleared after every batch of changes
+    Arena styles; // the last styles.css read from disk
+    i32 fd; // inotify instance, -1 when polling
+    i32 root_watch;
+    i32 content_watch;
+    i64 styles_mtime; // only used when polling
+    bool assets_changed; // set by inotify events, handled once per batch
+    u32 changes; // files handled in the current batch
+} Watcher;
+
+i64 collection_find_page(const Collection* c, const char* name) {
+    for (u32 i = 0; i < c->page_count; ++i) {
+        if (strcmp(c->pages[i].source_name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/// @brief Delete the output of a page that was removed or renamed (and its sidecars)
+void remove_page_output(const Collection* c, const Page* page, Manifest* manifest) {
+    char path[MKSITE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.html", c->dst_path, page->slug.data);
+    remove_output(path);
+    manifest_forget(manifest, path);
+}
+
+/// @brief Re-import (or drop) one page of `c`, then rebuild it and the collection's index
+bool watch_page_changed(Watcher* w, Collection* c, const char* name) {
+    ++w->changes;
+    const i64 idx = collection_find_page(c, name);
+
+    char src_path[MKSITE_PATH_MAX];
+    snprintf(src_path, sizeof(src_path), "%s/%s", c->src_path, name);
+
+    Page fresh;
+    const bool exists = access(src_path, F_OK) == 0;
+    if (exists && !import_page(&c->arena, c->src_path, name, &fresh)) {
+        // Most likely a half-finished edit, keep serving the last good version
+        LOG_WARN("Keeping the previous output of %s\n", src_path);
+        return true;
+    }
+    if (!exists) {
+        if (idx < 0) {
+            return true;
+        }
+        LOG_INFO("Removed %s\n", src_path);
+        remove_page_output(c, &c->pages[idx], w->manifest);
+        c->pages[idx] = c->pages[--c->page_count];
+        // The array is the only thing in its arena, so dropping the last slot is just this
+        c->page_arena.used -= sizeof(Page);
+        // Nothing to render for the page itself, but its neighbours now link past it
+        return build_collection_pages(c, 0, 0, w->manifest, w->pool, w->scratch) &&
+               build_collection_index(c, w->manifest, w->pool, w->scratch);
+    }
+
+    u32 page_idx;
+    if (idx >= 0) {
+        page_idx = (u32)idx;
+        if (strcmp(c->pages[page_idx].slug.data, fresh.slug.data) != 0) {
+            remove_page_output(c, &c->pages[page_idx], w->manifest);
+        }
+    } else {
+        Page* page = arena_push(&c->page_arena, sizeof(Page), _Alignof(Page));
+        if (c->page_count == 0) {
+            c->pages = page;
+        }
+        assert(page == &c->pages[c->page_count]);
+        page_idx = c->page_count++;
+    }
+    c->pages[page_idx] = fresh;
+
+    LOG_INFO("Rebuilding %s\n", src_path);
+    if (!build_collection_pages(c, page_idx, 1, w->manifest, w->pool, w->scratch)) {
+        return false;
+    }
+    return build_collection_index(c, w->manifest, w->pool, w->scratch);
+}
+
+/// @brief Re-import `c` from scratch once edits have left most of its arena unreachable
+bool watch_compact(Watcher* w, Collection* c) {
+    if (c->arena.used < 2 * c->imported_size + MB(64)) {
+        return true;
+    }
+    arena_clear(&c->arena);
+    return build_collection(c, w->manifest, w->pool, w->scratch);
+}
+
+/// @brief Re-render every page and index, for changes that show up in all of them
+bool watch_rebuild_all(Watcher* w) {
+    bool ok = true;
+    for (u32 i = 0; i < w->site->collection_count; ++i) {
+        Collection* c = &w->site->collections[i];
+        ok = build_collection_pages(c, 0, c->page_count, w->manifest, w->pool, w->scratch) &&
+             build_collection_index(c, w->manifest, w->pool, w->scratch) && ok;
+    }
+    return ok;
+}
+
+/// @brief Watch every directory under assets/, including ones that just appeared
+void watch_asset_dirs(Watcher* w) {
+#if defined(__linux__)
+    if (w->fd < 0) {
+        return;
+    }
+    // Adding a watch that already exists just returns it, so this is safe to repeat
+    const char* dirs = (const char*)assets.dirs.base;
+    for (u64 at = 0; at < assets.dirs_len; at += strlen(dirs + at) + 1) {
+        if (inotify_add_watch(w->fd, dirs + at, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+            LOG_WARN("Failed to watch %s\n", dirs + at);
+        }
+    }
+#else
+    (void)w;
+#endif
+}
+
+bool watch_styles_changed(Watcher* w) {
+    ++w->changes;
+    arena_clear(&w->styles);
+
+    u64 len = 0;
+    i64 mtime = 0;
+    const char* data = read_file(&w->styles, STYLES_PATH, &len, &mtime);
+    if (!data) {
+        LOG_WARN("Failed to read %s, keeping the previous styles\n", STYLES_PATH);
+        return true;
+    }
+
+    LOG_INFO("Styles changed, rebuilding every page\n");
+    site_css = (const u8*)data;
+    site_css_len = len;
+    w->manifest->styles_hash = styles_hash();
+    return install_stylesheet(w->scratch) && watch_rebuild_all(w);
+}
+
+/// @brief Bring public/ in line with assets/, and every page if the favicon's URL changed
+bool watch_assets_changed(Watcher* w) {
+    u32 copied = 0;
+    bool ok = install_assets(w->manifest, w->pool, w->scratch, &copied);
+    watch_asset_dirs(w);
+    w->changes += copied;
+
+    const u64 hash = styles_hash();
+    if (hash != w->manifest->styles_hash) {
+        LOG_INFO("Favicon moved to %s, rebuilding every page\n", favicon_href);
+        w->manifest->styles_hash = hash;
+        ok = watch_rebuild_all(w) && ok;
+    }
+    return ok;
+}
+
+#if defined(__linux__)
+void watch_collection(Watcher* w, Collection* c) {
+    c->watch_id = inotify_add_watch(
+        w->fd, c->src_path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    if (c->watch_id < 0) {
+        LOG_WARN("Failed to watch %s\n", c->src_path);
+    }
+}
+
+bool watch_handle_event(Watcher* w, const struct inotify_event* ev) {
+    if (ev->len == 0) {
+        return true;
+    }
+    const char* name = ev->name;
+
+    if (ev->wd == w->root_watch) {
+        return strcmp(name, "styles.css") != 0 || watch_styles_changed(w);
+    }
+    if (ev->wd == w->content_watch) {
+        if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+            for (u32 i = 0; i < w->site->collection_count; ++i) {
+                if (strcmp(w->site->collections[i].name, name) == 0) {
+                    return true;
+                }
+            }
+            LOG_INFO("New collection: %s\n", name);
+            Collection* c = site_add_collection(w->site, name);
+            watch_collection(w, c);
+            return build_collection(c, w->manifest, w->pool, w->scratch);
+        }
+        return true;
+    }
+
+    for (u32 i = 0; i < w->site->collection_count; ++i) {
+        Collection* c = &w->site->collections[i];
+        if (c->watch_id == ev->wd) {
+            if (!is_page_source(name)) {
+                return true;
+            }
+            return watch_page_changed(w, c, name) && watch_compact(w, c);
+        }
+    }
+
+    // Everything else being watched is a directory under assets/. Files only count once
+    // written, but a new directory may already have files in it.
+    if (!(ev->mask & IN_CREATE) || (ev->mask & IN_ISDIR)) {
+        w->assets_changed = true;
+    }
+    return true;
+}
+
+/// @brief Handle one batch of inotify events, skipping repeats of the same file
+bool watch_read_events(Watcher* w) {
+    _Alignas(struct inotify_event) char events[64 * 1024];
+    const ssize_t len = read(w->fd, events, sizeof(events));
+    if (len <= 0) {
+        return len == 0 || errno == EINTR || errno == EAGAIN;
+    }
+
+    bool ok = true;
+    for (char* p = events; p < events + len;) {
+        const struct inotify_event* ev = (const struct inotify_event*)p;
+        bool repeat = false;
+        for (char* q = events; q < p && !repeat;) {
+            const struct inotify_event* prev = (const struct inotify_event*)q;
+            repeat = prev->wd == ev->wd && prev->len == ev->len &&
+                     (ev->len == 0 || strcmp(prev->name, ev->name) == 0);
+            q += sizeof(struct inotify_event) + prev->len;
+        }
+        if (!repeat) {
+            ok = watch_handle_event(w, ev) && ok;
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+
+    if (w->assets_changed) {
+        w->assets_changed = false;
+        ok = watch_assets_changed(w) && ok;
+    }
+    return ok;
+}
+#endif
+
+i64 file_mtime(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? stat_mtime_ns(&st) : 0;
+}
+
+/// @brief Fallback for platforms without inotify: compare modification times on a timer
+bool watch_poll(Watcher* w) {
+    bool ok = true;
+
+    const i64 styles_mtime = file_mtime(STYLES_PATH);
+    if (styles_mtime != w->styles_mtime) {
+        w->styles_mtime = styles_mtime;
+        ok = watch_styles_changed(w) && ok;
+    }
+
+    // The manifest knows every asset's size and mtime, so this only copies what changed
+    ok = watch_assets_changed(w) && ok;
+
+    for (u32 i = 0; i < w->site->collection_count; ++i) {
+        Collection* c = &w->site->collections[i];
 
-        if (strcmp(dname, ".") == 0 || strcmp(dname, "..") == 0) {
+        // Pages whose source is gone
+        for (u32 j = 0; j < c->page_count;) {
+            char path[MKSITE_PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", c->src_path, c->pages[j].source_name);
+            if (access(path, F_OK) != 0) {
+                char name[MKSITE_PATH_MAX];
+                snprintf(name, sizeof(name), "%s", c->pages[j].source_name);
+                ok = watch_page_changed(w, c, name) && ok;
+            } else {
+                ++j;
+            }
+        }
+
+        // New and modified pages
+        DIR* dir = opendir(c->src_path);
+        if (!dir) {
             continue;
         }
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!is_page_source(entry->d_name)) {
+                continue;
+            }
+            char path[MKSITE_PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", c->src_path, entry->d_name);
+            const i64 idx = collection_find_page(c, entry->d_name);
+            if (idx < 0 || c->pages[idx].source_mtime != file_mtime(path)) {
+                ok = watch_page_changed(w, c, entry->d_name) && ok;
+            }
+        }
+        closedir(dir);
+        ok = watch_compact(w, c) && ok;
+    }
+    return ok;
+}
 
-        if (entry->d_type == DT_DIR) {
-            char src_path[PATH_MAX];
-            char dst_path[PATH_MAX];
-            snprintf(src_path, PATH_MAX, "%s/%s", CONTENT_DIR, dname);
-            snprintf(dst_path, PATH_MAX, "%s/%s", PUBLIC_DIR, dname);
+/// @brief Keep the site resident and rebuild only what changes, until the process is killed
+void watch_site(Site* site, Manifest* manifest, Pool* pool, Arena* scratch) {
+    Watcher w = {
+        .site = site,
+        .manifest = manifest,
+        .pool = pool,
+        .scratch = scratch,
+        .styles = arena_create(MB(64)),
+        .fd = -1,
+        .styles_mtime = file_mtime(STYLES_PATH),
+    };
 
-            Page* pages = NULL;
-            u32 page_count = import_pages(src_path, &arena, &pages);
+#if defined(__linux__)
+    w.fd = inotify_init1(IN_CLOEXEC);
+    if (w.fd >= 0) {
+        const u32 mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+        w.root_watch = inotify_add_watch(w.fd, ".", mask);
+        watch_asset_dirs(&w);
+        w.content_watch = inotify_add_watch(w.fd, CONTENT_DIR, IN_CREATE | IN_MOVED_TO);
+        for (u32 i = 0; i < site->collection_count; ++i) {
+            watch_collection(&w, &site->collections[i]);
+        }
+    } else {
+        LOG_WARN("inotify unavailable, falling back to polling\n");
+    }
+#endif
 
-            if (page_count == 0) {
-                LOG_ERROR("Failed to import pages from %s\n", src_path);
-                arena_release(&arena);
-                closedir(dir);
-                return 1;
+    LOG_INFO("Watching %s, %s and %s for changes\n", CONTENT_DIR, ASSET_DIR, STYLES_PATH);
+    for (;;) {
+        if (w.fd >= 0) {
+            struct pollfd pfd = {.fd = w.fd, .events = POLLIN};
+            if (poll(&pfd, 1, -1) <= 0) {
+                continue;
             }
+        } else {
+            usleep(200 * 1000);
+        }
+
+        struct timespec t_start, t_end;
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+#if defined(__linux__)
+        const bool ok = w.fd >= 0 ? watch_read_events(&w) : watch_poll(&w);
+#else
+        const bool ok = watch_poll(&w);
+#endif
+        if (!ok) {
+            LOG_ERROR("Rebuild failed, waiting for the next change\n");
+        }
+        if (w.changes > 0) {
+            build_search_index(site, manifest, pool, scratch);
+            build_sitemap(site, manifest, scratch);
+            report_render_cache();
+            manifest_save(manifest);
+        }
+        arena_clear(scratch);
+
+        clock_gettime(CLOCK_MONOTONIC, &t_end);
+        double elapsed_ms =
+            (t_end.tv_sec - t_start.tv_sec) * 1000.0 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6;
+        if (w.changes > 0) {
+            printf("Rebuilt in %.3f ms\n", elapsed_ms);
+            fflush(stdout);
+            w.changes = 0;
+        }
+    }
+}
+
+#ifndef MKSITE_NO_MAIN
+int main(int argc, char** argv) {
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
 
-            if (access(dst_path, F_OK) == -1) {
-                if (mkdir(dst_path, 0755) == -1) {
-                    LOG_ERROR("Failed to create directory: %s\n", dst_path);
-                    arena_release(&arena);
-                    closedir(dir);
+    site_css = styles_css;
+    site_css_len = styles_css_len;
+
+    const long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    opts.jobs = online_cpus > 0 ? (u32)online_cpus : 1;
+    opts.stream_above = STREAM_ABOVE_DEFAULT;
+    opts.feed_size = FEED_SIZE_DEFAULT;
+
+    for (i32 i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--force") == 0) {
+            opts.force = true;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            opts.mmap = true;
+        } else if (strcmp(argv[i], "--inline-css") == 0) {
+            opts.inline_css = true;
+        } else if (strcmp(argv[i], "--precompress") == 0) {
+            if (!compression_available()) {
+                LOG_ERROR("--precompress needs mksite to be built with zlib or brotli\n");
+                return 1;
+            }
+            opts.precompress = true;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            opts.watch = true;
+        } else if (strcmp(argv[i], "--archives") == 0) {
+            opts.archives = true;
+        } else if (strcmp(argv[i], "--fingerprint") == 0) {
+            opts.fingerprint = true;
+        } else if (strcmp(argv[i], "--per-page") == 0 && i + 1 < argc) {
+            const i32 per_page = atoi(argv[++i]);
+            if (per_page < 1) {
+                LOG_ERROR("--per-page expects a positive number, got %s\n", argv[i]);
+                return 1;
+            }
+            opts.per_page = (u32)per_page;
+        } else if (strcmp(argv[i], "--feed-size") == 0 && i + 1 < argc) {
+            const i32 feed_size = atoi(argv[++i]);
+            if (feed_size < 1) {
+                LOG_ERROR("--feed-size expects a positive number, got %s\n", argv[i]);
+                return 1;
+            }
+            opts.feed_size = (u32)feed_size;
+        } else if (strcmp(argv[i], "--stream-above") == 0 && i + 1 < argc) {
+            char* suffix = NULL;
+            u64 limit = strtoull(argv[++i], &suffix, 10);
+            switch (*suffix) {
+                case 'k':
+                case 'K':
+                    limit *= KB(1);
+                    break;
+                case 'm':
+                case 'M':
+                    limit *= MB(1);
+                    break;
+                case 'g':
+                case 'G':
+                    limit *= GB(1);
+                    break;
+                case '\0':
+                    break;
+                default:
+                    LOG_ERROR("--stream-above expects a size like 64M, got %s\n", argv[i]);
                     return 1;
-                }
             }
-
-            if (!build_pages(dst_path, pages, page_count)) {
-                LOG_ERROR("Failed to build pages to %s\n", dst_path);
-                arena_release(&arena);
-                closedir(dir);
+            opts.stream_above = limit;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            opts.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache-url") == 0 && i + 1 < argc) {
+            if (!cache_remote_available()) {
+                LOG_ERROR("--cache-url needs mksite to be built with libcurl\n");
                 return 1;
             }
-
-            // If we're processing the `posts` directory, also build an index.html
-            if (strcmp(dname, "posts") == 0) {
-                qsort(pages, page_count, sizeof(Page), compare_pages_desc);
-                build_index(pages, page_count);
+            opts.cache_url = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            opts.trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            const i32 jobs = atoi(argv[++i]);
+            if (jobs < 1) {
+                LOG_ERROR("--jobs expects a positive number, got %s\n", argv[i]);
+                return 1;
             }
+            opts.jobs = (u32)jobs;
+        } else {
+            LOG_ERROR("Unknown option: %s\n", argv[i]);
+            fprintf(
+                stderr,
+                "Usage: %s [--force] [--jobs N] [--mmap] [--inline-css] [--precompress] "
+                "[--watch] [--per-page N] [--archives] [--feed-size N] [--fingerprint] "
+                "[--stream-above SIZE] [--cache DIR [--cache-url URL]] "
+                "[--trace FILE.json|FILE.csv]\n",
+                argv[0]);
+            return 1;
         }
+    }
+
+    if (opts.trace_path) {
+        trace_init();
+    }
+
+    if (opts.cache_url && !opts.cache_dir) {
+        LOG_ERROR("--cache-url needs a --cache directory to fetch into\n");
+        return 1;
+    }
+    // The header usually carries a token, so it comes from the environment instead of argv
+    if (opts.cache_dir &&
+        !cache_open(&render_cache, opts.cache_dir, opts.cache_url, getenv("MKSITE_CACHE_HEADER"))) {
+        return 1;
+    }
+
+    u64 t = trace_begin();
+    if (!prepare_public_dir()) {
+        return 1;
+    }
+    trace_end("prepare_public_dir", NULL, t);
+
+    t = trace_begin();
+    Manifest manifest = {0};
+    manifest_load(&manifest);
+    trace_end("manifest_load", NULL, t);
+
+    // Only address space is reserved here; memory is committed as the arena grows
+    Arena scratch = arena_create(GB(64));
+
+    Arena pool_arena = arena_create(MB(1));
+    Pool pool;
+    pool_create(&pool, &pool_arena, opts.jobs);
+
+    t = trace_begin();
+    assets = (Assets){
+        .arena = arena_create(GB(1)),
+        .list = arena_create(GB(1)),
+        .dirs = arena_create(MB(64)),
+    };
+    u32 assets_copied = 0;
+    if (!install_assets(&manifest, &pool, &scratch, &assets_copied)) {
+        return 1;
+    }
+    // Pages link to the favicon, which may have just been fingerprinted
+    manifest.styles_hash = styles_hash();
+    trace_end("install_assets", NULL, t);
+
+    t = trace_begin();
+    if (!install_stylesheet(&scratch)) {
+        return 1;
+    }
+    trace_end("install_stylesheet", NULL, t);
+    arena_clear(&scratch);
 
-        // We can clear the arena after each directory is processed
-        arena_clear(&arena);
+    Site site = {.arena = arena_create(GB(1))};
+    if (!site_load_config(&site, &scratch)) {
+        return 1;
+    }
+    arena_clear(&scratch);
+    if (!build_site(&site, &manifest, &pool, &scratch)) {
+        return 1;
     }
 
-    arena_release(&arena);
+    t = trace_begin();
+    remove_unseen_outputs(&manifest);
+    manifest_save(&manifest);
+    trace_end("manifest_save", NULL, t);
 
     clock_gettime(CLOCK_MONOTONIC, &t_end);
     double elapsed_ms =
         (t_end.tv_sec - t_start.tv_sec) * 1000.0 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6;
     printf("Site built in %.3f ms\n", elapsed_ms);
 
+    if (opts.trace_path) {
+        trace_counter("arena_peak", "scratch", scratch.peak);
+        trace_counter("arena_peak", "manifest", manifest.arena.peak);
+        trace_counter("highlight_cache", "hits", atomic_load(&highlight_cache.hits));
+        trace_counter("highlight_cache", "misses", atomic_load(&highlight_cache.misses));
+        for (u32 i = 0; i < pool.worker_count; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "worker %u", i);
+            trace_counter("arena_peak", name, pool.workers[i].scratch.peak);
+        }
+        if (!trace_write(opts.trace_path, &scratch)) {
+            LOG_ERROR("Failed to write trace to %s\n", opts.trace_path);
+        }
+    }
+
+    if (opts.watch) {
+        fflush(stdout);
+        // --force only applies to the initial build
+        opts.force = false;
+        watch_site(&site, &manifest, &pool, &scratch);
+    }
+
+    arena_release(&site.arena);
+    arena_release(&scratch);
+
+    pool_destroy(&pool);
+    arena_release(&pool_arena);
+
+    arena_release(&manifest.arena);
+
     return 0;
 }
+#endif // MKSITE_NO_MAIN
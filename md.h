@@ -0,0 +1,952 @@
+#ifndef MD_H
+#define MD_H
+
+#include <string.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "highlight.h"
+#include "html.h"
+#include "scan.h"
+
+/// @brief Markdown for page content, parsed in one pass into a flat array of nodes and then
+/// rendered in a second pass over that array.
+///
+/// Containers (block quotes, lists and their items, footnote definitions) open and close
+/// around the blocks inside them, so the array reads like the HTML it becomes. Text nodes
+/// point straight into the source. Footnote definitions are gathered while parsing, so a
+/// reference can be rendered before the definition it points to has been reached.
+///
+/// Every line is looked at once by the parser and once more by the inline renderer, and
+/// nesting is capped at MD_MAX_DEPTH, so unclosed markers and deep nesting stay linear.
+typedef enum {
+    MD_PARAGRAPH,
+    MD_PARAGRAPH_END,
+    MD_TEXT, // one line of a paragraph
+    MD_HEADING, // `level` is 1-6, the text is inline
+    MD_CODE, // fenced code, the text is the info string
+    MD_CODE_LINE,
+    MD_CODE_END,
+    MD_QUOTE,
+    MD_QUOTE_END,
+    MD_LIST, // `level` is 1 for ordered lists, which start at `len`
+    MD_LIST_END, // `level` as for MD_LIST
+    MD_ITEM,
+    MD_ITEM_END,
+    MD_FOOTNOTE, // the text is the label
+    MD_FOOTNOTE_END,
+} MdKind;
+
+typedef struct {
+    u8 kind;
+    u8 level;
+    u32 len;
+    const char* text;
+} MdNode;
+
+// Containers nested deeper than this are read as text
+#define MD_MAX_DEPTH 32
+// Longest footnote label, anything longer isn't a footnote
+#define MD_MAX_LABEL 64
+
+typedef struct {
+    Str label; // copied into the arena, so it outlives a streamed window
+    u32 number; // 1-based, in the order of the definitions
+    bool referenced; // the first reference carries the id the backlink points to
+    bool rendered; // later definitions with the same label are dropped
+} MdFootnote;
+
+/// @brief Footnote labels of one page, kept in a hash table so references are O(1)
+typedef struct {
+    Arena* arena;
+    MdFootnote* items;
+    u32 count;
+    u32* slots; // open addressing, 1 + index into `items`, 0 when empty
+    u32 mask;
+} MdFootnotes;
+
+typedef struct {
+    u8 kind;
+    u8 marker; // lists: '-', '*' or '+', or '.' or ')' after a number
+    u32 indent; // items and footnotes: columns their content is indented by
+} MdContainer;
+
+typedef struct {
+    Arena* arena;
+    MdNode* nodes;
+    u32 count;
+    u32 cap;
+    MdFootnotes* footnotes;
+
+    MdContainer containers[MD_MAX_DEPTH];
+    u32 depth;
+    bool in_paragraph;
+    bool in_code;
+    char fence_char;
+    u32 fence_len;
+    u32 fence_indent;
+} MdParser;
+
+void md_footnotes_init(MdFootnotes* f, Arena* arena) {
+    *f = (MdFootnotes){.arena = arena};
+}
+
+static u64 md_hash(const char* text, u32 len) {
+    u64 hash = 0xcbf29ce484222325ull;
+    for (u32 i = 0; i < len; ++i) {
+        hash = (hash ^ (u8)text[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static u32* md_footnote_slot(const MdFootnotes* f, const char* label, u32 len) {
+    for (u32 i = (u32)md_hash(label, len) & f->mask;; i = (i + 1) & f->mask) {
+        const u32 slot = f->slots[i];
+        if (!slot) {
+            return &f->slots[i];
+        }
+        const Str other = f->items[slot - 1].label;
+        if (other.len == len && memcmp(other.data, label, len) == 0) {
+            return &f->slots[i];
+        }
+    }
+}
+
+MdFootnote* md_footnote_find(const MdFootnotes* f, const char* label, u32 len) {
+    if (!f->count) {
+        return NULL;
+    }
+    const u32 slot = *md_footnote_slot(f, label, len);
+    return slot ? &f->items[slot - 1] : NULL;
+}
+
+/// @brief Add `label` unless it's already there, returns its footnote either way
+MdFootnote* md_footnote_add(MdFootnotes* f, const char* label, u32 len) {
+    MdFootnote* existing = md_footnote_find(f, label, len);
+    if (existing) {
+        return existing;
+    }
+
+    // Keep the table at most half full, doubling both arrays as needed
+    if (2 * (f->count + 1) > f->mask + 1 || !f->slots) {
+        const u32 cap = f->slots ? 2 * (f->mask + 1) : 16;
+        MdFootnote* items = arena_push(f->arena, sizeof(MdFootnote) * cap / 2, ALIGNMENT);
+        if (f->count) {
+            memcpy(items, f->items, sizeof(MdFootnote) * f->count);
+        }
+        f->items = items;
+        f->slots = arena_push(f->arena, sizeof(u32) * cap, ALIGNMENT);
+        memset(f->slots, 0, sizeof(u32) * cap);
+        f->mask = cap - 1;
+        for (u32 i = 0; i < f->count; ++i) {
+            const Str l = f->items[i].label;
+            *md_footnote_slot(f, l.data, l.len) = i + 1;
+        }
+    }
+
+    char* copy = arena_push(f->arena, len + 1, 1);
+    memcpy(copy, label, len);
+    copy[len] = '\0';
+    MdFootnote* note = &f->items[f->count];
+    *note = (MdFootnote){.label = {copy, len}, .number = f->count + 1};
+    ++f->count;
+    *md_footnote_slot(f, label, len) = f->count;
+    return note;
+}
+
+static bool md_label_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-'
+        || c == '_';
+}
+
+/// @brief Length of the label in a `^[label]` at `p`, 0 if there isn't one there
+u32 md_footnote_label(const char* p, const char* end) {
+    if (end - p < 4 || p[0] != '^' || p[1] != '[') {
+        return 0;
+    }
+    u32 len = 0;
+    while (p + 2 + len < end && len <= MD_MAX_LABEL && md_label_char(p[2 + len])) {
+        ++len;
+    }
+    const bool closed = p + 2 + len < end && p[2 + len] == ']';
+    return closed && len && len <= MD_MAX_LABEL ? len : 0;
+}
+
+void md_parser_init(MdParser* m, Arena* arena, MdFootnotes* footnotes, u64 source_len) {
+    *m = (MdParser){.arena = arena, .footnotes = footnotes};
+    // Most lines make a node or two, so most pages never have to grow the array
+    m->cap = (u32)(source_len / 32) + 64;
+    m->nodes = arena_push(arena, sizeof(MdNode) * m->cap, _Alignof(MdNode));
+}
+
+static void md_push(MdParser* m, u8 kind, u8 level, const char* text, u32 len) {
+    if (m->count == m->cap) {
+        // Grow in place while the array is the last thing in the arena
+        Arena* arena = m->arena;
+        if ((char*)arena->base + arena->used == (char*)(m->nodes + m->cap)) {
+            arena_push(arena, sizeof(MdNode) * m->cap, 1);
+        } else {
+            MdNode* nodes = arena_push(arena, sizeof(MdNode) * m->cap * 2, _Alignof(MdNode));
+            memcpy(nodes, m->nodes, sizeof(MdNode) * m->count);
+            m->nodes = nodes;
+        }
+        m->cap *= 2;
+    }
+    m->nodes[m->count++] = (MdNode){.kind = kind, .level = level, .len = len, .text = text};
+}
+
+static void md_close_paragraph(MdParser* m) {
+    if (m->in_paragraph) {
+        md_push(m, MD_PARAGRAPH_END, 0, NULL, 0);
+        m->in_paragraph = false;
+    }
+}
+
+/// @brief Close the open code block, paragraph and every container from `depth` in
+static void md_close_to(MdParser* m, u32 depth) {
+    if (m->in_code && depth < m->depth) {
+        md_push(m, MD_CODE_END, 0, NULL, 0);
+        m->in_code = false;
+    }
+    if (depth < m->depth) {
+        md_close_paragraph(m);
+    }
+    while (m->depth > depth) {
+        const MdContainer* c = &m->containers[--m->depth];
+        const bool ordered = c->kind == MD_LIST && (c->marker == '.' || c->marker == ')');
+        // Every container's end is the node kind right after its start
+        md_push(m, c->kind + 1, ordered, NULL, 0);
+    }
+}
+
+/// @brief How many containers are left once the unmatched ones close, a list whose item
+/// didn't continue closes too unless a new item is about to join it
+static u32 md_keep(const MdParser* m, u32 matched, bool new_item) {
+    if (!new_item && matched && m->containers[matched - 1].kind == MD_LIST) {
+        --matched;
+    }
+    return matched;
+}
+
+static void md_advance(const char** p, u32* col) {
+    *col = **p == '\t' ? (*col + 4) & ~3u : *col + 1;
+    ++*p;
+}
+
+/// @brief Skip up to `max` columns of whitespace, returns how many were skipped
+static u32 md_skip_indent(const char** p, const char* end, u32* col, u32 max) {
+    const u32 start = *col;
+    while (*p < end && (**p == ' ' || **p == '\t') && *col - start < max) {
+        md_advance(p, col);
+    }
+    return *col - start;
+}
+
+static bool md_is_blank(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    return p == end;
+}
+
+/// @brief Length of the list marker at `p` (`-`, `*`, `+`, `1.` or `1)`), 0 if there isn't one
+static u32 md_list_marker(const char* p, const char* end, u8* marker, u32* start) {
+    u32 len = 0;
+    if (p < end && (*p == '-' || *p == '*' || *p == '+')) {
+        *marker = (u8)*p;
+        len = 1;
+    } else {
+        u32 number = 0;
+        while (p + len < end && len < 9 && p[len] >= '0' && p[len] <= '9') {
+            number = number * 10 + (u32)(p[len++] - '0');
+        }
+        if (!len || p + len == end || (p[len] != '.' && p[len] != ')')) {
+            return 0;
+        }
+        *marker = (u8)p[len++];
+        *start = number;
+    }
+    // The marker has to be followed by whitespace, or end the line
+    if (p + len < end && p[len] != ' ' && p[len] != '\t') {
+        return 0;
+    }
+    return len;
+}
+
+/// @brief Length of the code fence at `p` (three or more backticks or tildes), 0 if none
+static u32 md_fence(const char* p, const char* end, char* fence_char) {
+    if (p == end || (*p != '`' && *p != '~')) {
+        return 0;
+    }
+    u32 len = 0;
+    while (p + len < end && p[len] == *p) {
+        ++len;
+    }
+    // The info string of a backtick fence can't have backticks, or it'd be inline code
+    if (len < 3 || (*p == '`' && memchr(p + len, '`', end - p - len))) {
+        return 0;
+    }
+    *fence_char = *p;
+    return len;
+}
+
+static void md_push_text(MdParser* m, const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        ++p;
+    }
+    if (!m->in_paragraph) {
+        md_push(m, MD_PARAGRAPH, 0, NULL, 0);
+        m->in_paragraph = true;
+    }
+    md_push(m, MD_TEXT, 0, p, (u32)(end - p));
+}
+
+/// @brief Parse one line of content, without its newline
+void md_parse_line(MdParser* m, const char* line, u32 len) {
+    const char* p = line;
+    const char* end = line + len;
+    u32 col = 0;
+
+    // See how many of the open containers this line continues
+    u32 matched = 0;
+    for (; matched < m->depth; ++matched) {
+        const MdContainer* c = &m->containers[matched];
+        if (c->kind == MD_LIST) {
+            continue; // lists go on as long as their items do
+        }
+        const char* q = p;
+        u32 q_col = col;
+        if (c->kind == MD_QUOTE) {
+            md_skip_indent(&q, end, &q_col, 3);
+            if (q == end || *q != '>') {
+                break;
+            }
+            md_advance(&q, &q_col);
+            if (q < end && (*q == ' ' || *q == '\t')) {
+                md_advance(&q, &q_col);
+            }
+        } else if (!md_is_blank(p, end) && md_skip_indent(&q, end, &q_col, c->indent) < c->indent) {
+            break;
+        }
+        p = q;
+        col = q_col;
+    }
+    const bool all_matched = matched == m->depth;
+
+    if (m->in_code) {
+        if (all_matched) {
+            const char* q = p;
+            u32 q_col = col;
+            char fence_char = 0;
+            const bool indented = md_skip_indent(&q, end, &q_col, 4) > 3;
+            const u32 fence = indented ? 0 : md_fence(q, end, &fence_char);
+            if (fence >= m->fence_len && fence_char == m->fence_char &&
+                md_is_blank(q + fence, end)) {
+                md_push(m, MD_CODE_END, 0, NULL, 0);
+                m->in_code = false;
+                return;
+            }
+            md_skip_indent(&p, end, &col, m->fence_indent);
+            md_push(m, MD_CODE_LINE, 0, p, (u32)(end - p));
+            return;
+        }
+        md_push(m, MD_CODE_END, 0, NULL, 0);
+        m->in_code = false;
+    }
+
+    // Open whatever new containers the line starts with
+    bool opened = false;
+    for (;;) {
+        const char* q = p;
+        u32 q_col = col;
+        const u32 indent = md_skip_indent(&q, end, &q_col, 4);
+        if (indent > 3 || q == end) {
+            break;
+        }
+
+        if (*q == '>') {
+            if (m->depth + 1 > MD_MAX_DEPTH) {
+                break;
+            }
+            md_close_to(m, md_keep(m, matched, false));
+            md_close_paragraph(m);
+            m->containers[m->depth++] = (MdContainer){.kind = MD_QUOTE};
+            md_push(m, MD_QUOTE, 0, NULL, 0);
+            md_advance(&q, &q_col);
+            if (q < end && (*q == ' ' || *q == '\t')) {
+                md_advance(&q, &q_col);
+            }
+            matched = m->depth;
+            opened = true;
+            p = q;
+            col = q_col;
+            continue;
+        }
+
+        u8 marker = 0;
+        u32 start = 1;
+        const u32 marker_len = md_list_marker(q, end, &marker, &start);
+        if (marker_len && m->depth + 2 <= MD_MAX_DEPTH) {
+            const bool empty = md_is_blank(q + marker_len, end);
+            const bool ordered = marker == '.' || marker == ')';
+            const u32 keep = md_keep(m, matched, true);
+            const MdContainer* outer = keep ? &m->containers[keep - 1] : NULL;
+            const bool next_item = outer && outer->kind == MD_LIST && outer->marker == marker;
+            // Only a non-empty bullet or an ordered list starting at 1 may cut a paragraph short
+            if (m->in_paragraph && !opened && !next_item && (empty || (ordered && start != 1))) {
+                break;
+            }
+            md_close_to(m, keep);
+            md_close_paragraph(m);
+            const MdContainer* list = m->depth ? &m->containers[m->depth - 1] : NULL;
+            if (list && list->kind == MD_LIST && list->marker != marker) {
+                md_close_to(m, m->depth - 1);
+                list = NULL;
+            }
+            if (!list || list->kind != MD_LIST) {
+                m->containers[m->depth++] = (MdContainer){.kind = MD_LIST, .marker = marker};
+                md_push(m, MD_LIST, ordered, NULL, start);
+            }
+
+            // The item's content lines up with the first thing after the marker
+            const u32 marker_col = q_col;
+            q += marker_len;
+            q_col += marker_len;
+            const char* content = q;
+            u32 content_col = q_col;
+            const u32 gap = md_skip_indent(&content, end, &content_col, 5);
+            if (empty || gap > 4) {
+                content = q < end ? q + 1 : q;
+                content_col = q_col + 1;
+            }
+            m->containers[m->depth++] = (MdContainer){
+                .kind = MD_ITEM,
+                .marker = marker,
+                .indent = content_col - marker_col + indent,
+            };
+            md_push(m, MD_ITEM, 0, NULL, 0);
+            matched = m->depth;
+            opened = true;
+            p = content;
+            col = content_col;
+            continue;
+        }
+
+        // Footnotes can't nest, definitions only start at the top level
+        const u32 label_len = md_footnote_label(q, end);
+        if (label_len && md_keep(m, matched, false) == 0 && q + label_len + 3 < end &&
+            q[label_len + 3] == ':') {
+            md_close_to(m, 0);
+            md_close_paragraph(m);
+            const MdFootnote* note = md_footnote_add(m->footnotes, q + 2, label_len);
+            m->containers[m->depth++] = (MdContainer){.kind = MD_FOOTNOTE, .indent = 4};
+            md_push(m, MD_FOOTNOTE, 0, note->label.data, note->label.len);
+            q += label_len + 4;
+            q_col += label_len + 4;
+            md_skip_indent(&q, end, &q_col, 1);
+            matched = m->depth;
+            opened = true;
+            p = q;
+            col = q_col;
+            continue;
+        }
+        break;
+    }
+
+    const bool blank = md_is_blank(p, end);
+    const char* q = p;
+    u32 q_col = col;
+    const u32 indent = md_skip_indent(&q, end, &q_col, 4);
+    char fence_char = 0;
+    const u32 fence = indent > 3 ? 0 : md_fence(q, end, &fence_char);
+
+    if (!opened && !all_matched) {
+        // A line that doesn't continue its containers still continues their paragraph
+        if (m->in_paragraph && !blank && !fence) {
+            md_push_text(m, p, end);
+            return;
+        }
+        md_close_to(m, md_keep(m, matched, false));
+    }
+
+    if (blank) {
+        md_close_paragraph(m);
+        return;
+    }
+
+    if (fence) {
+        md_close_paragraph(m);
+        const char* info = q + fence;
+        while (info < end && (*info == ' ' || *info == '\t')) {
+            ++info;
+        }
+        const char* info_end = info;
+        while (info_end < end && *info_end != ' ' && *info_end != '\t') {
+            ++info_end;
+        }
+        md_push(m, MD_CODE, 0, info, (u32)(info_end - info));
+        m->in_code = true;
+        m->fence_char = fence_char;
+        m->fence_len = fence;
+        m->fence_indent = indent;
+        return;
+    }
+
+    // Headings only start outside paragraphs, `#` on a continued line is just text
+    if (!m->in_paragraph && indent <= 3 && *q == '#') {
+        u32 level = 0;
+        while (q + level < end && q[level] == '#') {
+            ++level;
+        }
+        if (level <= 6) {
+            const char* text = q + level;
+            if (text < end && *text == ' ') {
+                ++text;
+            }
+            md_push(m, MD_HEADING, (u8)level, text, (u32)(end - text));
+            return;
+        }
+    }
+
+    md_push_text(m, p, end);
+}
+
+/// @brief Close everything still open at the end of the content
+void md_finish(MdParser* m) {
+    if (m->in_code) {
+        md_push(m, MD_CODE_END, 0, NULL, 0);
+        m->in_code = false;
+    }
+    md_close_paragraph(m);
+    md_close_to(m, 0);
+}
+
+/// @brief Parse all of `text` and close whatever is left open
+void md_parse(MdParser* m, const char* text, u64 len) {
+    const char* cursor = text;
+    const char* end = text + len;
+    while (cursor < end) {
+        const char* eol = memchr(cursor, '\n', end - cursor);
+        const u32 line_len = eol ? (u32)(eol - cursor) : (u32)(end - cursor);
+        md_parse_line(m, cursor, line_len);
+        cursor += eol ? line_len + 1 : line_len;
+    }
+    md_finish(m);
+}
+
+typedef enum {
+    FORMAT_NONE,
+    FORMAT_BOLD,
+    FORMAT_ITALIC,
+    FORMAT_HIGHLIGHT,
+    FORMAT_INLINE_CODE,
+    FORMAT_LINK,
+    FORMAT_FOOTNOTE,
+    FORMAT_HTML,
+    FORMAT_TYPE_COUNT
+} FormatType;
+
+FormatType get_format_type(const char* text, u32 pos, u32 len) {
+    if (pos + 1 < len && text[pos] == '*' && text[pos + 1] == '*') {
+        return FORMAT_BOLD;
+    } else if (pos + 1 < len && text[pos] == '_' && text[pos + 1] == '_') {
+        return FORMAT_ITALIC;
+    } else if (pos + 1 < len && text[pos] == '=' && text[pos + 1] == '=') {
+        return FORMAT_HIGHLIGHT;
+    } else if (text[pos] == '`' && pos + 1 < len && text[pos + 1] != '`') {
+        return FORMAT_INLINE_CODE;
+    } else if (text[pos] == '[') {
+        return FORMAT_LINK;
+    } else if (text[pos] == '^') {
+        return FORMAT_FOOTNOTE;
+    } else if (text[pos] == '&' || text[pos] == '<' || text[pos] == '>') {
+        return FORMAT_HTML;
+    }
+    return FORMAT_NONE;
+}
+
+// Longest entity passed through as-is, like &hellip; or &#x2014;
+#define MD_MAX_ENTITY 32
+
+/// @brief Length of the character reference at `p` (`&amp;`, `&#8617;`...), 0 if there isn't one
+static u32 md_entity(const char* p, const char* end) {
+    u32 len = 1;
+    while (p + len < end && len < MD_MAX_ENTITY &&
+           (md_label_char(p[len]) || (len == 1 && p[len] == '#'))) {
+        ++len;
+    }
+    return len > 1 && p + len < end && p[len] == ';' ? len + 1 : 0;
+}
+
+static void md_toggle(Buf* out, bool* open, const char* start_tag, const char* end_tag) {
+    buf_str(out, *open ? end_tag : start_tag);
+    *open = !*open;
+}
+
+/// @brief Render one line of inline Markdown: **bold**, __italic__, ==highlight==, `code`,
+/// [links](url) and ^[n] footnote references. Formatting still open at the end is closed.
+void md_write_inline(Buf* out, const char* text, u32 len, MdFootnotes* footnotes, bool in_link) {
+    bool in_bold = false;
+    bool in_italic = false;
+    bool in_highlight = false;
+    // Where the next ], ) and > are, so a line full of [ or < doesn't keep scanning to the end
+    const char* bracket = text;
+    const char* paren = text;
+    const char* angle = text;
+
+    const char* end = text + len;
+    u32 i = 0;
+    while (i < len) {
+        // Copy the plain text up to the next marker in one go
+        const char* next = scan_inline_markers(text + i, end);
+        if (next != text + i) {
+            buf_write(out, text + i, next - (text + i));
+            i = (u32)(next - text);
+            if (i == len) {
+                break;
+            }
+        }
+
+        switch (get_format_type(text, i, len)) {
+            case FORMAT_BOLD:
+                md_toggle(out, &in_bold, "<strong>", "</strong>");
+                i += 2;
+                continue;
+            case FORMAT_ITALIC:
+                md_toggle(out, &in_italic, "<em>", "</em>");
+                i += 2;
+                continue;
+            case FORMAT_HIGHLIGHT:
+                md_toggle(out, &in_highlight, "<mark>", "</mark>");
+                i += 2;
+                continue;
+            case FORMAT_INLINE_CODE: {
+                // Without a closing backtick there's none further on either, so this stays linear
+                const char* close = memchr(text + i + 1, '`', len - (i + 1));
+                if (close) {
+                    u32 code_len = (u32)(close - (text + i + 1));
+                    buf_lit(out, "<code>");
+                    html_escape(out, text + i + 1, code_len);
+                    buf_lit(out, "</code>");
+                    i = (u32)(close - text) + 1;
+                } else {
+                    buf_char(out, text[i++]);
+                }
+                continue;
+            }
+            case FORMAT_LINK: {
+                if (bracket && bracket <= text + i) {
+                    bracket = memchr(text + i, ']', len - i);
+                }
+                const char* url = bracket ? bracket + 2 : NULL;
+                if (in_link || !url || url > end || bracket[1] != '(') {
+                    buf_char(out, text[i++]);
+                    continue;
+                }
+                if (paren && paren < url) {
+                    paren = memchr(url, ')', end - url);
+                }
+                if (!paren) {
+                    buf_char(out, text[i++]);
+                    continue;
+                }
+                buf_lit(out, "<a href=\"");
+                html_escape(out, url, (u32)(paren - url));
+                buf_lit(out, "\">");
+                const u32 label_len = (u32)(bracket - (text + i + 1));
+                md_write_inline(out, text + i + 1, label_len, footnotes, true);
+                buf_lit(out, "</a>");
+                i = (u32)(paren - text) + 1;
+                continue;
+            }
+            case FORMAT_FOOTNOTE: {
+                const u32 label_len = md_footnote_label(text + i, end);
+                MdFootnote* note =
+                    label_len ? md_footnote_find(footnotes, text + i + 2, label_len) : NULL;
+                if (!note) {
+                    buf_char(out, text[i++]);
+                    continue;
+                }
+                buf_lit(out, "<sup class=\"footnote-ref\"><a href=\"#fn-");
+                buf_write(out, note->label.data, note->label.len);
+                if (!note->referenced) {
+                    buf_lit(out, "\" id=\"fnref-");
+                    buf_write(out, note->label.data, note->label.len);
+                    note->referenced = true;
+                }
+                buf_lit(out, "\">");
+                buf_u32(out, note->number);
+                buf_lit(out, "</a></sup>");
+                i += label_len + 3;
+                continue;
+            }
+            case FORMAT_HTML: {
+                // Raw HTML tags and character references go through untouched, stray &, < and >
+                // are escaped
+                const char c = text[i];
+                const char next = i + 1 < len ? text[i + 1] : 0;
+                const bool tag_start = c == '<' &&
+                    ((next >= 'a' && next <= 'z') || (next >= 'A' && next <= 'Z') ||
+                     next == '/' || next == '!');
+                if (tag_start && angle && angle <= text + i) {
+                    angle = memchr(text + i, '>', len - i);
+                }
+                u32 raw = c == '&' ? md_entity(text + i, end) : 0;
+                if (tag_start && angle) {
+                    raw = (u32)(angle - (text + i)) + 1;
+                }
+                if (raw) {
+                    buf_write(out, text + i, raw);
+                    i += raw;
+                } else {
+                    const Str entity = HTML_ENTITIES[(u8)c];
+                    buf_write(out, entity.data, entity.len);
+                    ++i;
+                }
+                continue;
+            }
+            case FORMAT_NONE:
+            default:
+                buf_char(out, text[i++]);
+                break;
+        }
+    }
+
+    if (in_bold) {
+        buf_lit(out, "</strong>");
+    }
+    if (in_italic) {
+        buf_lit(out, "</em>");
+    }
+    if (in_highlight) {
+        buf_lit(out, "</mark>");
+    }
+}
+
+/// @brief State carried between calls to `md_render`, so nodes can be rendered in batches
+typedef struct {
+    Buf* out;
+    Arena* scratch; // holds `notes` and `code`, which can't go on `out`'s arena as it grows
+    Buf notes; // rendered footnote definitions, written after everything else
+    Buf* dst; // `out`, or `notes` inside a footnote definition
+    Buf code; // lines of the open code block while it's small enough to highlight whole
+    const HighlightLang* code_lang; // of the open code block, NULL to write it as plain text
+    HighlightState code_state; // of an open code block that outgrew `code`
+    bool code_streamed; // the open code block is highlighted a line at a time
+    MdFootnotes* footnotes;
+    Str note_label; // of the footnote definition being rendered
+    u32 skip; // containers left to close in a duplicate footnote definition being dropped
+    u32 lines; // lines so far in the open paragraph
+    bool item_fresh; // nothing has been rendered in the innermost item yet
+    bool tight; // the open paragraph is an item's first, which goes without <p>
+    bool pending_newline; // an <li> or its leading text still needs to end its line
+} MdRenderer;
+
+/// @brief Start rendering into `out`. `scratch` should be some other arena than `out`'s, or
+/// whatever it holds stops `out` from growing in place.
+void md_renderer_init(MdRenderer* r, Buf* out, MdFootnotes* footnotes, Arena* scratch) {
+    *r = (MdRenderer){.out = out, .scratch = scratch, .dst = out, .footnotes = footnotes};
+}
+
+static bool md_is_container(u8 kind) {
+    return kind == MD_QUOTE || kind == MD_LIST || kind == MD_ITEM || kind == MD_FOOTNOTE;
+}
+
+static bool md_is_container_end(u8 kind) {
+    return kind == MD_QUOTE_END || kind == MD_LIST_END || kind == MD_ITEM_END ||
+        kind == MD_FOOTNOTE_END;
+}
+
+// Ends the line an item's text was left on before the next block starts
+static void md_block_break(MdRenderer* r) {
+    if (r->pending_newline) {
+        buf_char(r->dst, '\n');
+        r->pending_newline = false;
+    }
+    r->item_fresh = false;
+}
+
+/// @brief Render `count` nodes, carrying on from wherever the last call stopped
+void md_render(MdRenderer* r, const MdNode* nodes, u32 count) {
+    for (u32 n = 0; n < count; ++n) {
+        const MdNode* node = &nodes[n];
+        if (r->skip) {
+            r->skip += md_is_container(node->kind);
+            r->skip -= md_is_container_end(node->kind);
+            continue;
+        }
+
+        Buf* out = r->dst;
+        switch (node->kind) {
+            case MD_PARAGRAPH:
+                r->tight = r->item_fresh;
+                r->lines = 0;
+                if (r->tight) {
+                    r->pending_newline = false;
+                    r->item_fresh = false;
+                } else {
+                    md_block_break(r);
+                    buf_lit(out, "    <p>");
+                }
+                break;
+            case MD_TEXT:
+                if (r->lines++) {
+                    buf_char(out, ' ');
+                }
+                md_write_inline(out, node->text, node->len, r->footnotes, false);
+                break;
+            case MD_PARAGRAPH_END:
+                if (r->tight) {
+                    r->pending_newline = true;
+                } else {
+                    buf_lit(out, "</p>\n");
+                }
+                break;
+            case MD_HEADING:
+                md_block_break(r);
+                buf_lit(out, "<h");
+                buf_u32(out, node->level);
+                buf_char(out, '>');
+                md_write_inline(out, node->text, node->len, r->footnotes, false);
+                buf_lit(out, "</h");
+                buf_u32(out, node->level);
+                buf_lit(out, ">\n");
+                break;
+            case MD_CODE:
+                md_block_break(r);
+                buf_lit(out, "    <pre><code");
+                if (node->len) {
+                    buf_lit(out, " class=\"language-");
+                    html_escape(out, node->text, node->len);
+                    buf_char(out, '"');
+                }
+                buf_char(out, '>');
+                // Blocks are gathered to be highlighted through the cache, up to the point where
+                // holding them whole would cost more than lexing them again
+                r->code_lang = highlight_language(node->text, node->len);
+                if (r->code_lang) {
+                    if (!r->code.arena) {
+                        r->code = buf_create(r->scratch, KB(1));
+                    }
+                    r->code.len = 0;
+                    r->code_state = (HighlightState){0};
+                    r->code_streamed = false;
+                }
+                break;
+            case MD_CODE_LINE:
+                if (!r->code_lang) {
+                    html_escape(out, node->text, node->len);
+                    buf_char(out, '\n');
+                    break;
+                }
+                if (!r->code_streamed && r->code.len + node->len < HIGHLIGHT_SNIPPET_MAX) {
+                    buf_write(&r->code, node->text, node->len);
+                    buf_char(&r->code, '\n');
+                    break;
+                }
+                if (!r->code_streamed) {
+                    const char* end = r->code.data + r->code.len;
+                    for (const char* line = r->code.data; line < end;) {
+                        const char* eol = memchr(line, '\n', end - line);
+                        highlight_line(out, r->code_lang, &r->code_state, line, eol - line);
+                        buf_char(out, '\n');
+                        line = eol + 1;
+                    }
+                    r->code.len = 0;
+                    r->code_streamed = true;
+                }
+                highlight_line(out, r->code_lang, &r->code_state, node->text, node->len);
+                buf_char(out, '\n');
+                break;
+            case MD_CODE_END:
+                if (r->code_streamed) {
+                    highlight_finish(out, &r->code_state);
+                } else if (r->code_lang) {
+                    highlight_cached(out, r->code_lang, r->code.data, r->code.len);
+                }
+                r->code_lang = NULL;
+                buf_lit(out, "</code></pre>\n");
+                break;
+            case MD_QUOTE:
+                md_block_break(r);
+                buf_lit(out, "    <blockquote>\n");
+                break;
+            case MD_QUOTE_END:
+                md_block_break(r);
+                buf_lit(out, "    </blockquote>\n");
+                break;
+            case MD_LIST:
+                md_block_break(r);
+                if (!node->level) {
+                    buf_lit(out, "    <ul>\n");
+                } else if (node->len == 1) {
+                    buf_lit(out, "    <ol>\n");
+                } else {
+                    buf_lit(out, "    <ol start=\"");
+                    buf_u32(out, node->len);
+                    buf_lit(out, "\">\n");
+                }
+                break;
+            case MD_LIST_END:
+                md_block_break(r);
+                buf_str(out, node->level ? "    </ol>\n" : "    </ul>\n");
+                break;
+            case MD_ITEM:
+                md_block_break(r);
+                buf_lit(out, "    <li>");
+                r->pending_newline = true;
+                r->item_fresh = true;
+                break;
+            case MD_FOOTNOTE: {
+                MdFootnote* note = md_footnote_find(r->footnotes, node->text, node->len);
+                if (note->rendered) {
+                    r->skip = 1;
+                    break;
+                }
+                note->rendered = true;
+                md_block_break(r);
+                if (!r->notes.arena) {
+                    r->notes = buf_create(r->scratch, KB(1));
+                }
+                out = r->dst = &r->notes;
+                buf_lit(out, "    <li id=\"fn-");
+                buf_write(out, node->text, node->len);
+                buf_lit(out, "\">");
+                r->note_label = (Str){node->text, node->len};
+                r->pending_newline = true;
+                r->item_fresh = true;
+                break;
+            }
+            case MD_ITEM_END:
+            case MD_FOOTNOTE_END:
+                if (!r->pending_newline) {
+                    buf_lit(out, "    ");
+                } else if (node->kind == MD_FOOTNOTE_END) {
+                    buf_char(out, ' ');
+                }
+                if (node->kind == MD_FOOTNOTE_END) {
+                    buf_lit(out, "<a href=\"#fnref-");
+                    buf_write(out, r->note_label.data, r->note_label.len);
+                    buf_lit(out, "\" class=\"footnote-backref\">&#8617;</a>");
+                    r->dst = r->out;
+                }
+                buf_lit(out, "</li>\n");
+                r->pending_newline = false;
+                r->item_fresh = false;
+                break;
+        }
+    }
+}
+
+/// @brief Write out the footnotes once all the content has been rendered
+void md_render_finish(MdRenderer* r) {
+    md_block_break(r);
+    if (r->notes.len) {
+        Buf* out = r->out;
+        buf_lit(out, "    <section class=\"footnotes\">\n    <ol>\n");
+        buf_write(out, r->notes.data, r->notes.len);
+        buf_lit(out, "    </ol>\n    </section>\n");
+    }
+}
+
+#endif // MD_H
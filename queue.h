@@ -0,0 +1,154 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "arena.h"
+#include "base.h"
+
+/// @brief Bounded lock-free queue of u64s for any number of producers and consumers.
+///
+/// Every cell carries a sequence number that says whether it's ready to be written or read on
+/// the current lap around the ring (Vyukov's bounded MPMC queue), so pushes and pops only
+/// contend on their own index. Producers close the queue once they're done, consumers drain it
+/// until `queue_pop_wait` reports it closed and empty. A consumer that keeps finding the queue
+/// empty goes to sleep on a condition variable, which pushes only touch while someone sleeps.
+typedef struct {
+    _Atomic u32 sequence;
+    u64 value;
+} QueueCell;
+
+typedef struct {
+    QueueCell* cells;
+    u32 mask; // capacity - 1, the capacity is a power of 2
+    _Alignas(64) _Atomic u32 head; // next cell to push to
+    _Alignas(64) _Atomic u32 tail; // next cell to pop from
+    _Alignas(64) atomic_bool closed;
+    _Atomic u32 sleepers; // consumers waiting on `ready`, or about to
+    pthread_mutex_t mutex;
+    pthread_cond_t ready; // signalled by pushes and closing while there are sleepers
+} Queue;
+
+void queue_init(Queue* q, Arena* arena, u32 capacity) {
+    assert(capacity && (capacity & (capacity - 1)) == 0);
+    q->cells = arena_push(arena, sizeof(QueueCell) * capacity, ALIGNMENT);
+    q->mask = capacity - 1;
+    for (u32 i = 0; i < capacity; ++i) {
+        atomic_init(&q->cells[i].sequence, i);
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, false);
+    atomic_init(&q->sleepers, 0);
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->ready, NULL);
+}
+
+void queue_destroy(Queue* q) {
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->mutex);
+}
+
+/// @brief Wake a sleeping consumer, if there is one, after a push
+void queue_wake(Queue* q) {
+    // Pairs with the fence in `queue_pop_wait`: either the sleeper sees the new value or this
+    // sees the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&q->sleepers, memory_order_relaxed)) {
+        pthread_mutex_lock(&q->mutex);
+        pthread_cond_signal(&q->ready);
+        pthread_mutex_unlock(&q->mutex);
+    }
+}
+
+/// @brief Add `value`, returns false if the queue is full
+bool queue_push(Queue* q, u64 value) {
+    u32 pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        QueueCell* cell = &q->cells[pos & q->mask];
+        const u32 seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const i32 diff = (i32)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->value = value;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                queue_wake(q);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // still holds a value from the previous lap
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+/// @brief Take the oldest value, returns false if the queue is empty
+bool queue_pop(Queue* q, u64* value) {
+    u32 pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        QueueCell* cell = &q->cells[pos & q->mask];
+        const u32 seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        const i32 diff = (i32)(seq - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *value = cell->value;
+                atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // not written on this lap yet
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+/// @brief Tell consumers nothing more is coming
+void queue_close(Queue* q) {
+    atomic_store_explicit(&q->closed, true, memory_order_release);
+    pthread_mutex_lock(&q->mutex);
+    pthread_cond_broadcast(&q->ready);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/// @brief Take the oldest value, waiting for one if needed. Returns false once closed and empty.
+bool queue_pop_wait(Queue* q, u64* value) {
+    for (u32 spins = 0;; ++spins) {
+        if (queue_pop(q, value)) {
+            return true;
+        }
+        // Everything pushed before closing is visible now, so one more try settles it
+        if (atomic_load_explicit(&q->closed, memory_order_acquire)) {
+            return queue_pop(q, value);
+        }
+        if (spins < 64) {
+            continue;
+        }
+        if (spins < 128) {
+            sched_yield();
+            continue;
+        }
+
+        // Still nothing, so the producers are slow (reading from a slow disk, say) and spinning
+        // on would only take a core from them
+        pthread_mutex_lock(&q->mutex);
+        atomic_fetch_add_explicit(&q->sleepers, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        const bool got = queue_pop(q, value);
+        if (!got && !atomic_load_explicit(&q->closed, memory_order_acquire)) {
+            pthread_cond_wait(&q->ready, &q->mutex);
+        }
+        atomic_fetch_sub_explicit(&q->sleepers, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&q->mutex);
+        if (got) {
+            return true;
+        }
+        spins = 0;
+    }
+}
+
+#endif // QUEUE_H
@@ -0,0 +1,290 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "base.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Bytes that can start an inline format marker: **bold**, __italic__, ==highlight==, `code`,
+// [links](url) and ^[n] footnote references, plus the bytes HTML cares about (&, < and >), which
+// are escaped unless they belong to raw HTML. Everything else in a line is copied through as-is.
+// clang-format off
+static const u8 INLINE_MARKER[256] = {
+    ['*'] = 1,
+    ['_'] = 1,
+    ['='] = 1,
+    ['`'] = 1,
+    ['^'] = 1,
+    ['['] = 1,
+    ['&'] = 1,
+    ['<'] = 1,
+    ['>'] = 1,
+};
+// clang-format on
+
+static inline const char* scan_inline_markers_scalar(const char* p, const char* end) {
+    while (p < end && !INLINE_MARKER[(u8)*p]) {
+        ++p;
+    }
+    return p;
+}
+
+/// @brief Find the first inline marker byte in [p, end), or `end` if there is none.
+///
+/// To keep the vector loop short, < = > come from one compare of `v | 3` against '?', and
+/// ^ _ from one against '_'. That also stops at '?', '\\' and ']', which callers just copy.
+const char* scan_inline_markers(const char* p, const char* end) {
+#if defined(__AVX2__)
+    const __m256i three = _mm256_set1_epi8(3);
+    const __m256i angles = _mm256_set1_epi8('?'); // < = > ?
+    const __m256i under = _mm256_set1_epi8('_'); // \ ] ^ _
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i tick = _mm256_set1_epi8('`');
+    const __m256i bracket = _mm256_set1_epi8('[');
+    const __m256i amp = _mm256_set1_epi8('&');
+    while (end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        const __m256i low = _mm256_or_si256(v, three);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(low, angles), _mm256_cmpeq_epi8(low, under));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, star));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, tick));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bracket));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+        const u32 mask = (u32)_mm256_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i angles = _mm_set1_epi8('?'); // < = > ?
+    const __m128i under = _mm_set1_epi8('_'); // \ ] ^ _
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i tick = _mm_set1_epi8('`');
+    const __m128i bracket = _mm_set1_epi8('[');
+    const __m128i amp = _mm_set1_epi8('&');
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)p);
+        const __m128i low = _mm_or_si128(v, three);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(low, angles), _mm_cmpeq_epi8(low, under));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, star));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, tick));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bracket));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+        const u32 mask = (u32)_mm_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#elif defined(__ARM_NEON)
+    while (end - p >= 16) {
+        const uint8x16_t v = vld1q_u8((const u8*)p);
+        const uint8x16_t low = vorrq_u8(v, vdupq_n_u8(3));
+        uint8x16_t m = vorrq_u8(vceqq_u8(low, vdupq_n_u8('?')), vceqq_u8(low, vdupq_n_u8('_')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('*')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('`')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('[')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('&')));
+        // Narrow each byte of the mask to a nibble, giving a 64-bit mask with 4 bits per byte
+        const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+        const u64 mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+        p += 16;
+    }
+#endif
+    return scan_inline_markers_scalar(p, end);
+}
+
+// Bytes that have to be escaped in HTML text and attribute values
+// clang-format off
+static const u8 HTML_SPECIAL[256] = {
+    ['&'] = 1,
+    ['<'] = 1,
+    ['>'] = 1,
+    ['"'] = 1,
+};
+// clang-format on
+
+static inline const char* scan_html_special_scalar(const char* p, const char* end) {
+    while (p < end && !HTML_SPECIAL[(u8)*p]) {
+        ++p;
+    }
+    return p;
+}
+
+/// @brief Find the first byte in [p, end) that HTML needs escaped, or `end` if there is none
+const char* scan_html_special(const char* p, const char* end) {
+#if defined(__AVX2__)
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i quote = _mm256_set1_epi8('"');
+    while (end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, lt));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, gt));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+        const u32 mask = (u32)_mm256_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quote = _mm_set1_epi8('"');
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, gt));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+        const u32 mask = (u32)_mm_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#elif defined(__ARM_NEON)
+    while (end - p >= 16) {
+        const uint8x16_t v = vld1q_u8((const u8*)p);
+        uint8x16_t m = vorrq_u8(vceqq_u8(v, vdupq_n_u8('&')), vceqq_u8(v, vdupq_n_u8('<')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('>')));
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('"')));
+        const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+        const u64 mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (mask) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+        p += 16;
+    }
+#endif
+    return scan_html_special_scalar(p, end);
+}
+
+// Bytes that make up search terms: ASCII letters and digits, and everything from 0x80 up so
+// UTF-8 stays whole. 0x20 is set for the bytes it lowercases.
+// clang-format off
+static const u8 TERM_CHAR[256] = {
+    ['0' ... '9'] = 1,
+    ['a' ... 'z'] = 1,
+    ['A' ... 'Z'] = 1 | 0x20,
+    [0x80 ... 0xff] = 1,
+};
+// clang-format on
+
+static inline u64 scan_terms_scalar(const char* p, char* folded, u64* markup) {
+    u64 mask = 0;
+    *markup = 0;
+    for (u32 i = 0; i < 64; ++i) {
+        const u8 c = TERM_CHAR[(u8)p[i]];
+        folded[i] = (char)(p[i] | (c & 0x20));
+        mask |= (u64)(c & 1) << i;
+        *markup |= (u64)(p[i] == '<' || p[i] == '&' || p[i] == ']') << i;
+    }
+    return mask;
+}
+
+/// @brief Lowercase the 64 bytes at `p` into `folded`, returning a mask with bit i set if
+/// byte i belongs to a search term. `markup` gets the bytes that can start something that
+/// isn't text: '<' for tags, '&' for entities and ']' for the destination of a link.
+///
+/// Ranges are checked with one unsigned compare each, by subtracting the start of the range,
+/// since SSE2 and AVX2 only compare signed bytes.
+u64 scan_terms(const char* p, char* folded, u64* markup) {
+#if defined(__AVX2__)
+    const __m256i digit = _mm256_set1_epi8('0');
+    const __m256i upper = _mm256_set1_epi8('A');
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i bracket = _mm256_set1_epi8(']');
+    u64 mask = 0;
+    *markup = 0;
+    for (u32 i = 0; i < 64; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        const __m256i d = _mm256_sub_epi8(v, digit);
+        const __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+        const __m256i u = _mm256_sub_epi8(v, upper);
+        const __m256i is_upper = _mm256_cmpeq_epi8(_mm256_min_epu8(u, _mm256_set1_epi8(25)), u);
+        const __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, case_bit), _mm256_set1_epi8('a'));
+        const __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(25)), l);
+        const __m256i fold = _mm256_or_si256(v, _mm256_and_si256(is_upper, case_bit));
+        _mm256_storeu_si256((__m256i*)(folded + i), fold);
+        // Bytes from 0x80 up already have their top bit set, which is all movemask looks at
+        const __m256i term = _mm256_or_si256(_mm256_or_si256(is_digit, is_alpha), v);
+        mask |= (u64)(u32)_mm256_movemask_epi8(term) << i;
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, amp));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bracket));
+        *markup |= (u64)(u32)_mm256_movemask_epi8(m) << i;
+    }
+    return mask;
+#elif defined(__SSE2__)
+    const __m128i digit = _mm_set1_epi8('0');
+    const __m128i upper = _mm_set1_epi8('A');
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i bracket = _mm_set1_epi8(']');
+    u64 mask = 0;
+    *markup = 0;
+    for (u32 i = 0; i < 64; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        const __m128i d = _mm_sub_epi8(v, digit);
+        const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+        const __m128i u = _mm_sub_epi8(v, upper);
+        const __m128i is_upper = _mm_cmpeq_epi8(_mm_min_epu8(u, _mm_set1_epi8(25)), u);
+        const __m128i l = _mm_sub_epi8(_mm_or_si128(v, case_bit), _mm_set1_epi8('a'));
+        const __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(25)), l);
+        const __m128i fold = _mm_or_si128(v, _mm_and_si128(is_upper, case_bit));
+        _mm_storeu_si128((__m128i*)(folded + i), fold);
+        // Bytes from 0x80 up already have their top bit set, which is all movemask looks at
+        const __m128i term = _mm_or_si128(_mm_or_si128(is_digit, is_alpha), v);
+        mask |= (u64)(u32)_mm_movemask_epi8(term) << i;
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, amp));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bracket));
+        *markup |= (u64)(u32)_mm_movemask_epi8(m) << i;
+    }
+    return mask;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const u8 BITS[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t bits = vld1q_u8(BITS);
+    const uint8x16_t case_bit = vdupq_n_u8(0x20);
+    u64 mask = 0;
+    *markup = 0;
+    for (u32 i = 0; i < 64; i += 16) {
+        const uint8x16_t v = vld1q_u8((const u8*)p + i);
+        const uint8x16_t is_digit = vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(9));
+        const uint8x16_t is_upper = vcleq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(25));
+        const uint8x16_t l = vsubq_u8(vorrq_u8(v, case_bit), vdupq_n_u8('a'));
+        const uint8x16_t is_alpha = vcleq_u8(l, vdupq_n_u8(25));
+        vst1q_u8((u8*)folded + i, vorrq_u8(v, vandq_u8(is_upper, case_bit)));
+        uint8x16_t term = vorrq_u8(vorrq_u8(is_digit, is_alpha), vcgeq_u8(v, vdupq_n_u8(0x80)));
+        term = vandq_u8(term, bits);
+        const u64 lo = vaddv_u8(vget_low_u8(term));
+        const u64 hi = vaddv_u8(vget_high_u8(term));
+        mask |= (lo | hi << 8) << i;
+        uint8x16_t m = vorrq_u8(vceqq_u8(v, vdupq_n_u8('<')), vceqq_u8(v, vdupq_n_u8('&')));
+        m = vandq_u8(vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(']'))), bits);
+        const u64 m_lo = vaddv_u8(vget_low_u8(m));
+        const u64 m_hi = vaddv_u8(vget_high_u8(m));
+        *markup |= (m_lo | m_hi << 8) << i;
+    }
+    return mask;
+#else
+    return scan_terms_scalar(p, folded, markup);
+#endif
+}
+
+#endif // SCAN_H
@@ -0,0 +1,468 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "md.h"
+#include "scan.h"
+
+/// @brief Full-text search: the distinct terms of every page, gathered from its parsed
+/// Markdown, merged into an inverted index written as one file the client reads in place.
+///
+/// A term is a run of ASCII letters, digits and bytes from 0x80 up, so UTF-8 words stay whole,
+/// lowercased. Raw HTML tags, entities and link destinations aren't text and are skipped.
+/// Terms shorter than 2 or longer than SEARCH_TERM_MAX bytes are dropped.
+///
+/// The file has four sections after its header, all of them 4-byte aligned so the file can be
+/// used straight from memory, and every offset is from the start of the file:
+///
+///     pages     page_count SearchPageEntry, by page id
+///     terms     term_count SearchTermEntry, sorted by the bytes of the term for binary search
+///     strings   the terms in the same order, then each page's URL and title, unterminated
+///     postings  for each term the ids of its pages in ascending order, each as the LEB128
+///               varint of its difference from the one before (the first from 0)
+#define SEARCH_MAGIC "MKSI"
+#define SEARCH_VERSION 1
+#define SEARCH_TERM_MAX 32
+
+typedef struct {
+    char magic[4];
+    u32 version;
+    u32 page_count;
+    u32 term_count;
+    u32 pages; // offsets of each section
+    u32 terms;
+    u32 strings;
+    u32 postings;
+    u32 size; // of the whole file
+} SearchHeader;
+
+typedef struct {
+    u32 url; // relative to the site root, like "posts/hi-mom.html"
+    u32 url_len;
+    u32 title; // as written in the front matter, not escaped
+    u32 title_len;
+} SearchPageEntry;
+
+typedef struct {
+    u32 text;
+    u32 len;
+    u32 postings;
+    u32 page_count; // varints at `postings`
+} SearchTermEntry;
+
+// Term text is zero padded to a multiple of 8 bytes, so terms compare a word at a time
+#define SEARCH_PADDED(len) ALIGN_UP_POW2(len, 8)
+
+typedef struct {
+    u64 hash;
+    const char* text; // SEARCH_PADDED(len) bytes
+    u32 len;
+} SearchTerm;
+
+/// @brief The distinct terms of one page, in the order they first appear
+typedef struct {
+    Arena* arena;
+    SearchTerm* items;
+    u32 count;
+    u32* slots; // open addressing, 1 + index into `items`, 0 when empty
+    u32 mask;
+    // Reused by every call to `search_add_text`
+    char* folded; // the text lowercased, padded so terms can be read 8 bytes at a time
+    u64* masks; // a bit per byte of the text, set for the bytes of its terms
+    u64 fold_cap;
+} SearchTerms;
+
+/// @brief One page of the index
+typedef struct {
+    Str url;
+    Str title;
+    const SearchTerm* terms;
+    u32 term_count;
+} SearchDoc;
+
+void search_terms_init(SearchTerms* t, Arena* arena) {
+    *t = (SearchTerms){.arena = arena};
+}
+
+static bool search_same(const SearchTerm* term, const char* text, u32 len, u64 hash) {
+    if (term->hash != hash || term->len != len) {
+        return false;
+    }
+    for (u32 i = 0; i < len; i += 8) {
+        u64 a, b;
+        memcpy(&a, term->text + i, 8);
+        memcpy(&b, text + i, 8);
+        if (a != b) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static u32* search_slot(
+    u32* slots,
+    u32 mask,
+    const SearchTerm* items,
+    const char* text,
+    u32 len,
+    u64 hash) {
+    for (u32 i = (u32)hash & mask;; i = (i + 1) & mask) {
+        const u32 slot = slots[i];
+        if (!slot) {
+            return &slots[i];
+        }
+        if (search_same(&items[slot - 1], text, len, hash)) {
+            return &slots[i];
+        }
+    }
+}
+
+/// @brief Add the already lowercased and padded `text` unless the page has it already
+void search_terms_add(SearchTerms* t, const char* text, u32 len, u64 hash) {
+    if (t->slots) {
+        const u32* slot = search_slot(t->slots, t->mask, t->items, text, len, hash);
+        if (*slot) {
+            return;
+        }
+    }
+
+    // Keep the table at most half full, doubling both arrays as needed
+    if (2 * (t->count + 1) > t->mask + 1 || !t->slots) {
+        const u32 cap = t->slots ? 2 * (t->mask + 1) : 256;
+        SearchTerm* items = arena_push(t->arena, sizeof(SearchTerm) * cap / 2, ALIGNMENT);
+        if (t->count) {
+            memcpy(items, t->items, sizeof(SearchTerm) * t->count);
+        }
+        t->items = items;
+        t->slots = arena_push(t->arena, sizeof(u32) * cap, ALIGNMENT);
+        memset(t->slots, 0, sizeof(u32) * cap);
+        t->mask = cap - 1;
+        for (u32 i = 0; i < t->count; ++i) {
+            const SearchTerm* item = &t->items[i];
+            *search_slot(t->slots, t->mask, t->items, item->text, item->len, item->hash) = i + 1;
+        }
+    }
+
+    char* copy = arena_push(t->arena, SEARCH_PADDED(len), 8);
+    memcpy(copy, text, SEARCH_PADDED(len));
+    t->items[t->count] = (SearchTerm){.hash = hash, .text = copy, .len = len};
+    *search_slot(t->slots, t->mask, t->items, copy, len, hash) = ++t->count;
+}
+
+/// @brief Copy `count` terms into `arena`, text included
+SearchTerm* search_terms_copy(const SearchTerm* terms, u32 count, Arena* arena) {
+    SearchTerm* copy = arena_push(arena, sizeof(SearchTerm) * count, _Alignof(SearchTerm));
+    for (u32 i = 0; i < count; ++i) {
+        char* text = arena_push(arena, SEARCH_PADDED(terms[i].len), 8);
+        memcpy(text, terms[i].text, SEARCH_PADDED(terms[i].len));
+        copy[i] = (SearchTerm){.hash = terms[i].hash, .text = text, .len = terms[i].len};
+    }
+    return copy;
+}
+
+// Clear the bits of [from, to) in `masks`
+static void search_clear(u64* masks, u64 from, u64 to) {
+    for (; from < to && from % 64; ++from) {
+        masks[from / 64] &= ~(1ull << (from % 64));
+    }
+    for (; from + 64 <= to; from += 64) {
+        masks[from / 64] = 0;
+    }
+    for (; from < to; ++from) {
+        masks[from / 64] &= ~(1ull << (from % 64));
+    }
+}
+
+// Drop the bytes of the raw HTML tag, entity or link destination at `p`, if there is one,
+// from `masks`. Returns where the markup ends.
+static const char* search_clear_markup(
+    u64* masks,
+    const char* text,
+    const char* p,
+    const char* end) {
+    const char* from = p;
+    const char* to = p;
+    if (*p == '<' && p + 1 < end && (isalpha((u8)p[1]) || p[1] == '/' || p[1] == '!')) {
+        const char* close = memchr(p, '>', end - p);
+        to = close ? close + 1 : p;
+    } else if (*p == '&') {
+        const char* q = p + 1;
+        while (q < end && q - p <= 10 && (isalnum((u8)*q) || *q == '#')) {
+            ++q;
+        }
+        to = q < end && *q == ';' ? q + 1 : p;
+    } else if (*p == ']' && p + 1 < end && p[1] == '(') {
+        const char* close = memchr(p, ')', end - p);
+        to = close ? close + 1 : p;
+    }
+    if (to > from) {
+        search_clear(masks, (u64)(from - text), (u64)(to - text));
+    }
+    return to;
+}
+
+/// @brief Add every term of the Markdown inline text `text`.
+///
+/// The text is lowercased and classified 64 bytes at a time, then terms are read off the
+/// masks a whole run of bits at a time, so no byte goes through a branch of its own.
+void search_add_text(SearchTerms* t, const char* text, u64 len) {
+    const u64 blocks = (len + 63) / 64;
+    if (blocks * 64 + 64 > t->fold_cap) {
+        t->fold_cap = 2 * blocks * 64 + 64;
+        t->folded = arena_push(t->arena, t->fold_cap, ALIGNMENT);
+        t->masks = arena_push(t->arena, t->fold_cap / 64 * sizeof(u64), ALIGNMENT);
+    }
+    // Markup is rare, it's dealt with as each block turns up any
+    const char* end = text + len;
+    const char* skipped = text; // markup has been cleared up to here
+    for (u64 b = 0; b < blocks; ++b) {
+        u64 markup;
+        if (b < len / 64) {
+            t->masks[b] = scan_terms(text + 64 * b, t->folded + 64 * b, &markup);
+        } else {
+            // Zeros aren't term bytes, so the last term ends with the text
+            char tail[64] = {0};
+            memcpy(tail, text + 64 * b, len % 64);
+            t->masks[b] = scan_terms(tail, t->folded + 64 * b, &markup);
+            markup &= ~0ull >> (64 - len % 64);
+        }
+        // Markup found in an earlier block can run on into this one
+        if (skipped > text + 64 * b) {
+            const u64 to = (u64)(skipped - text);
+            search_clear(t->masks, 64 * b, to < 64 * b + 64 ? to : 64 * b + 64);
+        }
+        for (; markup; markup &= markup - 1) {
+            const char* p = text + 64 * b + __builtin_ctzll(markup);
+            if (p >= skipped) {
+                skipped = search_clear_markup(t->masks, text, p, end);
+            }
+        }
+    }
+
+    const u64* masks = t->masks;
+    for (u64 pos = 0;;) {
+        u64 b = pos / 64;
+        if (b >= blocks) {
+            break;
+        }
+        u64 bits = masks[b] & (~0ull << (pos % 64));
+        while (!bits && ++b < blocks) {
+            bits = masks[b];
+        }
+        if (!bits) {
+            break;
+        }
+        const u64 start = b * 64 + (u64)__builtin_ctzll(bits);
+        bits = ~masks[b] & (~0ull << (start % 64));
+        while (!bits && ++b < blocks) {
+            bits = ~masks[b];
+        }
+        pos = bits ? b * 64 + (u64)__builtin_ctzll(bits) : blocks * 64;
+
+        const u32 word_len = (u32)(pos - start);
+        if (word_len < 2 || word_len > SEARCH_TERM_MAX) {
+            continue;
+        }
+        u64 word[SEARCH_TERM_MAX / 8];
+        u64 hash = word_len;
+        for (u32 i = 0; i < word_len; i += 8) {
+            u64 chunk;
+            memcpy(&chunk, t->folded + start + i, 8);
+            if (word_len - i < 8) {
+                chunk &= ~0ull >> (64 - 8 * (word_len - i));
+            }
+            word[i / 8] = chunk;
+            hash = (hash ^ chunk) * 0x9e3779b97f4a7c15ull;
+            hash ^= hash >> 32;
+        }
+        search_terms_add(t, (const char*)word, word_len, hash);
+    }
+}
+
+/// @brief Add the terms of everything readable among `nodes`
+void search_add_nodes(SearchTerms* t, const MdNode* nodes, u32 count) {
+    for (u32 i = 0; i < count; ++i) {
+        const MdNode* node = &nodes[i];
+        if (node->kind == MD_TEXT || node->kind == MD_HEADING || node->kind == MD_CODE_LINE) {
+            search_add_text(t, node->text, node->len);
+        }
+    }
+}
+
+/// @brief A term of the whole index, with everything needed to lay out its postings
+typedef struct {
+    const SearchTerm* term;
+    u32 page_count;
+    u32 last; // page id last added, to take the next delta from
+    u32 size; // bytes of postings
+    u32 offset; // where the next posting goes while they're written
+} SearchEntry;
+
+static u32 search_varint_size(u32 value) {
+    u32 size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+static char* search_varint(char* p, u32 value) {
+    while (value >= 0x80) {
+        *p++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (char)value;
+    return p;
+}
+
+static int search_entry_compare(const void* a, const void* b) {
+    const SearchTerm* x = (*(const SearchEntry* const*)a)->term;
+    const SearchTerm* y = (*(const SearchEntry* const*)b)->term;
+    const int c = memcmp(x->text, y->text, x->len < y->len ? x->len : y->len);
+    return c ? c : (int)x->len - (int)y->len;
+}
+
+/// @brief Merge the terms of `docs` into an inverted index and append it to `out`.
+///
+/// Page ids are positions in `docs`. `arena` holds the merge tables until the caller clears it.
+/// Returns the number of distinct terms.
+u32 search_index_write(Buf* out, Arena* arena, const SearchDoc* docs, u32 doc_count) {
+    // Nothing but the entry array, so it can grow in place
+    Arena entry_arena = arena_create(GB(4));
+    SearchEntry* entries = (SearchEntry*)entry_arena.base;
+    u32 count = 0;
+    u32* slots = NULL;
+    u32 mask = 0;
+
+    // First pass: find every distinct term and the size of its postings
+    for (u32 d = 0; d < doc_count; ++d) {
+        for (u32 i = 0; i < docs[d].term_count; ++i) {
+            const SearchTerm* term = &docs[d].terms[i];
+            if (2 * (count + 1) > mask + 1 || !slots) {
+                const u32 cap = slots ? 2 * (mask + 1) : 4096;
+                slots = arena_push(arena, sizeof(u32) * cap, ALIGNMENT);
+                memset(slots, 0, sizeof(u32) * cap);
+                mask = cap - 1;
+                for (u32 j = 0; j < count; ++j) {
+                    u32 k = (u32)entries[j].term->hash & mask;
+                    while (slots[k]) {
+                        k = (k + 1) & mask;
+                    }
+                    slots[k] = j + 1;
+                }
+            }
+
+            u32 k = (u32)term->hash & mask;
+            for (; slots[k]; k = (k + 1) & mask) {
+                if (search_same(entries[slots[k] - 1].term, term->text, term->len, term->hash)) {
+                    break;
+                }
+            }
+            if (!slots[k]) {
+                SearchEntry* entry =
+                    arena_push(&entry_arena, sizeof(SearchEntry), _Alignof(SearchEntry));
+                assert(entry == &entries[count]);
+                *entry = (SearchEntry){.term = term};
+                slots[k] = ++count;
+            }
+            SearchEntry* entry = &entries[slots[k] - 1];
+            entry->size += search_varint_size(d - entry->last);
+            entry->last = d;
+            ++entry->page_count;
+        }
+    }
+
+    SearchEntry** order = arena_push(arena, sizeof(SearchEntry*) * (count ? count : 1), ALIGNMENT);
+    for (u32 i = 0; i < count; ++i) {
+        order[i] = &entries[i];
+    }
+    qsort(order, count, sizeof(SearchEntry*), search_entry_compare);
+
+    // Lay out the file
+    u32 offset = sizeof(SearchHeader);
+    const u32 pages_offset = offset;
+    offset += sizeof(SearchPageEntry) * doc_count;
+    const u32 terms_offset = offset;
+    offset += sizeof(SearchTermEntry) * count;
+    const u32 strings_offset = offset;
+    for (u32 i = 0; i < count; ++i) {
+        offset += entries[i].term->len;
+    }
+    for (u32 d = 0; d < doc_count; ++d) {
+        offset += docs[d].url.len + docs[d].title.len;
+    }
+    offset = (u32)ALIGN_UP_POW2(offset, 4);
+    const u32 postings_offset = offset;
+    for (u32 i = 0; i < count; ++i) {
+        SearchEntry* entry = order[i];
+        entry->offset = offset;
+        offset += entry->size;
+    }
+    const u32 size = offset;
+
+    buf_reserve(out, size);
+    char* base = out->data + out->len;
+    memset(base, 0, postings_offset);
+    SearchHeader* header = (SearchHeader*)base;
+    memcpy(header->magic, SEARCH_MAGIC, 4);
+    header->version = SEARCH_VERSION;
+    header->page_count = doc_count;
+    header->term_count = count;
+    header->pages = pages_offset;
+    header->terms = terms_offset;
+    header->strings = strings_offset;
+    header->postings = postings_offset;
+    header->size = size;
+
+    u32 text = strings_offset;
+    SearchTermEntry* term_entries = (SearchTermEntry*)(base + terms_offset);
+    for (u32 i = 0; i < count; ++i) {
+        SearchEntry* entry = order[i];
+        term_entries[i] = (SearchTermEntry){
+            .text = text,
+            .len = entry->term->len,
+            .postings = entry->offset,
+            .page_count = entry->page_count,
+        };
+        memcpy(base + text, entry->term->text, entry->term->len);
+        text += entry->term->len;
+        entry->last = 0;
+    }
+    SearchPageEntry* page_entries = (SearchPageEntry*)(base + pages_offset);
+    for (u32 d = 0; d < doc_count; ++d) {
+        page_entries[d] = (SearchPageEntry){.url = text, .url_len = docs[d].url.len};
+        memcpy(base + text, docs[d].url.data, docs[d].url.len);
+        text += docs[d].url.len;
+        page_entries[d].title = text;
+        page_entries[d].title_len = docs[d].title.len;
+        memcpy(base + text, docs[d].title.data, docs[d].title.len);
+        text += docs[d].title.len;
+    }
+
+    // Second pass: pages come in id order, so every term's postings come out ascending
+    for (u32 d = 0; d < doc_count; ++d) {
+        for (u32 i = 0; i < docs[d].term_count; ++i) {
+            const SearchTerm* term = &docs[d].terms[i];
+            u32 k = (u32)term->hash & mask;
+            for (;; k = (k + 1) & mask) {
+                if (search_same(entries[slots[k] - 1].term, term->text, term->len, term->hash)) {
+                    break;
+                }
+            }
+            SearchEntry* entry = &entries[slots[k] - 1];
+            entry->offset = (u32)(search_varint(base + entry->offset, d - entry->last) - base);
+            entry->last = d;
+        }
+    }
+    out->len += size;
+    arena_release(&entry_arena);
+    return count;
+}
+
+#endif // SEARCH_H
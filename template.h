@@ -0,0 +1,83 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <string.h>
+#include "base.h"
+#include "buf.h"
+
+/// @brief Page layouts from templates/, compiled by mksite-template-gen into static spans.
+///
+/// A template is a flat list of parts: literal spans, `{{name}}` holes filled from an array of
+/// `Str` indexed by `TemplateHole`, and `{{?name}}...{{/name}}` sections that are only written
+/// when the `name` hole is non-empty. Partials (`{{>name}}`) are inlined by the generator.
+typedef enum {
+    TEMPLATE_SPAN,
+    TEMPLATE_HOLE,
+    TEMPLATE_SECTION,
+} TemplatePartKind;
+
+typedef struct {
+    u8 kind;
+    u8 hole; // for holes and sections
+    u16 end; // for sections, index of the first part after `{{/name}}`
+    u32 len; // for spans
+    const char* text;
+} TemplatePart;
+
+typedef struct {
+    const TemplatePart* parts;
+    u32 count;
+} Template;
+
+// A hole set to TEMPLATE_DEFER makes `template_render` stop there, so the caller can write that
+// part of the output itself (like a page's content) and then carry on from the returned part
+const char TEMPLATE_DEFER_MARK[1] = {0};
+#define TEMPLATE_DEFER ((Str){TEMPLATE_DEFER_MARK, 0})
+
+/// @brief Write the parts of `t` from `part` up to the next deferred hole or the end.
+///
+/// Returns the part to continue from, which is `t->count` once everything has been written.
+u32 template_render(Buf* out, const Template* t, u32 part, const Str* holes) {
+    // Size the output first so it's reserved once, then gather the spans and holes into it
+    u64 total = 0;
+    u32 stop = part;
+    while (stop < t->count) {
+        const TemplatePart* p = &t->parts[stop];
+        if (p->kind == TEMPLATE_SPAN) {
+            total += p->len;
+            ++stop;
+        } else if (p->kind == TEMPLATE_SECTION) {
+            stop = holes[p->hole].len ? stop + 1 : p->end;
+        } else if (holes[p->hole].data == TEMPLATE_DEFER_MARK) {
+            break;
+        } else {
+            total += holes[p->hole].len;
+            ++stop;
+        }
+    }
+
+    buf_reserve(out, total);
+    char* dst = out->data + out->len;
+    for (u32 i = part; i < stop;) {
+        const TemplatePart* p = &t->parts[i];
+        if (p->kind == TEMPLATE_SPAN) {
+            memcpy(dst, p->text, p->len);
+            dst += p->len;
+            ++i;
+        } else if (p->kind == TEMPLATE_SECTION) {
+            i = holes[p->hole].len ? i + 1 : p->end;
+        } else {
+            const Str value = holes[p->hole];
+            if (value.len) {
+                memcpy(dst, value.data, value.len);
+                dst += value.len;
+            }
+            ++i;
+        }
+    }
+    out->len += total;
+
+    return stop < t->count ? stop + 1 : stop;
+}
+
+#endif // TEMPLATE_H
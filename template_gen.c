@@ -0,0 +1,340 @@
+// Compiles templates/*.html into templates.h, see template.h for the syntax
+//
+//     mksite-template-gen OUT.h TEMPLATE.html... [--renderer SOURCE...]
+//
+// Every template becomes a `Template TEMPLATE_<NAME>` of static spans and holes, and every hole
+// name used anywhere becomes a `TEMPLATE_HOLE_<NAME>`. Partials are inlined, so rendering never
+// looks anything up. The renderer's sources are only hashed, into `RENDERER_HASH`.
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "arena.h"
+#include "base.h"
+
+#define MAX_TEMPLATES 32
+#define MAX_PARTS 256
+#define MAX_HOLES 64
+#define MAX_DEPTH 8
+
+typedef enum {
+    PART_SPAN,
+    PART_HOLE,
+    PART_SECTION,
+} PartKind;
+
+typedef struct {
+    PartKind kind;
+    u32 hole;
+    u32 end;
+    u64 start; // spans, offset into the template's text pool
+    u64 len;
+} Part;
+
+typedef struct {
+    char name[64];
+    const char* source;
+    u64 source_len;
+
+    Part parts[MAX_PARTS];
+    u32 part_count;
+    u32 merge_from; // spans before this part can't grow, a section starts or ends after them
+    char* pool;
+    u64 pool_len;
+    u64 pool_cap;
+} TemplateFile;
+
+typedef struct {
+    Arena arena;
+    TemplateFile templates[MAX_TEMPLATES];
+    u32 template_count;
+    char holes[MAX_HOLES][64];
+    u32 hole_count;
+} Generator;
+
+static const char* read_whole_file(Arena* arena, const char* path, u64* len) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = (u64)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = arena_push(arena, *len + 1, 1);
+    *len = fread(data, 1, *len, f);
+    data[*len] = '\0';
+    fclose(f);
+    return data;
+}
+
+/// @brief FNV-1a over `len` bytes, continuing from `hash`
+static u64 fnv1a(const char* data, u64 len, u64 hash) {
+    for (u64 i = 0; i < len; ++i) {
+        hash = (hash ^ (u8)data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static u32 hole_index(Generator* g, const char* name, u64 len) {
+    for (u32 i = 0; i < g->hole_count; ++i) {
+        if (strlen(g->holes[i]) == len && memcmp(g->holes[i], name, len) == 0) {
+            return i;
+        }
+    }
+    if (g->hole_count == MAX_HOLES) {
+        LOG_ERROR("More than %u distinct holes\n", MAX_HOLES);
+        exit(1);
+    }
+    snprintf(g->holes[g->hole_count], sizeof(g->holes[0]), "%.*s", (int)len, name);
+    return g->hole_count++;
+}
+
+static Part* push_part(TemplateFile* t, PartKind kind) {
+    if (t->part_count == MAX_PARTS) {
+        LOG_ERROR("%s: more than %u parts\n", t->name, MAX_PARTS);
+        exit(1);
+    }
+    Part* part = &t->parts[t->part_count++];
+    *part = (Part){.kind = kind};
+    return part;
+}
+
+static void push_span(TemplateFile* t, const char* text, u64 len) {
+    if (len == 0) {
+        return;
+    }
+    if (t->pool_len + len > t->pool_cap) {
+        LOG_ERROR("%s: too much text after inlining partials\n", t->name);
+        exit(1);
+    }
+    memcpy(t->pool + t->pool_len, text, len);
+    // Text around an inlined partial ends up in one span
+    Part* last = t->part_count ? &t->parts[t->part_count - 1] : NULL;
+    if (last && last->kind == PART_SPAN && t->part_count - 1 >= t->merge_from) {
+        last->len += len;
+    } else {
+        Part* part = push_part(t, PART_SPAN);
+        part->start = t->pool_len;
+        part->len = len;
+    }
+    t->pool_len += len;
+}
+
+static TemplateFile* find_template(Generator* g, const char* name, u64 len) {
+    for (u32 i = 0; i < g->template_count; ++i) {
+        if (strlen(g->templates[i].name) == len && memcmp(g->templates[i].name, name, len) == 0) {
+            return &g->templates[i];
+        }
+    }
+    return NULL;
+}
+
+/// @brief Append the parts of `src` to `t`, inlining partials. Returns false on syntax errors.
+static bool compile(Generator* g, TemplateFile* t, const TemplateFile* src, u32 depth) {
+    if (depth > MAX_DEPTH) {
+        LOG_ERROR("%s: partials nest more than %u deep\n", t->name, MAX_DEPTH);
+        return false;
+    }
+
+    u32 open_sections[MAX_PARTS];
+    u32 open_count = 0;
+
+    const char* p = src->source;
+    const char* end = p + src->source_len;
+    while (p < end) {
+        const char* tag = strstr(p, "{{");
+        if (!tag) {
+            push_span(t, p, end - p);
+            break;
+        }
+        push_span(t, p, tag - p);
+
+        const char* close = strstr(tag + 2, "}}");
+        if (!close) {
+            LOG_ERROR("%s: unterminated {{\n", src->name);
+            return false;
+        }
+        const char sigil = tag[2];
+        const char* name = tag + 2 + (sigil == '?' || sigil == '/' || sigil == '>');
+        const u64 len = close - name;
+        for (u64 i = 0; i < len; ++i) {
+            if (!islower((u8)name[i]) && !isdigit((u8)name[i]) && name[i] != '_') {
+                LOG_ERROR("%s: bad tag {{%.*s}}\n", src->name, (int)(close - tag - 2), tag + 2);
+                return false;
+            }
+        }
+        p = close + 2;
+
+        if (sigil == '>') {
+            const TemplateFile* partial = find_template(g, name, len);
+            if (!partial) {
+                LOG_ERROR("%s: unknown partial %.*s\n", src->name, (int)len, name);
+                return false;
+            }
+            if (!compile(g, t, partial, depth + 1)) {
+                return false;
+            }
+        } else if (sigil == '?') {
+            Part* part = push_part(t, PART_SECTION);
+            part->hole = hole_index(g, name, len);
+            open_sections[open_count++] = t->part_count - 1;
+            t->merge_from = t->part_count;
+        } else if (sigil == '/') {
+            const u32 hole = hole_index(g, name, len);
+            if (open_count == 0 || t->parts[open_sections[open_count - 1]].hole != hole) {
+                LOG_ERROR("%s: {{/%.*s}} doesn't close a section\n", src->name, (int)len, name);
+                return false;
+            }
+            t->parts[open_sections[--open_count]].end = t->part_count;
+            t->merge_from = t->part_count;
+        } else {
+            Part* part = push_part(t, PART_HOLE);
+            part->hole = hole_index(g, name, len);
+        }
+    }
+
+    if (open_count) {
+        LOG_ERROR("%s: unclosed section\n", src->name);
+        return false;
+    }
+    return true;
+}
+
+static void write_upper(FILE* f, const char* name) {
+    for (; *name; ++name) {
+        fputc(toupper((u8)*name), f);
+    }
+}
+
+static void write_c_string(FILE* f, const char* text, u64 len) {
+    fputs("\"", f);
+    for (u64 i = 0; i < len; ++i) {
+        const u8 c = (u8)text[i];
+        if (c == '\n') {
+            // One source line per line of C keeps the generated file readable
+            fputs(i + 1 < len ? "\\n\"\n        \"" : "\\n", f);
+        } else if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7f || (c == '?' && i + 1 < len && text[i + 1] == '?')) {
+            fprintf(f, "\\%03o", c); // always three digits, so a following digit is safe
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputs("\"", f);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s OUT.h TEMPLATE.html... [--renderer SOURCE...]\n", argv[0]);
+        return 1;
+    }
+
+    static Generator g;
+    g.arena = arena_create(GB(1));
+
+    // FNV-1a over every template, so the manifest can tell when the layout changed
+    u64 hash = 0xcbf29ce484222325ull;
+    i32 i = 2;
+    for (; i < argc && strcmp(argv[i], "--renderer") != 0; ++i) {
+        if (g.template_count == MAX_TEMPLATES) {
+            LOG_ERROR("More than %u templates\n", MAX_TEMPLATES);
+            return 1;
+        }
+        TemplateFile* t = &g.templates[g.template_count++];
+        t->source = read_whole_file(&g.arena, argv[i], &t->source_len);
+        if (!t->source) {
+            LOG_ERROR("Failed to read %s\n", argv[i]);
+            return 1;
+        }
+        const char* base = strrchr(argv[i], '/');
+        base = base ? base + 1 : argv[i];
+        const char* dot = strrchr(base, '.');
+        const u64 name_len = dot ? (u64)(dot - base) : strlen(base);
+        snprintf(t->name, sizeof(t->name), "%.*s", (int)name_len, base);
+
+        hash = fnv1a(t->source, t->source_len, hash);
+    }
+
+    // and over the Markdown and highlighting code, which changes every page just as much
+    u64 renderer_hash = 0xcbf29ce484222325ull;
+    for (++i; i < argc; ++i) { // past "--renderer"
+        u64 len = 0;
+        const char* source = read_whole_file(&g.arena, argv[i], &len);
+        if (!source) {
+            LOG_ERROR("Failed to read %s\n", argv[i]);
+            return 1;
+        }
+        renderer_hash = fnv1a(source, len, renderer_hash);
+    }
+
+    for (u32 i = 0; i < g.template_count; ++i) {
+        TemplateFile* t = &g.templates[i];
+        // Plenty for any sane use of partials, push_span checks it anyway
+        u64 total = 0;
+        for (u32 j = 0; j < g.template_count; ++j) {
+            total += g.templates[j].source_len;
+        }
+        t->pool_cap = total * (MAX_DEPTH + 1);
+        t->pool = arena_push(&g.arena, t->pool_cap + 1, 1);
+        if (!compile(&g, t, t, 0)) {
+            return 1;
+        }
+    }
+
+    FILE* f = fopen(argv[1], "w");
+    if (!f) {
+        LOG_ERROR("Failed to write %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(f, "// Generated by mksite-template-gen from templates/, do not edit\n\n");
+    fprintf(f, "#ifndef TEMPLATES_H\n#define TEMPLATES_H\n\n#include \"template.h\"\n\n");
+    fprintf(f, "#define TEMPLATES_HASH 0x%016llxull\n", (unsigned long long)hash);
+    fprintf(f, "#define RENDERER_HASH 0x%016llxull\n\n", (unsigned long long)renderer_hash);
+
+    fprintf(f, "typedef enum {\n");
+    for (u32 i = 0; i < g.hole_count; ++i) {
+        fprintf(f, "    TEMPLATE_HOLE_");
+        write_upper(f, g.holes[i]);
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "    TEMPLATE_HOLE_COUNT\n} TemplateHole;\n");
+
+    for (u32 i = 0; i < g.template_count; ++i) {
+        const TemplateFile* t = &g.templates[i];
+        fprintf(f, "\nstatic const TemplatePart TEMPLATE_");
+        write_upper(f, t->name);
+        fprintf(f, "_PARTS[] = {\n");
+        for (u32 j = 0; j < t->part_count; ++j) {
+            const Part* part = &t->parts[j];
+            if (part->kind == PART_SPAN) {
+                const unsigned long long len = part->len;
+                fprintf(f, "    {TEMPLATE_SPAN, 0, 0, %llu,\n        ", len);
+                write_c_string(f, t->pool + part->start, part->len);
+                fprintf(f, "},\n");
+            } else {
+                fprintf(
+                    f,
+                    "    {%s, TEMPLATE_HOLE_",
+                    part->kind == PART_HOLE ? "TEMPLATE_HOLE" : "TEMPLATE_SECTION");
+                write_upper(f, g.holes[part->hole]);
+                fprintf(f, ", %u, 0, NULL},\n", part->end);
+            }
+        }
+        fprintf(f, "};\n\nconst Template TEMPLATE_");
+        write_upper(f, t->name);
+        fprintf(f, " = {TEMPLATE_");
+        write_upper(f, t->name);
+        fprintf(f, "_PARTS, %u};\n", t->part_count);
+    }
+
+    fprintf(f, "\n#endif // TEMPLATES_H\n");
+    if (fclose(f) != 0) {
+        LOG_ERROR("Failed to write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
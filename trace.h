@@ -0,0 +1,259 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "arena.h"
+#include "base.h"
+
+/// @brief Build tracing for --trace: timed spans per phase and per page, plus a few counters.
+///
+/// Spans are only recorded while `trace.enabled` is set, so the instrumented hot paths cost a
+/// branch when tracing is off. The result is written either as Chrome trace-event JSON (load it
+/// in chrome://tracing or Perfetto) or, for paths ending in `.csv`, as a per-phase summary.
+typedef struct {
+    const char* name; // static string naming the phase
+    char detail[48]; // page slug, collection name, ...
+    u64 start_ns; // relative to `trace.start_ns`
+    u64 dur_ns;
+    u32 tid;
+} TraceEvent;
+
+typedef struct {
+    const char* name;
+    char detail[48];
+    u64 value;
+} TraceCounter;
+
+typedef struct {
+    bool enabled;
+    u64 start_ns;
+    pthread_mutex_t mutex;
+    Arena events; // TraceEvent array, grows in place
+    u32 event_count;
+    Arena counters; // TraceCounter array, grows in place
+    u32 counter_count;
+    _Atomic u64 bytes_read;
+    _Atomic u64 bytes_written;
+} Trace;
+
+Trace trace = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// Small per-thread id, set for pool workers so spans land on separate tracks
+_Thread_local u32 trace_tid;
+
+static inline u64 trace_now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000000000ull + (u64)t.tv_nsec;
+}
+
+void trace_init() {
+    trace.enabled = true;
+    trace.start_ns = trace_now_ns();
+    trace.events = arena_create(GB(4));
+    trace.counters = arena_create(MB(64));
+}
+
+/// @brief Start a span, pass the result to `trace_end`
+static inline u64 trace_begin() {
+    return trace.enabled ? trace_now_ns() : 0;
+}
+
+static void trace_copy_detail(char out[48], const char* detail) {
+    if (!detail) {
+        out[0] = '\0';
+        return;
+    }
+    const u64 len = strnlen(detail, 47);
+    memcpy(out, detail, len);
+    out[len] = '\0';
+}
+
+void trace_end(const char* name, const char* detail, u64 start_ns) {
+    if (!trace.enabled) {
+        return;
+    }
+    const u64 end_ns = trace_now_ns();
+
+    pthread_mutex_lock(&trace.mutex);
+    TraceEvent* ev = arena_push(&trace.events, sizeof(TraceEvent), _Alignof(TraceEvent));
+    ++trace.event_count;
+    pthread_mutex_unlock(&trace.mutex);
+
+    ev->name = name;
+    trace_copy_detail(ev->detail, detail);
+    ev->start_ns = start_ns - trace.start_ns;
+    ev->dur_ns = end_ns - start_ns;
+    ev->tid = trace_tid;
+}
+
+void trace_counter(const char* name, const char* detail, u64 value) {
+    if (!trace.enabled) {
+        return;
+    }
+    pthread_mutex_lock(&trace.mutex);
+    TraceCounter* c = arena_push(&trace.counters, sizeof(TraceCounter), _Alignof(TraceCounter));
+    ++trace.counter_count;
+    pthread_mutex_unlock(&trace.mutex);
+
+    c->name = name;
+    trace_copy_detail(c->detail, detail);
+    c->value = value;
+}
+
+static inline void trace_add_read(u64 bytes) {
+    if (trace.enabled) {
+        atomic_fetch_add_explicit(&trace.bytes_read, bytes, memory_order_relaxed);
+    }
+}
+
+static inline void trace_add_written(u64 bytes) {
+    if (trace.enabled) {
+        atomic_fetch_add_explicit(&trace.bytes_written, bytes, memory_order_relaxed);
+    }
+}
+
+static void trace_json_string(FILE* f, const char* str) {
+    fputc('"', f);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', f);
+            fputc(*str, f);
+        } else if ((u8)*str < 0x20) {
+            fprintf(f, "\\u%04x", *str);
+        } else {
+            fputc(*str, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static bool trace_write_json(FILE* f) {
+    const TraceEvent* events = (const TraceEvent*)trace.events.base;
+    const TraceCounter* counters = (const TraceCounter*)trace.counters.base;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (u32 i = 0; i < trace.event_count; ++i) {
+        const TraceEvent* ev = &events[i];
+        fprintf(f, "{\"name\":");
+        trace_json_string(f, ev->name);
+        fprintf(
+            f,
+            ",\"cat\":\"mksite\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+            ev->start_ns / 1000.0,
+            ev->dur_ns / 1000.0,
+            ev->tid);
+        if (ev->detail[0]) {
+            fprintf(f, ",\"args\":{\"detail\":");
+            trace_json_string(f, ev->detail);
+            fputc('}', f);
+        }
+        fprintf(f, "},\n");
+    }
+
+    const u64 end_us = (trace_now_ns() - trace.start_ns) / 1000;
+    for (u32 i = 0; i < trace.counter_count; ++i) {
+        const TraceCounter* c = &counters[i];
+        fprintf(f, "{\"name\":");
+        trace_json_string(f, c->name);
+        fprintf(f, ",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"args\":{", (unsigned long long)end_us);
+        trace_json_string(f, c->detail[0] ? c->detail : "value");
+        fprintf(f, ":%llu}},\n", (unsigned long long)c->value);
+    }
+    fprintf(
+        f,
+        "{\"name\":\"io\",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,"
+        "\"args\":{\"bytes_read\":%llu,\"bytes_written\":%llu}}\n]}\n",
+        (unsigned long long)end_us,
+        (unsigned long long)atomic_load(&trace.bytes_read),
+        (unsigned long long)atomic_load(&trace.bytes_written));
+    return true;
+}
+
+static bool trace_write_csv(FILE* f, Arena* scratch) {
+    const TraceEvent* events = (const TraceEvent*)trace.events.base;
+    const TraceCounter* counters = (const TraceCounter*)trace.counters.base;
+
+    // Phase names are static strings, so spans of the same phase share a pointer
+    typedef struct {
+        const char* name;
+        u32 count;
+        u64 total_ns;
+        u64 min_ns;
+        u64 max_ns;
+        const char* slowest;
+    } PhaseSummary;
+    PhaseSummary* phases = arena_push(scratch, sizeof(PhaseSummary) * 64, ALIGNMENT);
+    u32 phase_count = 0;
+
+    for (u32 i = 0; i < trace.event_count; ++i) {
+        const TraceEvent* ev = &events[i];
+        PhaseSummary* phase = NULL;
+        for (u32 p = 0; p < phase_count && !phase; ++p) {
+            phase = phases[p].name == ev->name ? &phases[p] : NULL;
+        }
+        if (!phase) {
+            if (phase_count == 64) {
+                continue;
+            }
+            phase = &phases[phase_count++];
+            *phase = (PhaseSummary){.name = ev->name, .min_ns = ev->dur_ns};
+        }
+        ++phase->count;
+        phase->total_ns += ev->dur_ns;
+        if (ev->dur_ns < phase->min_ns) {
+            phase->min_ns = ev->dur_ns;
+        }
+        if (ev->dur_ns >= phase->max_ns) {
+            phase->max_ns = ev->dur_ns;
+            phase->slowest = ev->detail;
+        }
+    }
+
+    // For phases `detail` names the slowest span, for counters it says what was counted
+    fprintf(f, "kind,name,detail,count,total_ms,min_ms,max_ms,value\n");
+    for (u32 p = 0; p < phase_count; ++p) {
+        const PhaseSummary* phase = &phases[p];
+        fprintf(
+            f,
+            "phase,%s,%s,%u,%.3f,%.3f,%.3f,\n",
+            phase->name,
+            phase->slowest ? phase->slowest : "",
+            phase->count,
+            phase->total_ns / 1e6,
+            phase->min_ns / 1e6,
+            phase->max_ns / 1e6);
+    }
+    for (u32 i = 0; i < trace.counter_count; ++i) {
+        fprintf(
+            f,
+            "counter,%s,%s,,,,,%llu\n",
+            counters[i].name,
+            counters[i].detail,
+            (unsigned long long)counters[i].value);
+    }
+    fprintf(
+        f,
+        "counter,bytes_read,,,,,,%llu\ncounter,bytes_written,,,,,,%llu\n",
+        (unsigned long long)atomic_load(&trace.bytes_read),
+        (unsigned long long)atomic_load(&trace.bytes_written));
+    return true;
+}
+
+/// @brief Write everything recorded so far to `path`, as CSV if it ends in `.csv`
+bool trace_write(const char* path, Arena* scratch) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    const u64 len = strlen(path);
+    const bool csv = len > 4 && strcmp(path + len - 4, ".csv") == 0;
+    const bool ok = csv ? trace_write_csv(f, scratch) : trace_write_json(f);
+    return fclose(f) == 0 && ok;
+}
+
+#endif // TRACE_H
@@ -0,0 +1,433 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arena.h"
+#include "base.h"
+#include "buf.h"
+#include "trace.h"
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+// A batch is submitted once this many files or bytes are queued, leaving room in `jobs` for
+// the outputs of the task that filled it
+#define WRITER_BATCH_FILES 48
+#define WRITER_BATCH_BYTES MB(16)
+#define WRITER_MAX_JOBS 64
+// Anything bigger is written straight away, a single io_uring write is limited to 32 bits
+#define WRITER_MAX_QUEUED MB(512)
+
+typedef struct {
+    const char* path;
+    const void* data;
+    u64 len;
+    bool failed;
+} WriteJob;
+
+/// @brief Batched output files for one thread.
+///
+/// On Linux every queued file becomes an openat/write/close chain on a private io_uring, using
+/// a direct descriptor so the three steps never come back to userspace. A whole batch is
+/// submitted with a single `io_uring_enter`. Without io_uring direct descriptors (Linux 5.15),
+/// files are written as soon as they're queued, which on pool workers is the same as the
+/// thread pool doing the writes.
+typedef struct {
+    Arena arena; // queued paths and, by convention, the buffers being written. See `writer_queue`.
+    WriteJob jobs[WRITER_MAX_JOBS];
+    u32 job_count;
+    u64 queued_bytes;
+    u32 failures; // files that couldn't be written, reset by `writer_take_failures`
+    i32 ring_fd; // -1 when writing synchronously
+
+#if defined(__linux__)
+    void* sq_ring;
+    u64 sq_ring_size;
+    void* cq_ring;
+    u64 cq_ring_size;
+    struct io_uring_sqe* sqes;
+    u64 sqes_size;
+    _Atomic u32* sq_head;
+    _Atomic u32* sq_tail;
+    u32 sq_mask;
+    u32* sq_array;
+    _Atomic u32* cq_head;
+    _Atomic u32* cq_tail;
+    u32 cq_mask;
+    struct io_uring_cqe* cqes;
+#endif
+} Writer;
+
+#if defined(__linux__)
+static void writer_close_ring(Writer* w) {
+    if (w->sqes) {
+        munmap(w->sqes, w->sqes_size);
+    }
+    if (w->cq_ring && w->cq_ring != w->sq_ring) {
+        munmap(w->cq_ring, w->cq_ring_size);
+    }
+    if (w->sq_ring) {
+        munmap(w->sq_ring, w->sq_ring_size);
+    }
+    close(w->ring_fd);
+    w->ring_fd = -1;
+}
+
+static struct io_uring_sqe* writer_next_sqe(Writer* w, u32* tail) {
+    struct io_uring_sqe* sqe = &w->sqes[*tail & w->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    w->sq_array[*tail & w->sq_mask] = *tail & w->sq_mask;
+    ++*tail;
+    return sqe;
+}
+
+/// @brief Check that the kernel opens files straight into direct-descriptor slots.
+///
+/// That takes Linux 5.15. Kernels from 5.6 on know the opcodes but ignore `file_index`, so an
+/// open hands back a regular descriptor that would never be closed, and the write on the slot
+/// fails. So besides probing the opcodes, one file is opened into a slot and closed by slot.
+static bool writer_probe_direct(Writer* w) {
+    union {
+        struct io_uring_probe probe;
+        char bytes[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+    } p;
+    memset(&p, 0, sizeof(p));
+    if (syscall(__NR_io_uring_register, w->ring_fd, IORING_REGISTER_PROBE, &p.probe, 256) < 0) {
+        return false;
+    }
+    const u8 ops[] = {IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE};
+    for (u32 i = 0; i < sizeof(ops); ++i) {
+        if (ops[i] > p.probe.last_op || !(p.probe.ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+
+    // With stdin closed an ignored `file_index` could hand back fd 0, which looks like success
+    const bool stdin_open = fcntl(0, F_GETFD) != -1;
+    u32 tail = atomic_load_explicit(w->sq_tail, memory_order_relaxed);
+    struct io_uring_sqe* open_sqe = writer_next_sqe(w, &tail);
+    open_sqe->opcode = IORING_OP_OPENAT;
+    open_sqe->fd = AT_FDCWD;
+    open_sqe->addr = (u64)(uintptr_t)"/";
+    open_sqe->open_flags = O_RDONLY;
+    open_sqe->file_index = 1;
+    open_sqe->user_data = 0;
+    struct io_uring_sqe* close_sqe = writer_next_sqe(w, &tail);
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->file_index = 1;
+    close_sqe->user_data = 1;
+    atomic_store_explicit(w->sq_tail, tail, memory_order_release);
+
+    i32 res[2] = {-1, -1};
+    u32 to_submit = 2;
+    u32 pending = 2;
+    while (pending > 0) {
+        const long rc = syscall(
+            __NR_io_uring_enter, w->ring_fd, to_submit, pending, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        to_submit -= (u32)rc < to_submit ? (u32)rc : to_submit;
+
+        u32 head = atomic_load_explicit(w->cq_head, memory_order_relaxed);
+        const u32 cq_tail = atomic_load_explicit(w->cq_tail, memory_order_acquire);
+        for (; head != cq_tail; ++head, --pending) {
+            const struct io_uring_cqe* cqe = &w->cqes[head & w->cq_mask];
+            res[cqe->user_data & 1] = cqe->res;
+        }
+        atomic_store_explicit(w->cq_head, head, memory_order_release);
+    }
+
+    const bool direct = res[0] == 0 && res[1] == 0;
+    if (res[0] > 0 || (res[0] == 0 && !direct && !stdin_open)) {
+        close(res[0]); // a regular descriptor, `file_index` was ignored
+    }
+    return direct;
+}
+
+static bool writer_open_ring(Writer* w) {
+    struct io_uring_params params = {0};
+    w->ring_fd = (i32)syscall(__NR_io_uring_setup, 4 * WRITER_MAX_JOBS, &params);
+    if (w->ring_fd < 0) {
+        w->ring_fd = -1;
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        writer_close_ring(w);
+        return false;
+    }
+
+    w->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    w->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (w->cq_ring_size > w->sq_ring_size) {
+        w->sq_ring_size = w->cq_ring_size;
+    }
+    w->sq_ring = mmap(
+        NULL,
+        w->sq_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        w->ring_fd,
+        IORING_OFF_SQ_RING);
+    if (w->sq_ring == MAP_FAILED) {
+        w->sq_ring = NULL;
+        writer_close_ring(w);
+        return false;
+    }
+    w->cq_ring = w->sq_ring;
+
+    w->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    w->sqes = mmap(
+        NULL,
+        w->sqes_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        w->ring_fd,
+        IORING_OFF_SQES);
+    if (w->sqes == MAP_FAILED) {
+        w->sqes = NULL;
+        writer_close_ring(w);
+        return false;
+    }
+
+    char* sq = w->sq_ring;
+    w->sq_head = (_Atomic u32*)(sq + params.sq_off.head);
+    w->sq_tail = (_Atomic u32*)(sq + params.sq_off.tail);
+    w->sq_mask = *(u32*)(sq + params.sq_off.ring_mask);
+    w->sq_array = (u32*)(sq + params.sq_off.array);
+    char* cq = w->cq_ring;
+    w->cq_head = (_Atomic u32*)(cq + params.cq_off.head);
+    w->cq_tail = (_Atomic u32*)(cq + params.cq_off.tail);
+    w->cq_mask = *(u32*)(cq + params.cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // One empty direct-descriptor slot per file in a batch
+    i32 slots[WRITER_MAX_JOBS];
+    memset(slots, 0xff, sizeof(slots));
+    if (syscall(__NR_io_uring_register, w->ring_fd, IORING_REGISTER_FILES, slots,
+                WRITER_MAX_JOBS) < 0 ||
+        !writer_probe_direct(w)) {
+        writer_close_ring(w);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Submit every queued job and wait for all of them, marking the ones that failed
+static void writer_submit(Writer* w) {
+    u32 tail = atomic_load_explicit(w->sq_tail, memory_order_relaxed);
+    for (u32 i = 0; i < w->job_count; ++i) {
+        const WriteJob* job = &w->jobs[i];
+
+        struct io_uring_sqe* open_sqe = writer_next_sqe(w, &tail);
+        open_sqe->opcode = IORING_OP_OPENAT;
+        open_sqe->fd = AT_FDCWD;
+        open_sqe->addr = (u64)(uintptr_t)job->path;
+        open_sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        open_sqe->len = 0644;
+        open_sqe->file_index = i + 1; // 1-based, 0 would mean a regular descriptor
+        open_sqe->flags = IOSQE_IO_LINK;
+        open_sqe->user_data = (u64)i * 3;
+
+        struct io_uring_sqe* write_sqe = writer_next_sqe(w, &tail);
+        write_sqe->opcode = IORING_OP_WRITE;
+        write_sqe->fd = (i32)i;
+        write_sqe->addr = (u64)(uintptr_t)job->data;
+        write_sqe->len = (u32)job->len;
+        write_sqe->off = 0;
+        write_sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        write_sqe->user_data = (u64)i * 3 + 1;
+
+        struct io_uring_sqe* close_sqe = writer_next_sqe(w, &tail);
+        close_sqe->opcode = IORING_OP_CLOSE;
+        close_sqe->file_index = i + 1;
+        close_sqe->user_data = (u64)i * 3 + 2;
+    }
+    atomic_store_explicit(w->sq_tail, tail, memory_order_release);
+
+    u32 to_submit = w->job_count * 3;
+    u32 pending = to_submit;
+    while (pending > 0) {
+        const long rc = syscall(
+            __NR_io_uring_enter, w->ring_fd, to_submit, pending, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The ring itself is broken. Let the caller rewrite everything synchronously.
+            for (u32 i = 0; i < w->job_count; ++i) {
+                w->jobs[i].failed = true;
+            }
+            writer_close_ring(w);
+            return;
+        }
+        to_submit -= (u32)rc < to_submit ? (u32)rc : to_submit;
+
+        u32 head = atomic_load_explicit(w->cq_head, memory_order_relaxed);
+        const u32 cq_tail = atomic_load_explicit(w->cq_tail, memory_order_acquire);
+        for (; head != cq_tail; ++head, --pending) {
+            const struct io_uring_cqe* cqe = &w->cqes[head & w->cq_mask];
+            WriteJob* job = &w->jobs[cqe->user_data / 3];
+            const bool is_write = cqe->user_data % 3 == 1;
+            if (cqe->user_data % 3 == 0 && cqe->res > 0) {
+                // Opens into a slot return 0, never leak a regular descriptor if one shows up
+                close(cqe->res);
+                job->failed = true;
+            } else if (cqe->res < 0 || (is_write && (u64)cqe->res != job->len)) {
+                job->failed = true;
+            } else if (is_write) {
+                trace_add_written(job->len);
+            }
+        }
+        atomic_store_explicit(w->cq_head, head, memory_order_release);
+    }
+}
+#endif
+
+void writer_init(Writer* w) {
+    *w = (Writer){.arena = arena_create(GB(4)), .ring_fd = -1};
+#if defined(__linux__)
+    writer_open_ring(w);
+#endif
+}
+
+void writer_release(Writer* w) {
+#if defined(__linux__)
+    if (w->ring_fd >= 0) {
+        writer_close_ring(w);
+    }
+#endif
+    arena_release(&w->arena);
+}
+
+/// @brief Write everything queued so far, returns false if any file couldn't be written
+bool writer_flush(Writer* w) {
+    if (w->job_count == 0) {
+        arena_clear(&w->arena);
+        return true;
+    }
+
+#if defined(__linux__)
+    if (w->ring_fd >= 0) {
+        writer_submit(w);
+    }
+#endif
+
+    // Anything io_uring couldn't do (an old kernel, a short write) gets a second, plain try
+    bool ok = true;
+    for (u32 i = 0; i < w->job_count; ++i) {
+        const WriteJob* job = &w->jobs[i];
+        if (job->failed && !write_file(job->path, job->data, job->len)) {
+            LOG_ERROR("Failed to write %s\n", job->path);
+            ++w->failures;
+            ok = false;
+        }
+    }
+    w->job_count = 0;
+    w->queued_bytes = 0;
+    arena_clear(&w->arena);
+    return ok;
+}
+
+/// @brief Queue `data` to be written to `path`.
+///
+/// `data` has to stay untouched until the batch is flushed by `writer_flush` or
+/// `writer_flush_if_full`, allocating it from `w->arena` makes that automatic. Failures are
+/// logged and counted in `w->failures`, so callers usually only check `writer_take_failures`.
+bool writer_queue(Writer* w, const char* path, const void* data, u64 len) {
+    if (w->ring_fd < 0 || len > WRITER_MAX_QUEUED || w->job_count == WRITER_MAX_JOBS) {
+        if (!write_file(path, data, len)) {
+            LOG_ERROR("Failed to write %s\n", path);
+            ++w->failures;
+            return false;
+        }
+        return true;
+    }
+
+    const u64 path_len = strlen(path);
+    char* path_copy = arena_push(&w->arena, path_len + 1, 1);
+    memcpy(path_copy, path, path_len + 1);
+    w->jobs[w->job_count++] = (WriteJob){.path = path_copy, .data = data, .len = len};
+    w->queued_bytes += len;
+    return true;
+}
+
+/// @brief Flush once a batch has filled up. Only call it once queued buffers are done with.
+bool writer_flush_if_full(Writer* w) {
+    if (w->job_count >= WRITER_BATCH_FILES || w->queued_bytes >= WRITER_BATCH_BYTES) {
+        return writer_flush(w);
+    }
+    return true;
+}
+
+/// @brief Number of files that failed since the last call
+u32 writer_take_failures(Writer* w) {
+    const u32 failures = w->failures;
+    w->failures = 0;
+    return failures;
+}
+
+/// @brief Copy the file at `src` to `dst`, inside the kernel where the platform allows it
+bool copy_file(const char* src, const char* dst) {
+    int in = open(src, O_RDONLY);
+    if (in < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    u64 left = (u64)st.st_size;
+    bool ok = true;
+#if defined(__linux__)
+    // copy_file_range can reflink on filesystems that support it, sendfile works everywhere else
+    while (left > 0) {
+        ssize_t n = syscall(__NR_copy_file_range, in, NULL, out, NULL, left, 0);
+        if (n <= 0) {
+            break;
+        }
+        left -= (u64)n;
+    }
+    while (left > 0) {
+        ssize_t n = sendfile(out, in, NULL, left);
+        if (n <= 0) {
+            break;
+        }
+        left -= (u64)n;
+    }
+#endif
+    trace_add_written((u64)st.st_size - left); // the fallback below counts its own writes
+
+    char chunk[KB(64)];
+    while (left > 0) {
+        const ssize_t n = read(in, chunk, sizeof(chunk));
+        if (n <= 0 || !write_all(out, chunk, (u64)n)) {
+            ok = false;
+            break;
+        }
+        left -= (u64)n;
+    }
+
+    close(in);
+    return close(out) == 0 && ok;
+}
+
+#endif // WRITER_H